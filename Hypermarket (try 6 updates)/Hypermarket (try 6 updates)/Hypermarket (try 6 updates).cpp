@@ -1,249 +1,1518 @@
-﻿#include <iostream>
-#include <vector>
-#include <string>
-#include <stdexcept>
-
-class Product {
-protected:
-    std::string company;
-    std::string title;
-    double price;
-    double maxDiscount;
-
-public:
-    Product(const std::string& company, const std::string& title, double price, double maxDiscount)
-        : company(company), title(title), price(price), maxDiscount(maxDiscount) {
-
-        if (company.empty()) {
-            throw std::invalid_argument("Company cannot be empty");
-        }
-        if (title.empty()) {
-            throw std::invalid_argument("Title cannot be empty");
-        }
-        if (price < 0) {
-            throw std::invalid_argument("Price cannot be negative");
-        }
-        if (maxDiscount < 0 || maxDiscount > 1) {
-            throw std::invalid_argument("Invalid maximum discount");
-        }
-    }
-
-    virtual ~Product() {}
-
-    const std::string& getCompany() const {
-        return company;
-    }
-
-    const std::string& getTitle() const {
-        return title;
-    }
-
-    double getPrice() const {
-        return price;
-    }
-
-    double getMaxDiscount() const {
-        return maxDiscount;
-    }
-
-    virtual double calculateDiscount(double customerDiscount) const {
-        double applicableDiscount = std::min(customerDiscount, maxDiscount);
-        return price * (1 - applicableDiscount);
-    }
-};
-
-class HouseholdAppliance : public Product {
-public:
-    HouseholdAppliance(const std::string& company, const std::string& title, double price, double maxDiscount)
-        : Product(company, title, price, maxDiscount) {}
-};
-
-class VacuumCleaner : public HouseholdAppliance {
-public:
-    VacuumCleaner(const std::string& company, const std::string& title, double price, double maxDiscount)
-        : HouseholdAppliance(company, title, price, maxDiscount) {}
-};
-
-class Camera : public Product {
-public:
-    Camera(const std::string& company, const std::string& title, double price, double maxDiscount)
-        : Product(company, title, price, maxDiscount) {}
-};
-
-class DSLRCamera : public Camera {
-public:
-    DSLRCamera(const std::string& company, const std::string& title, double price, double maxDiscount)
-        : Camera(company, title, price, maxDiscount) {}
-};
-
-class Laptop : public Product {
-private:
-    double screenSize;
-    double weight;
-    int processorCores;
-    double memory;
-
-public:
-    Laptop(const std::string& company, const std::string& title, double price, double maxDiscount,
-        double screenSize, double weight, int processorCores, double memory)
-        : Product(company, title, price, maxDiscount),
-        screenSize(screenSize), weight(weight), processorCores(processorCores), memory(memory) {
-
-        if (screenSize < 0) {
-            throw std::invalid_argument("Screen size cannot be negative");
-        }
-
-        if (weight < 0) {
-            throw std::invalid_argument("Weight cannot be negative");
-        }
-
-        if (processorCores < 0) {
-            throw std::invalid_argument("Processor cores cannot be negative");
-        }
-        if (memory < 0) {
-            throw std::invalid_argument("Memory cannot be negative");
-        }
-    }
-};
-
-class Customer {
-protected:
-    double money;
-    double customerDiscount;
-
-public:
-    Customer(double money) : money(money) {
-
-        if (money < 0) {
-            throw std::invalid_argument("Money cannot be negative");
-        }
-    }
-
-    virtual ~Customer() {}
-
-    double getMoney() const {
-        return money;
-    }
-
-    virtual double calculateIndividualDiscount() const {
-        return 0.0;
-    }
-
-    virtual bool buyProduct(const Product& product) {
-        customerDiscount = this->calculateIndividualDiscount();
-        double discountedPrice = product.calculateDiscount(customerDiscount);
-
-        if (money >= discountedPrice) {
-            money -= discountedPrice;
-            return true;
-        }
-        else {
-            std::cout << "Insufficient funds." << std::endl;
-            return false;
-        }
-    }
-};
-
-class RegularCustomer : public Customer {
-private:
-    std::string fullName;
-    double totalPurchaseCost;
-
-public:
-    RegularCustomer(const std::string& fullName, double money)
-        : Customer(money), fullName(fullName), totalPurchaseCost(0.0) {
-
-        if (fullName.empty()) {
-            throw std::invalid_argument("Full name cannot be empty");
-        }
-    }
-
-    const std::string& getFullName() const {
-        return fullName;
-    }
-
-    double getTotalPurchaseCost() const {
-        return totalPurchaseCost;
-    }
-
-    double calculateIndividualDiscount() const override {
-        double discount = totalPurchaseCost / 1000.0 / 100;
-        return (discount <= 0.15) ? discount : 0.15;
-    }
-
-    bool buyProduct(const Product& product) override {
-        customerDiscount = calculateIndividualDiscount();
-        return Customer::buyProduct(product);
-    }
-
-    void updateTotalPurchaseCost(double purchaseCost) {
-        totalPurchaseCost += purchaseCost;
-    }
-};
-
-int main() {
-    try {
-        std::vector<Product*> products;
-
-        HouseholdAppliance appliance1("Samsung", "Washing Machine", 500.0, 0.0);
-        products.push_back(&appliance1);
-
-        VacuumCleaner vacuumCleaner1("Philips", "Vacuum Cleaner", 150.0, 0.2);
-        products.push_back(&vacuumCleaner1);
-
-        Camera camera1("Canon", "Digital Camera", 300.0, 0.15);
-        products.push_back(&camera1);
-
-        DSLRCamera dslrCamera1("Nikon", "DSLR Camera", 800.0, 0.25);
-        products.push_back(&dslrCamera1);
-
-        Laptop laptop1("HP", "Laptop", 1000.0, 0.2, 15.6, 2.5, 4, 8.0);
-        products.push_back(&laptop1);
-
-        std::vector<Customer*> customers;
-
-        RegularCustomer regularCustomer1("John Doe", 2000.0);
-        customers.push_back(&regularCustomer1);
-
-        RegularCustomer regularCustomer2("Jane Doe", 2500.0);
-        customers.push_back(&regularCustomer2);
-
-        Customer customer1(1500.0);
-        customers.push_back(&customer1);
-
-
-        for (Customer* customer : customers) {
-            std::cout << "------------------------------" << std::endl;
-            RegularCustomer* regularCustomer = dynamic_cast<RegularCustomer*>(customer);
-            if (regularCustomer) {
-                std::cout << "Regular Customer: " << regularCustomer->getFullName() << std::endl;
-            }
-            else {
-                std::cout << "Customer" << std::endl;
-            }
-            std::cout << "Initial Balance: " << customer->getMoney() << std::endl;
-            std::cout << "------------------------------" << std::endl;
-
-            for (const auto& product : products) {
-                std::cout << "Product: " << product->getCompany() << " - " << product->getTitle() << std::endl;
-                if (customer->buyProduct(*product))
-                {
-                    std::cout << "Purchase successful!" << std::endl;
-                    if (regularCustomer) {
-                        regularCustomer->updateTotalPurchaseCost(product->getPrice());
-                    }
-                }
-                else {
-                    std::cout << "Purchase failed." << std::endl;
-                }
-                std::cout << "Remaining Balance: " << customer->getMoney() << std::endl;
-                std::cout << "------------------------------" << std::endl;
-            }
-        }
-    }
-    catch (std::invalid_argument& ex) {
-        std::cerr << "Error: " << ex.what() << std::endl;
-    }
-
-    return 0;
-}
+﻿#include <iostream>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+#include <cstddef>
+#include <variant>
+#include <type_traits>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <fstream>
+#include <iomanip>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define HYPERMARKET_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only emit AVX instructions inside functions marked for them;
+// MSVC accepts the intrinsics anywhere.
+#if defined(HYPERMARKET_X86) && (defined(__GNUC__) || defined(__clang__))
+#define PRICING_TARGET(isa) __attribute__((target(isa)))
+#else
+#define PRICING_TARGET(isa)
+#endif
+
+// Concrete class of a product; the attribute catalog keeps one table per category.
+enum class ProductCategory {
+    Product,
+    HouseholdAppliance,
+    VacuumCleaner,
+    Camera,
+    DSLRCamera,
+    Laptop,
+    Count
+};
+
+inline const char* productCategoryName(ProductCategory category) {
+    switch (category) {
+    case ProductCategory::HouseholdAppliance: return "HouseholdAppliance";
+    case ProductCategory::VacuumCleaner: return "VacuumCleaner";
+    case ProductCategory::Camera: return "Camera";
+    case ProductCategory::DSLRCamera: return "DSLRCamera";
+    case ProductCategory::Laptop: return "Laptop";
+    default: return "Product";
+    }
+}
+
+inline ProductCategory parseProductCategory(const std::string& name) {
+    for (size_t c = 0; c < static_cast<size_t>(ProductCategory::Count); ++c) {
+        ProductCategory category = static_cast<ProductCategory>(c);
+        if (name == productCategoryName(category)) {
+            return category;
+        }
+    }
+    throw std::invalid_argument("Unknown category: " + name);
+}
+
+class Product {
+    // Repricing goes through PriceIndex::setPrice, which keeps the index sorted.
+    friend class PriceIndex;
+
+protected:
+    std::string company;
+    std::string title;
+    double price;
+    double maxDiscount;
+
+public:
+    Product(const std::string& company, const std::string& title, double price, double maxDiscount)
+        : company(company), title(title), price(price), maxDiscount(maxDiscount) {
+
+        if (company.empty()) {
+            throw std::invalid_argument("Company cannot be empty");
+        }
+        if (title.empty()) {
+            throw std::invalid_argument("Title cannot be empty");
+        }
+        if (price < 0) {
+            throw std::invalid_argument("Price cannot be negative");
+        }
+        if (maxDiscount < 0 || maxDiscount > 1) {
+            throw std::invalid_argument("Invalid maximum discount");
+        }
+    }
+
+    virtual ~Product() {}
+
+    const std::string& getCompany() const {
+        return company;
+    }
+
+    const std::string& getTitle() const {
+        return title;
+    }
+
+    double getPrice() const {
+        return price;
+    }
+
+    double getMaxDiscount() const {
+        return maxDiscount;
+    }
+
+    // Non-virtual so static-dispatch checkout loops can inline the price math.
+    double discountedPrice(double customerDiscount) const {
+        double applicableDiscount = std::min(customerDiscount, maxDiscount);
+        return price * (1 - applicableDiscount);
+    }
+
+    virtual double calculateDiscount(double customerDiscount) const {
+        return discountedPrice(customerDiscount);
+    }
+
+    virtual ProductCategory getCategory() const {
+        return ProductCategory::Product;
+    }
+
+private:
+    void setPrice(double newPrice) {
+        if (newPrice < 0) {
+            throw std::invalid_argument("Price cannot be negative");
+        }
+        price = newPrice;
+    }
+};
+
+class HouseholdAppliance : public Product {
+public:
+    HouseholdAppliance(const std::string& company, const std::string& title, double price, double maxDiscount)
+        : Product(company, title, price, maxDiscount) {}
+
+    ProductCategory getCategory() const override {
+        return ProductCategory::HouseholdAppliance;
+    }
+};
+
+class VacuumCleaner : public HouseholdAppliance {
+public:
+    VacuumCleaner(const std::string& company, const std::string& title, double price, double maxDiscount)
+        : HouseholdAppliance(company, title, price, maxDiscount) {}
+
+    ProductCategory getCategory() const override {
+        return ProductCategory::VacuumCleaner;
+    }
+};
+
+class Camera : public Product {
+public:
+    Camera(const std::string& company, const std::string& title, double price, double maxDiscount)
+        : Product(company, title, price, maxDiscount) {}
+
+    ProductCategory getCategory() const override {
+        return ProductCategory::Camera;
+    }
+};
+
+class DSLRCamera : public Camera {
+public:
+    DSLRCamera(const std::string& company, const std::string& title, double price, double maxDiscount)
+        : Camera(company, title, price, maxDiscount) {}
+
+    ProductCategory getCategory() const override {
+        return ProductCategory::DSLRCamera;
+    }
+};
+
+class Laptop : public Product {
+private:
+    double screenSize;
+    double weight;
+    int processorCores;
+    double memory;
+
+public:
+    Laptop(const std::string& company, const std::string& title, double price, double maxDiscount,
+        double screenSize, double weight, int processorCores, double memory)
+        : Product(company, title, price, maxDiscount),
+        screenSize(screenSize), weight(weight), processorCores(processorCores), memory(memory) {
+
+        if (screenSize < 0) {
+            throw std::invalid_argument("Screen size cannot be negative");
+        }
+
+        if (weight < 0) {
+            throw std::invalid_argument("Weight cannot be negative");
+        }
+
+        if (processorCores < 0) {
+            throw std::invalid_argument("Processor cores cannot be negative");
+        }
+        if (memory < 0) {
+            throw std::invalid_argument("Memory cannot be negative");
+        }
+    }
+
+    double getScreenSize() const {
+        return screenSize;
+    }
+
+    double getWeight() const {
+        return weight;
+    }
+
+    int getProcessorCores() const {
+        return processorCores;
+    }
+
+    double getMemory() const {
+        return memory;
+    }
+
+    ProductCategory getCategory() const override {
+        return ProductCategory::Laptop;
+    }
+};
+
+// Structure-of-arrays copy of the catalog for bulk repricing and what-if runs.
+class PriceColumns {
+private:
+    std::vector<double> prices;
+    std::vector<double> maxDiscounts;
+
+public:
+    void add(const Product& product) {
+        prices.push_back(product.getPrice());
+        maxDiscounts.push_back(product.getMaxDiscount());
+    }
+
+    size_t size() const {
+        return prices.size();
+    }
+
+    const double* price() const {
+        return prices.data();
+    }
+
+    const double* maxDiscount() const {
+        return maxDiscounts.data();
+    }
+};
+
+enum class PricingKernel {
+    Scalar,
+    AVX2,
+    AVX512
+};
+
+inline const char* pricingKernelName(PricingKernel kernel) {
+    switch (kernel) {
+    case PricingKernel::AVX512: return "AVX-512";
+    case PricingKernel::AVX2: return "AVX2";
+    default: return "scalar";
+    }
+}
+
+// Picks the widest kernel the CPU and the OS (saved register state) support.
+inline PricingKernel detectPricingKernel() {
+#if defined(HYPERMARKET_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return PricingKernel::Scalar;
+    }
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (!osxsave) {
+        return PricingKernel::Scalar;
+    }
+    unsigned long long xcr0 = _xgetbv(0);
+    __cpuidex(info, 7, 0);
+    bool avx2 = (info[1] & (1 << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+    bool avx512 = (info[1] & (1 << 16)) != 0 && (xcr0 & 0xE6) == 0xE6;
+    if (avx512) {
+        return PricingKernel::AVX512;
+    }
+    return avx2 ? PricingKernel::AVX2 : PricingKernel::Scalar;
+#elif defined(HYPERMARKET_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return PricingKernel::AVX512;
+    }
+    return __builtin_cpu_supports("avx2") ? PricingKernel::AVX2 : PricingKernel::Scalar;
+#else
+    return PricingKernel::Scalar;
+#endif
+}
+
+// Same expression as Product::calculateDiscount; the vector kernels use it for the tail.
+inline void priceRowScalar(const double* price, const double* maxDiscount, size_t begin, size_t count,
+    double customerDiscount, double* out) {
+    for (size_t i = begin; i < count; ++i) {
+        double applicableDiscount = std::min(customerDiscount, maxDiscount[i]);
+        out[i] = price[i] * (1 - applicableDiscount);
+    }
+}
+
+#ifdef HYPERMARKET_X86
+// min_pd(a, b) returns b unless a < b, exactly like std::min(b, a), and the
+// subtraction and multiplication are rounded separately as in the scalar code,
+// so every lane is bit-identical to Product::calculateDiscount.
+PRICING_TARGET("avx2")
+inline void priceRowAVX2(const double* price, const double* maxDiscount, size_t count,
+    double customerDiscount, double* out) {
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d customer = _mm256_set1_pd(customerDiscount);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256d applicable = _mm256_min_pd(_mm256_loadu_pd(maxDiscount + i), customer);
+        __m256d discounted = _mm256_mul_pd(_mm256_loadu_pd(price + i), _mm256_sub_pd(one, applicable));
+        _mm256_storeu_pd(out + i, discounted);
+    }
+    priceRowScalar(price, maxDiscount, i, count, customerDiscount, out);
+}
+
+PRICING_TARGET("avx512f")
+inline void priceRowAVX512(const double* price, const double* maxDiscount, size_t count,
+    double customerDiscount, double* out) {
+    const __m512d one = _mm512_set1_pd(1.0);
+    const __m512d customer = _mm512_set1_pd(customerDiscount);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m512d applicable = _mm512_min_pd(_mm512_loadu_pd(maxDiscount + i), customer);
+        __m512d discounted = _mm512_mul_pd(_mm512_loadu_pd(price + i), _mm512_sub_pd(one, applicable));
+        _mm512_storeu_pd(out + i, discounted);
+    }
+    priceRowScalar(price, maxDiscount, i, count, customerDiscount, out);
+}
+#endif
+
+// Prices every product for every customer discount:
+// out[c * products.size() + i] = price[i] * (1 - min(customerDiscounts[c], maxDiscount[i])).
+inline void calculateDiscountBatch(const PriceColumns& products, const std::vector<double>& customerDiscounts,
+    std::vector<double>& out, PricingKernel kernel = detectPricingKernel()) {
+    const size_t count = products.size();
+    out.resize(count * customerDiscounts.size());
+
+    for (size_t c = 0; c < customerDiscounts.size(); ++c) {
+        double* row = out.data() + c * count;
+        switch (kernel) {
+#ifdef HYPERMARKET_X86
+        case PricingKernel::AVX512:
+            priceRowAVX512(products.price(), products.maxDiscount(), count, customerDiscounts[c], row);
+            break;
+        case PricingKernel::AVX2:
+            priceRowAVX2(products.price(), products.maxDiscount(), count, customerDiscounts[c], row);
+            break;
+#endif
+        default:
+            priceRowScalar(products.price(), products.maxDiscount(), 0, count, customerDiscounts[c], row);
+            break;
+        }
+    }
+}
+
+// Lowest set bit of a non-zero bitmap word.
+inline unsigned lowestSetBit(uint64_t word) {
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return index;
+#elif defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(__builtin_ctzll(word));
+#else
+    unsigned index = 0;
+    while ((word & 1) == 0) {
+        word >>= 1;
+        ++index;
+    }
+    return index;
+#endif
+}
+
+// Attribute filters: each clears the bitmap bits of rows whose value lies outside
+// [lo, hi]. One word covers 64 rows; words already cleared by an earlier filter are
+// skipped, so later predicates only read the rows that are still candidates.
+template <typename T>
+inline void filterRangeScalar(const T* column, size_t firstWord, size_t count, T lo, T hi, uint64_t* bits) {
+    for (size_t word = firstWord; word * 64 < count; ++word) {
+        if (bits[word] == 0) {
+            continue;
+        }
+        size_t base = word * 64;
+        size_t end = std::min(count, base + 64);
+        uint64_t keep = 0;
+        for (size_t i = base; i < end; ++i) {
+            keep |= static_cast<uint64_t>(column[i] >= lo && column[i] <= hi) << (i - base);
+        }
+        bits[word] &= keep;
+    }
+}
+
+#ifdef HYPERMARKET_X86
+PRICING_TARGET("avx2")
+inline void filterRangeAVX2(const double* column, size_t count, double lo, double hi, uint64_t* bits) {
+    const __m256d low = _mm256_set1_pd(lo);
+    const __m256d high = _mm256_set1_pd(hi);
+    const size_t words = count / 64;
+    for (size_t word = 0; word < words; ++word) {
+        if (bits[word] == 0) {
+            continue;
+        }
+        const double* rows = column + word * 64;
+        uint64_t keep = 0;
+        for (int i = 0; i < 16; ++i) {
+            __m256d value = _mm256_loadu_pd(rows + 4 * i);
+            __m256d inside = _mm256_and_pd(_mm256_cmp_pd(value, low, _CMP_GE_OQ), _mm256_cmp_pd(value, high, _CMP_LE_OQ));
+            keep |= static_cast<uint64_t>(_mm256_movemask_pd(inside)) << (4 * i);
+        }
+        bits[word] &= keep;
+    }
+    filterRangeScalar(column, words, count, lo, hi, bits);
+}
+
+PRICING_TARGET("avx2")
+inline void filterRangeAVX2(const int32_t* column, size_t count, int32_t lo, int32_t hi, uint64_t* bits) {
+    const __m256i low = _mm256_set1_epi32(lo);
+    const __m256i high = _mm256_set1_epi32(hi);
+    const size_t words = count / 64;
+    for (size_t word = 0; word < words; ++word) {
+        if (bits[word] == 0) {
+            continue;
+        }
+        const int32_t* rows = column + word * 64;
+        uint64_t keep = 0;
+        for (int i = 0; i < 8; ++i) {
+            __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows + 8 * i));
+            __m256i outside = _mm256_or_si256(_mm256_cmpgt_epi32(low, value), _mm256_cmpgt_epi32(value, high));
+            uint64_t outsideMask = static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(outside)));
+            keep |= (~outsideMask & 0xFF) << (8 * i);
+        }
+        bits[word] &= keep;
+    }
+    filterRangeScalar(column, words, count, lo, hi, bits);
+}
+
+PRICING_TARGET("avx512f")
+inline void filterRangeAVX512(const double* column, size_t count, double lo, double hi, uint64_t* bits) {
+    const __m512d low = _mm512_set1_pd(lo);
+    const __m512d high = _mm512_set1_pd(hi);
+    const size_t words = count / 64;
+    for (size_t word = 0; word < words; ++word) {
+        if (bits[word] == 0) {
+            continue;
+        }
+        const double* rows = column + word * 64;
+        uint64_t keep = 0;
+        for (int i = 0; i < 8; ++i) {
+            __m512d value = _mm512_loadu_pd(rows + 8 * i);
+            __mmask8 inside = _mm512_cmp_pd_mask(value, low, _CMP_GE_OQ) & _mm512_cmp_pd_mask(value, high, _CMP_LE_OQ);
+            keep |= static_cast<uint64_t>(inside) << (8 * i);
+        }
+        bits[word] &= keep;
+    }
+    filterRangeScalar(column, words, count, lo, hi, bits);
+}
+
+PRICING_TARGET("avx512f")
+inline void filterRangeAVX512(const int32_t* column, size_t count, int32_t lo, int32_t hi, uint64_t* bits) {
+    const __m512i low = _mm512_set1_epi32(lo);
+    const __m512i high = _mm512_set1_epi32(hi);
+    const size_t words = count / 64;
+    for (size_t word = 0; word < words; ++word) {
+        if (bits[word] == 0) {
+            continue;
+        }
+        const int32_t* rows = column + word * 64;
+        uint64_t keep = 0;
+        for (int i = 0; i < 4; ++i) {
+            __m512i value = _mm512_loadu_si512(rows + 16 * i);
+            __mmask16 inside = _mm512_cmpge_epi32_mask(value, low) & _mm512_cmple_epi32_mask(value, high);
+            keep |= static_cast<uint64_t>(inside) << (16 * i);
+        }
+        bits[word] &= keep;
+    }
+    filterRangeScalar(column, words, count, lo, hi, bits);
+}
+#endif
+
+template <typename T>
+inline void filterRange(const T* column, size_t count, T lo, T hi, uint64_t* bits, PricingKernel kernel) {
+    switch (kernel) {
+#ifdef HYPERMARKET_X86
+    case PricingKernel::AVX512:
+        filterRangeAVX512(column, count, lo, hi, bits);
+        break;
+    case PricingKernel::AVX2:
+        filterRangeAVX2(column, count, lo, hi, bits);
+        break;
+#endif
+    default:
+        filterRangeScalar(column, 0, count, lo, hi, bits);
+        break;
+    }
+}
+
+// One attribute bound of a query; every comparison becomes an inclusive range,
+// so "price>=500 AND price<=1200" is a single pass over the price column.
+struct AttributeRange {
+    std::string attribute;
+    double lo;
+    double hi;
+};
+
+// category=<name> AND <attribute><op><number> AND ..., op is one of < <= = >= >.
+struct AttributeQuery {
+    bool anyCategory = true;
+    ProductCategory category = ProductCategory::Product;
+    std::vector<AttributeRange> ranges;
+};
+
+inline std::string trimmed(const std::string& text) {
+    size_t begin = text.find_first_not_of(" \t");
+    if (begin == std::string::npos) {
+        return "";
+    }
+    size_t end = text.find_last_not_of(" \t");
+    return text.substr(begin, end - begin + 1);
+}
+
+inline AttributeQuery parseAttributeQuery(const std::string& text) {
+    AttributeQuery query;
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t separator = text.find(" AND ", start);
+        std::string term = trimmed(text.substr(start, separator == std::string::npos ? std::string::npos : separator - start));
+        start = separator == std::string::npos ? text.size() + 1 : separator + 5;
+
+        size_t opStart = term.find_first_of("<=>");
+        if (opStart == std::string::npos || opStart == 0) {
+            throw std::invalid_argument("Invalid query term: " + term);
+        }
+        size_t opEnd = term.find_first_not_of("<=>", opStart);
+        std::string name = trimmed(term.substr(0, opStart));
+        std::string op = term.substr(opStart, opEnd == std::string::npos ? std::string::npos : opEnd - opStart);
+        std::string value = trimmed(opEnd == std::string::npos ? "" : term.substr(opEnd));
+
+        if (name == "category") {
+            if (op != "=") {
+                throw std::invalid_argument("Category can only be compared with =");
+            }
+            query.anyCategory = false;
+            query.category = parseProductCategory(value);
+            continue;
+        }
+
+        size_t parsed = 0;
+        double number = 0.0;
+        try {
+            number = std::stod(value, &parsed);
+        }
+        catch (const std::exception&) {
+            parsed = 0;
+        }
+        if (parsed == 0 || parsed != value.size()) {
+            throw std::invalid_argument("Invalid number in query term: " + term);
+        }
+
+        const double infinity = std::numeric_limits<double>::infinity();
+        AttributeRange range{ name, -infinity, infinity };
+        if (op == "<") {
+            range.hi = std::nextafter(number, -infinity);
+        }
+        else if (op == "<=") {
+            range.hi = number;
+        }
+        else if (op == "=") {
+            range.lo = range.hi = number;
+        }
+        else if (op == ">=") {
+            range.lo = number;
+        }
+        else if (op == ">") {
+            range.lo = std::nextafter(number, infinity);
+        }
+        else {
+            throw std::invalid_argument("Invalid comparison in query term: " + term);
+        }
+        query.ranges.push_back(range);
+    }
+    return query;
+}
+
+// Filterable catalog engine: attributes of every product kept in typed columns, one
+// table per category, so a Laptop's cores and memory are stored without copying (or
+// slicing) the Product objects. A query picks the tables of its category, runs one
+// SIMD range filter per attribute over a shared row bitmap and returns the SKUs of
+// the rows left set. A SKU is the position in which the product was added.
+class AttributeCatalog {
+public:
+    enum class AttributeType {
+        Float64,
+        Int32
+    };
+
+    AttributeCatalog() {
+        for (Table& table : tables) {
+            table.addColumn("price", AttributeType::Float64);
+            table.addColumn("discount", AttributeType::Float64);
+        }
+        Table& laptops = tableOf(ProductCategory::Laptop);
+        laptops.addColumn("screen", AttributeType::Float64);
+        laptops.addColumn("weight", AttributeType::Float64);
+        laptops.addColumn("cores", AttributeType::Int32);
+        laptops.addColumn("memory", AttributeType::Float64);
+    }
+
+    // The catalog keeps a pointer: the product must outlive it.
+    size_t add(const Product& product) {
+        const size_t sku = products.size();
+        products.push_back(&product);
+        Table& table = tableOf(product.getCategory());
+        rowOf.push_back(table.skus.size());
+        table.skus.push_back(static_cast<uint32_t>(sku));
+        table.column("price").f64.push_back(product.getPrice());
+        table.column("discount").f64.push_back(product.getMaxDiscount());
+
+        if (product.getCategory() == ProductCategory::Laptop) {
+            const Laptop& laptop = static_cast<const Laptop&>(product);
+            table.column("screen").f64.push_back(laptop.getScreenSize());
+            table.column("weight").f64.push_back(laptop.getWeight());
+            table.column("cores").i32.push_back(laptop.getProcessorCores());
+            table.column("memory").f64.push_back(laptop.getMemory());
+        }
+        return sku;
+    }
+
+    size_t size() const {
+        return products.size();
+    }
+
+    const Product& product(size_t sku) const {
+        return *products[sku];
+    }
+
+    // The price column is a copy: re-reads the price after the product was repriced.
+    // A PriceIndex kept in sync with this catalog calls it from setPrice.
+    void refreshPrice(size_t sku) {
+        const Product& product = *products[sku];
+        tableOf(product.getCategory()).column("price").f64[rowOf[sku]] = product.getPrice();
+    }
+
+    std::vector<size_t> query(const std::string& text, PricingKernel kernel = detectPricingKernel()) const {
+        return query(parseAttributeQuery(text), kernel);
+    }
+
+    // SKUs matching every range of the query, in ascending order.
+    std::vector<size_t> query(const AttributeQuery& query, PricingKernel kernel = detectPricingKernel()) const {
+        for (const AttributeRange& range : query.ranges) {
+            bool known = false;
+            for (const Table& table : tables) {
+                known = known || table.find(range.attribute) != nullptr;
+            }
+            if (!known) {
+                throw std::invalid_argument("Unknown attribute: " + range.attribute);
+            }
+        }
+
+        std::vector<size_t> skus;
+        std::vector<uint64_t> bits;
+        for (size_t c = 0; c < static_cast<size_t>(ProductCategory::Count); ++c) {
+            const Table& table = tables[c];
+            if ((!query.anyCategory && c != static_cast<size_t>(query.category)) || table.skus.empty()) {
+                continue;
+            }
+            const size_t count = table.skus.size();
+            bits.assign((count + 63) / 64, ~uint64_t(0));
+            if (count % 64 != 0) {
+                bits.back() = (uint64_t(1) << (count % 64)) - 1;
+            }
+
+            // A table without one of the attributes has no matching rows.
+            bool matches = true;
+            for (const AttributeRange& range : query.ranges) {
+                const Column* column = table.find(range.attribute);
+                if (column == nullptr) {
+                    matches = false;
+                    break;
+                }
+                if (column->type == AttributeType::Float64) {
+                    filterRange(column->f64.data(), count, range.lo, range.hi, bits.data(), kernel);
+                }
+                else {
+                    double lo = std::max(std::ceil(range.lo), static_cast<double>(std::numeric_limits<int32_t>::min()));
+                    double hi = std::min(std::floor(range.hi), static_cast<double>(std::numeric_limits<int32_t>::max()));
+                    if (lo > hi) {
+                        matches = false;
+                        break;
+                    }
+                    filterRange(column->i32.data(), count, static_cast<int32_t>(lo), static_cast<int32_t>(hi), bits.data(), kernel);
+                }
+            }
+            if (!matches) {
+                continue;
+            }
+
+            for (size_t word = 0; word < bits.size(); ++word) {
+                for (uint64_t rows = bits[word]; rows != 0; rows &= rows - 1) {
+                    skus.push_back(table.skus[word * 64 + lowestSetBit(rows)]);
+                }
+            }
+        }
+        if (query.anyCategory) {
+            std::sort(skus.begin(), skus.end());
+        }
+        return skus;
+    }
+
+private:
+    struct Column {
+        std::string name;
+        AttributeType type;
+        std::vector<double> f64;
+        std::vector<int32_t> i32;
+    };
+
+    // Rows of one category: the SKU of each row and one column per attribute.
+    struct Table {
+        std::vector<uint32_t> skus;
+        std::vector<Column> columns;
+
+        const Column* find(const std::string& name) const {
+            for (const Column& column : columns) {
+                if (column.name == name) {
+                    return &column;
+                }
+            }
+            return nullptr;
+        }
+
+        Column& column(const std::string& name) {
+            return const_cast<Column&>(*find(name));
+        }
+
+        void addColumn(const std::string& name, AttributeType type) {
+            columns.push_back(Column());
+            columns.back().name = name;
+            columns.back().type = type;
+        }
+    };
+
+    std::vector<const Product*> products;
+    std::vector<size_t> rowOf; // SKU -> row in the table of its category
+    Table tables[static_cast<size_t>(ProductCategory::Count)];
+
+    Table& tableOf(ProductCategory category) {
+        return tables[static_cast<size_t>(category)];
+    }
+};
+
+// Discount policies for the closed set of customer tiers. Each is a stateless
+// function of the customer, so a caller that knows the tier at compile time
+// gets the discount inlined; the virtual calculateIndividualDiscount overrides
+// forward here, so both paths share one formula. A new tier adds a policy, a
+// DiscountPolicyOf specialization and an AnyCustomer alternative.
+struct PlainDiscountPolicy {
+    template <typename C>
+    static double individualDiscount(const C&) {
+        return 0.0;
+    }
+};
+
+struct RegularDiscountPolicy {
+    template <typename C>
+    static double individualDiscount(const C& customer) {
+        double discount = customer.getTotalPurchaseCost() / 1000.0 / 100;
+        return (discount <= 0.15) ? discount : 0.15;
+    }
+};
+
+template <typename C>
+struct DiscountPolicyOf;
+
+class Customer {
+protected:
+    double money;
+    double customerDiscount;
+
+    template <typename C>
+    friend bool buyProductStatic(C& customer, const Product& product);
+
+    // The payment step shared by the virtual and static purchase paths.
+    bool pay(double discountedPrice) {
+        if (money >= discountedPrice) {
+            money -= discountedPrice;
+            return true;
+        }
+        else {
+            std::cout << "Insufficient funds." << std::endl;
+            return false;
+        }
+    }
+
+public:
+    Customer(double money) : money(money) {
+
+        if (money < 0) {
+            throw std::invalid_argument("Money cannot be negative");
+        }
+    }
+
+    virtual ~Customer() {}
+
+    double getMoney() const {
+        return money;
+    }
+
+    virtual double calculateIndividualDiscount() const {
+        return PlainDiscountPolicy::individualDiscount(*this);
+    }
+
+    virtual bool buyProduct(const Product& product) {
+        customerDiscount = this->calculateIndividualDiscount();
+        return pay(product.calculateDiscount(customerDiscount));
+    }
+};
+
+class RegularCustomer : public Customer {
+private:
+    std::string fullName;
+    double totalPurchaseCost;
+
+public:
+    RegularCustomer(const std::string& fullName, double money)
+        : Customer(money), fullName(fullName), totalPurchaseCost(0.0) {
+
+        if (fullName.empty()) {
+            throw std::invalid_argument("Full name cannot be empty");
+        }
+    }
+
+    const std::string& getFullName() const {
+        return fullName;
+    }
+
+    double getTotalPurchaseCost() const {
+        return totalPurchaseCost;
+    }
+
+    double calculateIndividualDiscount() const override {
+        return RegularDiscountPolicy::individualDiscount(*this);
+    }
+
+    bool buyProduct(const Product& product) override {
+        customerDiscount = calculateIndividualDiscount();
+        return Customer::buyProduct(product);
+    }
+
+    void updateTotalPurchaseCost(double purchaseCost) {
+        totalPurchaseCost += purchaseCost;
+    }
+};
+
+template <>
+struct DiscountPolicyOf<Customer> {
+    using type = PlainDiscountPolicy;
+};
+
+template <>
+struct DiscountPolicyOf<RegularCustomer> {
+    using type = RegularDiscountPolicy;
+};
+
+// Same result as customer.buyProduct(product), but the tier is known at
+// compile time: no virtual calls, and the discount math inlines.
+template <typename C>
+bool buyProductStatic(C& customer, const Product& product) {
+    using Policy = typename DiscountPolicyOf<C>::type;
+    customer.customerDiscount = Policy::individualDiscount(customer);
+    return customer.pay(product.discountedPrice(customer.customerDiscount));
+}
+
+// A customer of any known tier. Dispatch happens once per visit, so a whole
+// basket can be checked out with the tier fixed for the inner loop.
+using AnyCustomer = std::variant<Customer*, RegularCustomer*>;
+
+inline Customer& customerOf(const AnyCustomer& customer) {
+    return *std::visit([](auto* c) -> Customer* { return c; }, customer);
+}
+
+// Buys every product in order, crediting regular customers' purchase totals
+// as main's loop does; returns the number of successful purchases.
+inline size_t checkoutBasket(const AnyCustomer& customer, const std::vector<Product*>& basket) {
+    return std::visit([&](auto* c) {
+        size_t bought = 0;
+        for (const Product* product : basket) {
+            if (buyProductStatic(*c, *product)) {
+                ++bought;
+                if constexpr (std::is_same_v<std::remove_pointer_t<decltype(c)>, RegularCustomer>) {
+                    c->updateTotalPurchaseCost(product->getPrice());
+                }
+            }
+        }
+        return bought;
+    }, customer);
+}
+
+// Ordered price index answering "what can this customer afford". A product costs
+// price * (1 - min(customerDiscount, maxDiscount)), so among products with the same
+// maxDiscount the price paid grows with the list price. The index keeps one bucket of
+// list prices sorted ascending per distinct maxDiscount; a query cuts the affordable
+// prefix of every bucket by binary search and merges the prefixes by the price paid,
+// O(B log n + k log B) for B buckets and a page of k offers. Repricing moves one entry
+// within its bucket and shifts only the entries between its old and new positions.
+// A SKU is the position in which the product was added; the index keeps a pointer, so
+// the product must outlive it, and prices must be changed through the index. An
+// AttributeCatalog over the same products is kept current with keepInSync.
+class PriceIndex {
+public:
+    // One product of a page, in page order: cheapest to pay first, then cheaper list
+    // price, then lower SKU.
+    struct Offer {
+        size_t sku;
+        double price;     // what the customer pays
+        double listPrice;
+    };
+
+    size_t add(Product& product) {
+        const size_t sku = products.size();
+        size_t b = 0;
+        while (b < buckets.size() && buckets[b].maxDiscount != product.getMaxDiscount()) {
+            ++b;
+        }
+        if (b == buckets.size()) {
+            buckets.push_back({ product.getMaxDiscount(), {}, {} });
+        }
+        products.push_back(&product);
+        bucketOf.push_back(b);
+
+        Bucket& bucket = buckets[b];
+        size_t at = position(bucket, product.getPrice(), sku);
+        bucket.prices.insert(bucket.prices.begin() + at, product.getPrice());
+        bucket.skus.insert(bucket.skus.begin() + at, sku);
+        return sku;
+    }
+
+    void setPrice(size_t sku, double price) {
+        if (price < 0) {
+            throw std::invalid_argument("Price cannot be negative");
+        }
+        Bucket& bucket = buckets[bucketOf[sku]];
+        size_t from = position(bucket, products[sku]->getPrice(), sku);
+        size_t to = position(bucket, price, sku);
+        if (to > from) {
+            --to;
+            std::rotate(bucket.prices.begin() + from, bucket.prices.begin() + from + 1, bucket.prices.begin() + to + 1);
+            std::rotate(bucket.skus.begin() + from, bucket.skus.begin() + from + 1, bucket.skus.begin() + to + 1);
+        }
+        else {
+            std::rotate(bucket.prices.begin() + to, bucket.prices.begin() + from, bucket.prices.begin() + from + 1);
+            std::rotate(bucket.skus.begin() + to, bucket.skus.begin() + from, bucket.skus.begin() + from + 1);
+        }
+        bucket.prices[to] = price;
+        products[sku]->setPrice(price);
+        if (attributes != nullptr) {
+            if (sku >= attributes->size() || &attributes->product(sku) != products[sku]) {
+                throw std::logic_error("PriceIndex and AttributeCatalog SKUs diverged");
+            }
+            attributes->refreshPrice(sku);
+        }
+    }
+
+    // From now on setPrice also updates the price column of the catalog, which must
+    // hold the same products under the same SKUs.
+    void keepInSync(AttributeCatalog& catalog) {
+        if (catalog.size() != products.size()) {
+            throw std::invalid_argument("AttributeCatalog holds different products");
+        }
+        for (size_t sku = 0; sku < products.size(); ++sku) {
+            if (&catalog.product(sku) != products[sku]) {
+                throw std::invalid_argument("AttributeCatalog holds different products");
+            }
+        }
+        attributes = &catalog;
+    }
+
+    size_t size() const {
+        return products.size();
+    }
+
+    const Product& product(size_t sku) const {
+        return *products[sku];
+    }
+
+    // Up to limit offers the customer can pay for out of balance, cheapest first. For
+    // the next page pass the last offer of the previous one as after.
+    std::vector<Offer> affordable(double customerDiscount, double balance, size_t limit,
+        const Offer* after = nullptr) const {
+        struct Head {
+            Offer offer;
+            size_t bucket;
+            size_t index;
+            size_t end;
+        };
+        auto later = [](const Offer& a, const Offer& b) {
+            if (a.price != b.price) return a.price > b.price;
+            if (a.listPrice != b.listPrice) return a.listPrice > b.listPrice;
+            return a.sku > b.sku;
+        };
+        std::vector<Head> heads;
+        heads.reserve(buckets.size());
+        for (size_t b = 0; b < buckets.size(); ++b) {
+            const Bucket& bucket = buckets[b];
+            // Same expression as Product::discountedPrice, so the cut agrees with pay().
+            const double applicableDiscount = std::min(customerDiscount, bucket.maxDiscount);
+            auto offerAt = [&](size_t i) {
+                return Offer{ bucket.skus[i], bucket.prices[i] * (1 - applicableDiscount), bucket.prices[i] };
+            };
+            size_t end = firstIndex(bucket.prices.size(), [&](size_t i) {
+                return bucket.prices[i] * (1 - applicableDiscount) > balance;
+            });
+            size_t begin = after == nullptr ? 0 : firstIndex(end, [&](size_t i) { return later(offerAt(i), *after); });
+            if (begin < end) {
+                heads.push_back({ offerAt(begin), b, begin, end });
+            }
+        }
+
+        auto headLater = [&](const Head& a, const Head& b) { return later(a.offer, b.offer); };
+        std::make_heap(heads.begin(), heads.end(), headLater);
+        std::vector<Offer> page;
+        while (page.size() < limit && !heads.empty()) {
+            std::pop_heap(heads.begin(), heads.end(), headLater);
+            Head& head = heads.back();
+            page.push_back(head.offer);
+            if (++head.index == head.end) {
+                heads.pop_back();
+                continue;
+            }
+            const Bucket& bucket = buckets[head.bucket];
+            head.offer = { bucket.skus[head.index], bucket.prices[head.index] * (1 - std::min(customerDiscount, bucket.maxDiscount)),
+                bucket.prices[head.index] };
+            std::push_heap(heads.begin(), heads.end(), headLater);
+        }
+        return page;
+    }
+
+    std::vector<Offer> affordable(const AnyCustomer& customer, size_t limit, const Offer* after = nullptr) const {
+        const Customer& c = customerOf(customer);
+        return affordable(c.calculateIndividualDiscount(), c.getMoney(), limit, after);
+    }
+
+private:
+    // Products with one maxDiscount, sorted by list price, then SKU.
+    struct Bucket {
+        double maxDiscount;
+        std::vector<double> prices;
+        std::vector<size_t> skus;
+    };
+
+    std::vector<Product*> products;
+    std::vector<size_t> bucketOf;
+    std::vector<Bucket> buckets;
+    AttributeCatalog* attributes = nullptr; // see keepInSync
+
+    // First i in [0, count) for which the monotone predicate holds, or count.
+    template <typename Predicate>
+    static size_t firstIndex(size_t count, Predicate&& holds) {
+        size_t low = 0;
+        while (count > 0) {
+            size_t half = count / 2;
+            if (holds(low + half)) {
+                count = half;
+            }
+            else {
+                low += half + 1;
+                count -= half + 1;
+            }
+        }
+        return low;
+    }
+
+    static size_t position(const Bucket& bucket, double price, size_t sku) {
+        return firstIndex(bucket.prices.size(), [&](size_t i) {
+            return bucket.prices[i] > price || (bucket.prices[i] == price && bucket.skus[i] >= sku);
+        });
+    }
+};
+
+// Times the same checkout through virtual buyProduct and through
+// checkoutBasket; each customer gets a fresh balance large enough that
+// nothing fails, so both loops do identical work.
+void benchmarkDiscountDispatch(size_t customerCount, size_t rounds) {
+    std::vector<Product*> basket;
+    std::vector<Product> catalog;
+    catalog.reserve(64);
+    for (int i = 0; i < 64; ++i) {
+        catalog.emplace_back("Bench", "Item " + std::to_string(i), 10.0 + i, (i % 5) * 0.05);
+    }
+    for (Product& product : catalog) {
+        basket.push_back(&product);
+    }
+    double funds = 1e12;
+
+    auto run = [&](auto&& checkout) {
+        std::vector<Customer> plain;
+        std::vector<RegularCustomer> regular;
+        plain.reserve(customerCount);
+        regular.reserve(customerCount);
+        for (size_t i = 0; i < customerCount; ++i) {
+            plain.emplace_back(funds);
+            regular.emplace_back("Bench " + std::to_string(i), funds);
+        }
+        auto start = std::chrono::steady_clock::now();
+        for (size_t r = 0; r < rounds; ++r) {
+            for (size_t i = 0; i < customerCount; ++i) {
+                checkout(plain[i]);
+                checkout(regular[i]);
+            }
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        double left = 0.0;
+        for (size_t i = 0; i < customerCount; ++i) {
+            left += plain[i].getMoney() + regular[i].getMoney();
+        }
+        return std::make_pair(elapsed.count(), left);
+    };
+
+    auto virtualRun = run([&](Customer& customer) {
+        RegularCustomer* regularCustomer = dynamic_cast<RegularCustomer*>(&customer);
+        for (const Product* product : basket) {
+            if (customer.buyProduct(*product) && regularCustomer) {
+                regularCustomer->updateTotalPurchaseCost(product->getPrice());
+            }
+        }
+    });
+    auto staticRun = run([&](auto& customer) {
+        checkoutBasket(AnyCustomer(&customer), basket);
+    });
+
+    double purchases = 2.0 * customerCount * rounds * basket.size();
+    std::cout << "Discount dispatch, " << purchases << " purchases" << std::endl;
+    std::cout << "  virtual: " << virtualRun.first * 1e9 / purchases << " ns/purchase" << std::endl;
+    std::cout << "  static:  " << staticRun.first * 1e9 / purchases << " ns/purchase" << std::endl;
+    std::cout << "  speedup: " << virtualRun.first / staticRun.first << "x" << std::endl;
+    if (virtualRun.second != staticRun.second) {
+        std::cout << "  MISMATCH: balances differ between paths" << std::endl;
+    }
+}
+
+struct BenchResult {
+    std::string name;
+    size_t iterations;
+    double seconds;
+};
+
+static volatile double benchSink = 0.0; // keeps measured results alive
+
+// Grows the iteration count until one run takes at least minTime, as Google Benchmark does.
+template <typename Body>
+BenchResult runBench(const std::string& name, double minTime, Body&& body) {
+    size_t iterations = 1;
+    for (;;) {
+        auto start = std::chrono::steady_clock::now();
+        body(iterations);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (seconds >= minTime || iterations >= 1000000000) {
+            std::cerr << name << ": " << iterations << " iterations, " << seconds * 1e9 / iterations << " ns" << std::endl;
+            return { name, iterations, seconds };
+        }
+        double factor = seconds > 0 ? minTime * 1.4 / seconds : 10.0;
+        iterations = std::max(iterations + 1, static_cast<size_t>(iterations * std::min(factor, 10.0)));
+    }
+}
+
+// Writes results in Google Benchmark's JSON format, so its compare.py can diff two runs.
+void writeBenchJson(std::ostream& out, const std::vector<BenchResult>& results, unsigned long long seed) {
+    out << "{\n  \"context\": {\n"
+        << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n"
+#ifdef NDEBUG
+        << "    \"library_build_type\": \"release\",\n"
+#else
+        << "    \"library_build_type\": \"debug\",\n"
+#endif
+        << "    \"pricing_kernel\": \"" << pricingKernelName(detectPricingKernel()) << "\",\n"
+        << "    \"seed\": " << seed << "\n"
+        << "  },\n  \"benchmarks\": [";
+    out << std::fixed << std::setprecision(6);
+    for (size_t i = 0; i < results.size(); ++i) {
+        double ns = results[i].seconds * 1e9 / results[i].iterations;
+        out << (i ? ",\n" : "\n")
+            << "    {\n"
+            << "      \"name\": \"" << results[i].name << "\",\n"
+            << "      \"run_name\": \"" << results[i].name << "\",\n"
+            << "      \"run_type\": \"iteration\",\n"
+            << "      \"iterations\": " << results[i].iterations << ",\n"
+            << "      \"real_time\": " << ns << ",\n"
+            << "      \"cpu_time\": " << ns << ",\n"
+            << "      \"time_unit\": \"ns\"\n"
+            << "    }";
+    }
+    out << "\n  ]\n}\n";
+}
+
+// Checkout and pricing benchmarks on a seeded synthetic catalog:
+//   --bench [--bench-out=file] [--bench-seed=N] [--bench-min-time=seconds]
+int runBenchmarks(int argc, char* argv[]) {
+    std::string outPath;
+    unsigned long long seed = 20240601;
+    double minTime = 0.2;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--bench-out=", 0) == 0) {
+            outPath = arg.substr(12);
+        }
+        else if (arg.rfind("--bench-seed=", 0) == 0) {
+            seed = std::stoull(arg.substr(13));
+        }
+        else if (arg.rfind("--bench-min-time=", 0) == 0) {
+            minTime = std::stod(arg.substr(17));
+        }
+    }
+
+    std::mt19937_64 gen(seed);
+    std::uniform_real_distribution<double> priceDist(1.0, 2000.0);
+    std::uniform_int_distribution<int> discountDist(0, 30);
+    std::vector<Product> catalog;
+    catalog.reserve(1024);
+    for (int i = 0; i < 1024; ++i) {
+        catalog.emplace_back("Bench", "Item " + std::to_string(i), priceDist(gen), discountDist(gen) / 100.0);
+    }
+
+    // Balances never run out, so every iteration takes the successful purchase path.
+    const double funds = 1e300;
+    std::vector<BenchResult> results;
+
+    Customer plain(funds);
+    RegularCustomer regular("Bench Customer", funds);
+    std::vector<Customer*> customers = { &plain, &regular };
+    for (Customer* customer : customers) {
+        RegularCustomer* regularCustomer = dynamic_cast<RegularCustomer*>(customer);
+        std::string name = regularCustomer ? "RegularCustomer::buyProduct" : "Customer::buyProduct";
+        results.push_back(runBench(name, minTime, [&](size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                const Product& product = catalog[i & 1023];
+                if (customer->buyProduct(product) && regularCustomer) {
+                    regularCustomer->updateTotalPurchaseCost(product.getPrice());
+                }
+            }
+            benchSink = customer->getMoney();
+        }));
+    }
+
+    std::vector<Product*> basket;
+    for (Product& product : catalog) {
+        basket.push_back(&product);
+    }
+    Customer plainStatic(funds);
+    RegularCustomer regularStatic("Bench Customer", funds);
+    for (AnyCustomer customer : { AnyCustomer(&plainStatic), AnyCustomer(&regularStatic) }) {
+        std::string name = customer.index() == 0 ? "checkoutBasket<Customer>" : "checkoutBasket<RegularCustomer>";
+        // One iteration is one purchase; the basket is walked whole.
+        results.push_back(runBench(name, minTime, [&](size_t n) {
+            for (size_t done = 0; done < n; done += basket.size()) {
+                checkoutBasket(customer, basket);
+            }
+            benchSink = customerOf(customer).getMoney();
+        }));
+        results.back().iterations = (results.back().iterations + basket.size() - 1) / basket.size() * basket.size();
+    }
+
+    PriceColumns columns;
+    for (const Product& product : catalog) {
+        columns.add(product);
+    }
+    std::vector<double> customerDiscounts(64);
+    for (double& discount : customerDiscounts) {
+        discount = discountDist(gen) / 200.0;
+    }
+    std::vector<double> repriced;
+    PricingKernel best = detectPricingKernel();
+    for (PricingKernel kernel : { PricingKernel::Scalar, PricingKernel::AVX2, PricingKernel::AVX512 }) {
+        if (static_cast<int>(kernel) > static_cast<int>(best)) {
+            break;
+        }
+        std::string name = std::string("calculateDiscountBatch/") + pricingKernelName(kernel) + "/1024x64";
+        results.push_back(runBench(name, minTime, [&](size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                calculateDiscountBatch(columns, customerDiscounts, repriced, kernel);
+                benchSink = repriced[i & 1023];
+            }
+        }));
+    }
+
+    // Attribute queries over a million SKUs, categories mixed evenly.
+    const size_t skuCount = 1000000;
+    std::uniform_real_distribution<double> screenDist(11.0, 18.0);
+    std::uniform_real_distribution<double> weightDist(0.9, 3.5);
+    std::uniform_int_distribution<int> coresDist(1, 6);
+    std::uniform_int_distribution<int> memoryDist(2, 6);
+    std::vector<std::unique_ptr<Product>> skus;
+    skus.reserve(skuCount);
+    AttributeCatalog attributes;
+    for (size_t i = 0; i < skuCount; ++i) {
+        std::string title = "Item " + std::to_string(i);
+        double price = priceDist(gen);
+        double maxDiscount = discountDist(gen) / 100.0;
+        switch (i % 5) {
+        case 0: skus.emplace_back(new HouseholdAppliance("Bench", title, price, maxDiscount)); break;
+        case 1: skus.emplace_back(new VacuumCleaner("Bench", title, price, maxDiscount)); break;
+        case 2: skus.emplace_back(new Camera("Bench", title, price, maxDiscount)); break;
+        case 3: skus.emplace_back(new DSLRCamera("Bench", title, price, maxDiscount)); break;
+        default:
+            skus.emplace_back(new Laptop("Bench", title, price, maxDiscount, screenDist(gen), weightDist(gen),
+                2 * coresDist(gen), static_cast<double>(1 << memoryDist(gen))));
+            break;
+        }
+        attributes.add(*skus.back());
+    }
+    const std::pair<const char*, const char*> attributeQueries[] = {
+        { "laptops", "category=Laptop AND cores>=8 AND memory>=16 AND price<=1200" },
+        { "price", "price>=100 AND price<=150" }
+    };
+    for (const auto& query : attributeQueries) {
+        AttributeQuery parsed = parseAttributeQuery(query.second);
+        for (PricingKernel kernel : { PricingKernel::Scalar, PricingKernel::AVX2, PricingKernel::AVX512 }) {
+            if (static_cast<int>(kernel) > static_cast<int>(best)) {
+                break;
+            }
+            std::string name = std::string("AttributeCatalog::query/") + pricingKernelName(kernel) + "/" + query.first + "/1M";
+            results.push_back(runBench(name, minTime, [&](size_t n) {
+                for (size_t i = 0; i < n; ++i) {
+                    benchSink = static_cast<double>(attributes.query(parsed, kernel).size());
+                }
+            }));
+        }
+    }
+
+    // "Affordable for me" pages over the million SKUs, against a full scan with the same answer.
+    PriceIndex prices;
+    for (const std::unique_ptr<Product>& sku : skus) {
+        prices.add(*sku);
+    }
+    prices.keepInSync(attributes);
+    std::uniform_real_distribution<double> balanceDist(50.0, 1500.0);
+    std::vector<std::pair<double, double>> shoppers(1024);
+    for (auto& shopper : shoppers) {
+        shopper = { discountDist(gen) / 200.0, balanceDist(gen) };
+    }
+    const size_t pageSize = 20;
+    results.push_back(runBench("PriceIndex::affordable/page20/1M", minTime, [&](size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            const auto& shopper = shoppers[i & 1023];
+            benchSink = prices.affordable(shopper.first, shopper.second, pageSize).back().price;
+        }
+    }));
+    results.push_back(runBench("PriceIndex::affordable/scan/1M", minTime, [&](size_t n) {
+        std::vector<PriceIndex::Offer> offers;
+        for (size_t i = 0; i < n; ++i) {
+            const auto& shopper = shoppers[i & 1023];
+            offers.clear();
+            for (size_t sku = 0; sku < skus.size(); ++sku) {
+                double paid = skus[sku]->discountedPrice(shopper.first);
+                if (paid <= shopper.second) {
+                    offers.push_back({ sku, paid, skus[sku]->getPrice() });
+                }
+            }
+            std::partial_sort(offers.begin(), offers.begin() + pageSize, offers.end(),
+                [](const PriceIndex::Offer& a, const PriceIndex::Offer& b) {
+                    if (a.price != b.price) return a.price < b.price;
+                    if (a.listPrice != b.listPrice) return a.listPrice < b.listPrice;
+                    return a.sku < b.sku;
+                });
+            benchSink = offers[pageSize - 1].price;
+        }
+    }));
+    // Small price moves, as day-to-day repricing makes them.
+    std::uniform_real_distribution<double> moveDist(0.98, 1.02);
+    results.push_back(runBench("PriceIndex::setPrice/1M", minTime, [&](size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            size_t sku = (i * 7919) % prices.size();
+            prices.setPrice(sku, prices.product(sku).getPrice() * moveDist(gen));
+        }
+    }));
+
+    if (outPath.empty()) {
+        writeBenchJson(std::cout, results, seed);
+        return 0;
+    }
+    std::ofstream out(outPath);
+    writeBenchJson(out, results, seed);
+    if (!out) {
+        std::cerr << "Error: cannot write " << outPath << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && std::strcmp(argv[1], "--bench") == 0) {
+        return runBenchmarks(argc, argv);
+    }
+    if (argc > 1 && std::strcmp(argv[1], "--bench-discount") == 0) {
+        benchmarkDiscountDispatch(1000, 50);
+        return 0;
+    }
+
+    try {
+        std::vector<Product*> products;
+
+        HouseholdAppliance appliance1("Samsung", "Washing Machine", 500.0, 0.0);
+        products.push_back(&appliance1);
+
+        VacuumCleaner vacuumCleaner1("Philips", "Vacuum Cleaner", 150.0, 0.2);
+        products.push_back(&vacuumCleaner1);
+
+        Camera camera1("Canon", "Digital Camera", 300.0, 0.15);
+        products.push_back(&camera1);
+
+        DSLRCamera dslrCamera1("Nikon", "DSLR Camera", 800.0, 0.25);
+        products.push_back(&dslrCamera1);
+
+        Laptop laptop1("HP", "Laptop", 1000.0, 0.2, 15.6, 2.5, 4, 8.0);
+        products.push_back(&laptop1);
+
+        std::vector<AnyCustomer> customers;
+
+        RegularCustomer regularCustomer1("John Doe", 2000.0);
+        customers.push_back(&regularCustomer1);
+
+        RegularCustomer regularCustomer2("Jane Doe", 2500.0);
+        customers.push_back(&regularCustomer2);
+
+        Customer customer1(1500.0);
+        customers.push_back(&customer1);
+
+
+        for (const AnyCustomer& anyCustomer : customers) {
+            std::visit([&](auto* customer) {
+                constexpr bool isRegular = std::is_same_v<std::remove_pointer_t<decltype(customer)>, RegularCustomer>;
+
+                std::cout << "------------------------------" << std::endl;
+                if constexpr (isRegular) {
+                    std::cout << "Regular Customer: " << customer->getFullName() << std::endl;
+                }
+                else {
+                    std::cout << "Customer" << std::endl;
+                }
+                std::cout << "Initial Balance: " << customer->getMoney() << std::endl;
+                std::cout << "------------------------------" << std::endl;
+
+                for (const auto& product : products) {
+                    std::cout << "Product: " << product->getCompany() << " - " << product->getTitle() << std::endl;
+                    if (buyProductStatic(*customer, *product))
+                    {
+                        std::cout << "Purchase successful!" << std::endl;
+                        if constexpr (isRegular) {
+                            customer->updateTotalPurchaseCost(product->getPrice());
+                        }
+                    }
+                    else {
+                        std::cout << "Purchase failed." << std::endl;
+                    }
+                    std::cout << "Remaining Balance: " << customer->getMoney() << std::endl;
+                    std::cout << "------------------------------" << std::endl;
+                }
+            }, anyCustomer);
+        }
+
+        // What-if run: the whole catalog repriced for every customer's current discount in one batch.
+        PriceColumns columns;
+        for (const Product* product : products) {
+            columns.add(*product);
+        }
+        std::vector<double> customerDiscounts;
+        for (const AnyCustomer& customer : customers) {
+            customerDiscounts.push_back(customerOf(customer).calculateIndividualDiscount());
+        }
+        std::vector<double> repriced;
+        PricingKernel kernel = detectPricingKernel();
+        calculateDiscountBatch(columns, customerDiscounts, repriced, kernel);
+
+        std::cout << "Repriced catalog (" << pricingKernelName(kernel) << " kernel)" << std::endl;
+        for (size_t c = 0; c < customers.size(); ++c) {
+            double basket = 0.0;
+            for (size_t i = 0; i < columns.size(); ++i) {
+                basket += repriced[c * columns.size() + i];
+            }
+            std::cout << "Customer " << c + 1 << " basket price: " << basket << std::endl;
+        }
+
+        AttributeCatalog attributes;
+        for (const Product* product : products) {
+            attributes.add(*product);
+        }
+        const std::string query = "category=Laptop AND cores>=4 AND memory>=8 AND price<=1200";
+        std::cout << "Query: " << query << std::endl;
+        for (size_t sku : attributes.query(query, kernel)) {
+            const Product& product = attributes.product(sku);
+            std::cout << "  " << productCategoryName(product.getCategory()) << ": "
+                << product.getCompany() << " - " << product.getTitle() << std::endl;
+        }
+
+        PriceIndex prices;
+        for (Product* product : products) {
+            prices.add(*product);
+        }
+        for (size_t c = 0; c < customers.size(); ++c) {
+            std::cout << "Affordable for customer " << c + 1 << ":" << std::endl;
+            for (const PriceIndex::Offer& offer : prices.affordable(customers[c], 3)) {
+                std::cout << "  " << prices.product(offer.sku).getTitle() << ": " << offer.price << std::endl;
+            }
+        }
+    }
+    catch (std::invalid_argument& ex) {
+        std::cerr << "Error: " << ex.what() << std::endl;
+    }
+
+    return 0;
+}
@@ -1,545 +1,8848 @@
-﻿#include <iostream>
-#include <vector>
-#include <map>
-#include <string>
-#include <unordered_map>
-#include <random>
-#include <algorithm>
-#include <fstream> // Для работы с файлами
-#include <sstream> // Для работы со строками
-
-
-class Product
-{
-protected:
-    std::string COMPANY;
-    std::string TITLE;
-    std::vector<double> PRICE;
-    double Max_Procent_Discount;
-
-public:
-    Product(std::string company, std::string title, double price, double max_procent_discount)
-        : COMPANY(company), TITLE(title), Max_Procent_Discount(max_procent_discount)
-    {
-        PRICE.push_back(price);
-    }
-
-    double get_price(size_t index) const
-    {
-        if (index >= PRICE.size())
-        {
-            throw std::out_of_range("Invalid price index");
-        }
-        return PRICE[index];
-    }
-
-    size_t get_price_size() const
-    {
-        return PRICE.size();
-    }
-
-    double get_max_discount() const
-    {
-        return Max_Procent_Discount;
-    }
-
-    const std::string& getCompany() const
-    {
-        return COMPANY;
-    }
-
-    const std::string& getTitle() const
-    {
-        return TITLE;
-    }
-
-    void setCompany(const std::string& company)
-    {
-        COMPANY = company;
-    }
-
-    void setTitle(const std::string& title)
-    {
-        TITLE = title;
-    }
-};
-
-class HouseholdAppliances : public Product
-{
-public:
-    HouseholdAppliances(std::string company, std::string title, double price, double max_procent_discount)
-        : Product(company, title, price, max_procent_discount) {}
-};
-
-class Hoover : public HouseholdAppliances
-{
-public:
-    Hoover(std::string company, std::string title, double price, double max_procent_discount)
-        : HouseholdAppliances(company, title, price, max_procent_discount) {}
-};
-
-class Camera : public Product
-{
-public:
-    Camera(std::string company, std::string title, double price, double max_procent_discount)
-        : Product(company, title, price, max_procent_discount) {}
-};
-
-class DSLRCamera : public Camera
-{
-public:
-    DSLRCamera(std::string company, std::string title, double price, double max_procent_discount)
-        : Camera(company, title, price, max_procent_discount) {}
-};
-
-class Notebook : public Product
-{
-private:
-    double SIZE_DIAGONAL;
-    double WEIGHT;
-    int CORE;
-    double MEMORY;
-
-public:
-    Notebook(std::string company, std::string title, double price, double max_procent_discount,
-        double size_diagonal, double weight, int core, double memory)
-        : Product(company, title, price, max_procent_discount),
-        SIZE_DIAGONAL(size_diagonal), WEIGHT(weight), CORE(core), MEMORY(memory) {}
-};
-
-class User
-{
-public:
-    int id;
-    std::string full_name;
-    double account_balance;
-    double discount = 0.0;
-    std::vector<Product> purchased_products;
-
-    User() = default;
-
-    User(int id, std::string full_name, double initial_balance)
-        : id(id), full_name(std::move(full_name)), account_balance(initial_balance) {}
-
-    void add_balance()
-    {
-        double amount;
-        std::cout << "Enter the amount you wish to add to the balance: ";
-
-        // Чтение ввода пользователя
-        while (!(std::cin >> amount))
-        {
-            // Если ввод некорректный, очищаем ошибки и буфер ввода
-            std::cin.clear();
-            std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-            std::cout << "An incorrect value has been entered. Try again: ";
-        }
-
-        if (amount < 0)
-        {
-            std::cout << "The amount cannot be negative. Please try again.\n";
-            return;
-        }
-
-        account_balance += amount; // используем account_balance вместо AMOUNT_OF_MONEY
-        std::cout << "Your balance has been successfully topped up. Current balance: " << account_balance << "\n";
-
-    }
-
-    virtual double individual_discount() const
-    {
-        return 0.0;
-    }
-
-    virtual bool purchase_product(Product& product, size_t price_index)
-    {
-        if (price_index >= product.get_price_size())
-        {
-            std::cout << "Invalid price index.\n";
-            return false;
-        }
-
-        double max_discounted_price = product.get_price(price_index) * (1.0 - product.get_max_discount());
-
-        double user_discount = individual_discount();
-
-        double discounted_price = product.get_price(price_index) * (1.0 - std::max(user_discount, product.get_max_discount()));
-
-        if (account_balance >= discounted_price)
-        {
-            account_balance -= discounted_price;
-            purchased_products.push_back(product);
-            return true; // purchase was successful
-        }
-        else
-        {
-            std::cout << "Insufficient funds.\n";
-            return false; // insufficient funds
-        }
-    }
-};
-
-class RegularCustomer : public User
-{
-private:
-    double total_purchase_cost;
-
-public:
-    RegularCustomer(std::string full_name, double initial_balance)
-        : User(0, full_name, initial_balance), total_purchase_cost(0.0) {}
-
-    double individual_discount() const override
-    {
-        return std::min(total_purchase_cost / 1000.0, 0.15);
-    }
-
-    bool purchase_product(Product& product, size_t price_index) override
-    {
-        bool purchase_successful = User::purchase_product(product, price_index);
-        if (purchase_successful)
-        {
-            total_purchase_cost += product.get_price(price_index);
-        }
-        return purchase_successful;
-    }
-};
-
-
-
-static void view_products(int user_id);
-
-static void purchase_product(int user_id);
-
-
-
-std::vector<Product> products; // Хранение товаров
-std::unordered_map<int, User> users;
-
-int generate_id()
-{
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    static std::uniform_int_distribution<int> distr(1, 1000000);
-    int id;
-    do
-    {
-        id = distr(gen);
-    } while (users.find(id) != users.end()); // Проверка на уникальность ID
-    return id;
-}
-
-void save_users_to_file(const std::unordered_map<int, User>& users)
-{
-    //std::ofstream file("users.txt", std::ios::app); // Открытие файла в режиме добавления
-
-    //if (!file)
-    //{
-    //    std::cerr << "Failed to open users.txt for writing.\n";
-    //    return;
-    //}
-    
-    std::ofstream file("users.txt"); // Открытие файла в режиме перезаписи
-
-    if (!file)
-    {
-        std::cerr << "Failed to open users.txt for writing.\n";
-        return;
-    }
-
-
-
-    for (const auto& pair : users)
-    {
-        const User& user = pair.second;
-        file << user.id << '\n'; // Сохранение ID пользователя
-        file << user.full_name << '\n';
-        file << user.account_balance << '\n';
-        file << user.discount << '\n';
-        file << user.purchased_products.size() << '\n';
-        for (const auto& product : user.purchased_products)
-        {
-            file << product.getCompany() << '\n';
-            file << product.getTitle() << '\n';
-            file << product.get_price(0) << '\n';
-        }
-    }
-
-    file.close();
-}
-
-void load_users_from_file(std::unordered_map<int, User>& users)
-{
-    std::ifstream file("users.txt");
-    if (!file)
-    {
-        // Если файл не существует, создаем его
-        std::ofstream createFile("users.txt");
-        createFile.close();
-
-        // Проверяем, успешно ли создан файл
-        if (!createFile)
-        {
-            std::cerr << "Failed to create users.txt file.\n";
-            return;
-        }
-
-        // Открываем файл после его создания
-        file.open("users.txt");
-        if (!file)
-        {
-            std::cerr << "Failed to open users.txt for reading.\n";
-            return;
-        }
-    }
-
-    users.clear();
-
-    std::string line;
-    while (std::getline(file, line))
-    {
-        int user_id; // Добавлено: переменная для хранения ID пользователя
-        file >> user_id;
-        file.ignore(); // Игнорирование символа новой строки
-
-        std::string full_name = line;
-        double account_balance, discount;
-        file >> account_balance >> discount;
-        file.ignore(); // Игнорирование символа новой строки
-
-        User user(user_id, full_name, account_balance); // Использование ID при создании пользователя
-        user.discount = discount;
-
-        int num_purchased_products;
-        file >> num_purchased_products;
-        file.ignore(); // Игнорирование символа новой строки
-
-        for (int i = 0; i < num_purchased_products; ++i)
-        {
-            std::string company, title;
-            double price;
-            std::getline(file, company);
-            std::getline(file, title);
-            file >> price;
-            file.ignore(); // Игнорирование символа новой строки
-
-            Product product(company, title, price, 0.0);
-            user.purchased_products.push_back(product);
-        }
-
-        users[user_id] = user;
-    }
-
-    file.close();
-}
-
-static void user_menu(int user_id)
-{
-
-    User& user = users[user_id];
-    while (true)
-    {
-         
-        std::cout << "-------------Hypermarket------------" << std::endl;
-        std::cout << "1. View products" << std::endl;
-        std::cout << "2. Purchase product" << std::endl;
-        std::cout << "3. Top up your account" << std::endl;
-        std::cout << "4. Exit" << std::endl;
-        std::cout << "Enter your choice: " << std::endl;
-
-        int choice;
-        std::cin >> choice;
-        std::cin.ignore();
-
-        switch (choice)
-        {
-        case 1:
-            view_products(user_id);
-            break;
-        case 2:
-            purchase_product(user_id);
-            break;
-        case 3:
-            users[user_id].add_balance();
-            break;
-        case 4:
-            save_users_to_file(users);
-            return; // выход в главное меню
-        default:
-            std::cout << "Invalid choice.\n";
-            break;
-        }
-    }
-}
-
-void sign_up(std::unordered_map<int, User>& users)
-{
-    std::string full_name;
-    double initial_balance;
-
-    std::cout << "Enter your full name: ";
-    std::getline(std::cin, full_name);
-
-    std::cout << "Enter the initial amount of money: ";
-    std::cin >> initial_balance;
-    std::cin.ignore();
-
-    int user_id = generate_id();
-    User new_user(user_id, full_name, initial_balance);
-    users[user_id] = new_user;
-
-    std::cout << "You have successfully signed up! Your user ID is " << user_id << "\n";
-
-    save_users_to_file(users); // Сохранение пользователей в файл
-}
-
-void sign_in()
-{
-
-
-    int user_id;
-    std::cout << "Enter your user ID: ";
-    std::cin >> user_id;
-    std::cin.ignore();
-
-    auto it = users.find(user_id);
-    if (it == users.end())
-    {
-        std::cout << "User not found.\n";
-    }
-    else
-    {
-        std::cout << "Welcome back, " << it->second.full_name << "!\n";
-        int user_id = it->second.id; // Сохранение ID пользователя
-        user_menu(user_id);
-    }
-}
-
-void purchase_product(int user_id)
-{
-    std::cout << "Enter the title of the product you want to purchase: ";
-    std::string product_title;
-    std::getline(std::cin, product_title);
-
-    Product* product = nullptr;
-
-    // Найти товар по введенному названию
-    for (auto& p : products) {
-        if (p.getTitle() == product_title) {
-            product = &p;
-            break;
-        }
-    }
-
-    if (product == nullptr) {
-        std::cout << "Product not found.\n";
-        return;
-    }
-
-    User* user = nullptr;
-
-    // Найти пользователя по user_id
-    for (auto& u : users) {
-        if (u.second.id == user_id) {
-            user = &(u.second);
-            break;
-        }
-    }
-
-    if (user == nullptr) {
-        std::cout << "User not found.\n";
-        return;
-    }
-
-    // Проверить, достаточно ли у пользователя денег на покупку
-    if (user->account_balance < product->get_price(0)) {
-        std::cout << "Insufficient funds.\n";
-        return;
-    }
-
-    // Выполнить покупку
-    user->account_balance -= product->get_price(0);
-    user->purchased_products.push_back(*product);
-
-    std::cout << "Purchase successful!\n";
-
-    save_users_to_file(users); // Сохранение данных пользователей в файл
-}
-
-void view_products(int user_id)
-{
-    auto it = users.find(user_id);
-    if (it == users.end())
-    {
-        std::cout << "User not found.\n";
-        return;
-    }
-
-    User& user = it->second;
-
-    std::cout << "User: " << user.full_name << std::endl;
-    std::cout << "Discount: " << user.discount * 100 << "%" << std::endl;
-    std::cout << "Purchased products:" << std::endl;
-    if (user.purchased_products.empty())
-    {
-        std::cout << "No products purchased." << std::endl;
-    }
-    else
-    {
-        for (const auto& product : user.purchased_products)
-        {
-            std::cout << "Company: " << product.getCompany() << std::endl;
-            std::cout << "Title: " << product.getTitle() << std::endl;
-            std::cout << "Price: " << product.get_price(0) << std::endl;  // Предполагаем, что у товара всегда есть хотя бы одна цена
-            std::cout << "-------------------------" << std::endl;
-        }
-    }
-}
-
-void main_menu()
-{
-    load_users_from_file(users); // Загрузка пользователей из файла перед началом работы программы
-
-    while (true)
-    {
-        std::cout << "1. Sign up" << std::endl;
-        std::cout << "2. Sign in" << std::endl;
-        std::cout << "3. Exit" << std::endl;
-        std::cout << "Enter your choice: " << std::endl;
-
-        int choice;
-        std::cin >> choice;
-        std::cin.ignore();
-
-        switch (choice)
-        {
-        case 1:
-            sign_up(users);
-            break;
-        case 2:
-            sign_in();
-            break;
-        case 3:
-            save_users_to_file(users);
-            return; // выход из программы
-        default:
-            std::cout << "Invalid choice.\n";
-            break;
-        }
-    }
-}
-
-
-
-
-int main()
-{
-
-    products.push_back(Product("Company 1", "Product 1", 10.0, 1));
-    products.push_back(Product("Company 2", "Product 2", 20.0, 0.2));
-    products.push_back(Product("Company 3", "Product 3", 30.0, 0.3));
-
-
-    load_users_from_file(users);
-    main_menu();
-    return 0;
-}
+﻿#include <iostream>
+#include <vector>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <fstream> // Для работы с файлами
+#include <sstream> // Для работы со строками
+#include <iomanip>
+#include <limits>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+#include <string_view>
+#include <stdexcept>
+#include <ctime>
+#include <type_traits>
+#include <mutex>
+#include <shared_mutex>
+#include <functional>
+#include <condition_variable>
+#include <deque>
+#include <coroutine>
+#include <utility>
+#include <charconv>
+#include <memory_resource>
+#include <bit>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <cerrno>
+#endif
+
+
+// Учёт памяти, выделяемой через std::pmr: ресурс передаёт запросы в new/delete и считает
+// их. Он стоит под аренами и пулами программы и становится ресурсом pmr по умолчанию в
+// main, поэтому стенды видят, сколько раз и сколько байт операция берёт у системы.
+class AllocationCounter : public std::pmr::memory_resource
+{
+public:
+    struct Totals
+    {
+        uint64_t allocations = 0;
+        uint64_t bytes = 0;
+
+        Totals operator-(const Totals& before) const
+        {
+            return { allocations - before.allocations, bytes - before.bytes };
+        }
+    };
+
+    Totals totals() const
+    {
+        return { allocations.load(std::memory_order_relaxed), bytes.load(std::memory_order_relaxed) };
+    }
+
+private:
+    std::atomic<uint64_t> allocations{ 0 };
+    std::atomic<uint64_t> bytes{ 0 };
+
+    void* do_allocate(size_t size, size_t alignment) override
+    {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        bytes.fetch_add(size, std::memory_order_relaxed);
+        return std::pmr::new_delete_resource()->allocate(size, alignment);
+    }
+
+    void do_deallocate(void* block, size_t size, size_t alignment) override
+    {
+        std::pmr::new_delete_resource()->deallocate(block, size, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+AllocationCounter allocation_counter;
+
+// Сборка с STORE_METRICS=0 убирает замеры операций целиком: OperationTimer становится
+// пустым, а отчёт сообщает, что замеров нет
+#ifndef STORE_METRICS
+#define STORE_METRICS 1
+#endif
+
+// Операции, для которых ведутся счётчики и гистограммы задержек
+enum class MetricOp
+{
+    PurchaseProduct,
+    SaveUsers,
+    LoadUsers,
+    SignUp,
+    Count
+};
+
+const char* const METRIC_OP_NAMES[] = { "purchase_product", "save_users_to_file", "load_users_from_file", "sign_up" };
+
+// Время замеряется у каждого N-го вызова операции в потоке (N - степень двойки), вызовы и
+// ошибки считаются все. Покупка занимает сотни наносекунд, и два чтения часов на каждой
+// стоили бы ей больше 1%.
+const uint64_t METRIC_SAMPLE_EVERY[] = { 16, 1, 1, 16 };
+
+// Гистограмма задержек в духе HDR: до 32 нс корзина на каждую наносекунду, дальше на каждую
+// степень двойки по 32 корзины равной ширины, так что погрешность не больше 1/32 значения.
+// Пишет только поток-владелец (load + store без lock-префикса), сводка читает на ходу.
+class LatencyHistogram
+{
+public:
+    static const unsigned SUB_BITS = 5;
+    static const uint64_t SUB_COUNT = uint64_t(1) << SUB_BITS;
+    static const unsigned MAX_BITS = 44; // 2^44 нс - почти 5 часов; дольше - в последнюю корзину
+    static const size_t BUCKET_COUNT = (MAX_BITS - SUB_BITS + 1) * SUB_COUNT;
+
+    static size_t bucket_of(uint64_t ns)
+    {
+        ns = std::min(ns, (uint64_t(1) << MAX_BITS) - 1);
+        if (ns < SUB_COUNT)
+        {
+            return static_cast<size_t>(ns);
+        }
+        unsigned shift = static_cast<unsigned>(std::bit_width(ns)) - 1 - SUB_BITS;
+        return static_cast<size_t>((shift + 1) * SUB_COUNT + (ns >> shift) - SUB_COUNT);
+    }
+
+    // Наибольшее значение, попадающее в корзину
+    static uint64_t bucket_max(size_t bucket)
+    {
+        if (bucket < 2 * SUB_COUNT)
+        {
+            return bucket;
+        }
+        unsigned shift = static_cast<unsigned>(bucket / SUB_COUNT) - 1;
+        return ((bucket % SUB_COUNT + SUB_COUNT + 1) << shift) - 1;
+    }
+
+    void record(uint64_t ns)
+    {
+        bump(buckets[bucket_of(ns)], 1);
+        bump(total_ns, ns);
+        if (ns > max_ns.load(std::memory_order_relaxed))
+        {
+            max_ns.store(ns, std::memory_order_relaxed);
+        }
+    }
+
+    static void bump(std::atomic<uint64_t>& counter, uint64_t by)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> buckets[BUCKET_COUNT] = {};
+    std::atomic<uint64_t> total_ns{ 0 };
+    std::atomic<uint64_t> max_ns{ 0 };
+};
+
+// Сводка по операции, собранная из всех потоков
+struct OperationSummary
+{
+    uint64_t calls = 0;
+    uint64_t failures = 0;
+    uint64_t samples = 0; // вызовов с замером времени
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+    std::vector<uint64_t> buckets = std::vector<uint64_t>(LatencyHistogram::BUCKET_COUNT);
+
+    double mean_ns() const
+    {
+        return samples == 0 ? 0.0 : static_cast<double>(total_ns) / samples;
+    }
+
+    // Задержка, которую не превышает доля p замеров, с точностью до корзины
+    uint64_t percentile(double p) const
+    {
+        uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(p * samples)));
+        uint64_t seen = 0;
+        for (size_t b = 0; b < buckets.size(); ++b)
+        {
+            seen += buckets[b];
+            if (seen >= rank)
+            {
+                return std::min(LatencyHistogram::bucket_max(b), max_ns);
+            }
+        }
+        return max_ns;
+    }
+};
+
+#if STORE_METRICS
+// Счётчики операций по потокам. Поток при первом замере получает свой блок и пишет только
+// в него; сводка складывает блоки всех потоков. Блок завершившегося потока со всеми
+// счётчиками переходит к следующему новому потоку, так что сумма не теряется, а память
+// не растёт с числом когда-либо живших потоков.
+class OperationMetrics
+{
+public:
+    struct OperationCounters
+    {
+        std::atomic<uint64_t> calls{ 0 };
+        std::atomic<uint64_t> failures{ 0 };
+        LatencyHistogram latency;
+    };
+
+    struct alignas(64) ThreadBlock
+    {
+        OperationCounters operations[static_cast<size_t>(MetricOp::Count)];
+    };
+
+    ThreadBlock& local()
+    {
+        static thread_local ThreadBlock* block = nullptr;
+        if (block == nullptr)
+        {
+            block = acquire();
+        }
+        return *block;
+    }
+
+    std::vector<OperationSummary> summary() const
+    {
+        std::vector<OperationSummary> result(static_cast<size_t>(MetricOp::Count));
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const std::unique_ptr<ThreadBlock>& block : blocks)
+        {
+            for (size_t op = 0; op < result.size(); ++op)
+            {
+                const OperationCounters& counters = block->operations[op];
+                OperationSummary& total = result[op];
+                total.calls += counters.calls.load(std::memory_order_relaxed);
+                total.failures += counters.failures.load(std::memory_order_relaxed);
+                total.total_ns += counters.latency.total_ns.load(std::memory_order_relaxed);
+                total.max_ns = std::max(total.max_ns, counters.latency.max_ns.load(std::memory_order_relaxed));
+                for (size_t b = 0; b < LatencyHistogram::BUCKET_COUNT; ++b)
+                {
+                    uint64_t count = counters.latency.buckets[b].load(std::memory_order_relaxed);
+                    total.buckets[b] += count;
+                    total.samples += count;
+                }
+            }
+        }
+        return result;
+    }
+
+private:
+    // Возвращает блок в свободные, когда поток завершается
+    struct Lease
+    {
+        OperationMetrics* owner = nullptr;
+        ThreadBlock* block = nullptr;
+
+        ~Lease()
+        {
+            if (owner)
+            {
+                std::lock_guard<std::mutex> lock(owner->mutex);
+                owner->free_blocks.push_back(block);
+            }
+        }
+    };
+
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadBlock>> blocks;
+    std::vector<ThreadBlock*> free_blocks;
+
+    ThreadBlock* acquire()
+    {
+        static thread_local Lease lease;
+        std::lock_guard<std::mutex> lock(mutex);
+        if (free_blocks.empty())
+        {
+            blocks.push_back(std::make_unique<ThreadBlock>());
+            free_blocks.push_back(blocks.back().get());
+        }
+        lease.owner = this;
+        lease.block = free_blocks.back();
+        free_blocks.pop_back();
+        return lease.block;
+    }
+};
+
+OperationMetrics metrics;
+
+// Замер одной операции: вызов считается в конструкторе, время - от конструктора до
+// деструктора у первого из каждых METRIC_SAMPLE_EVERY вызовов потока
+class OperationTimer
+{
+public:
+    explicit OperationTimer(MetricOp op)
+        : counters(metrics.local().operations[static_cast<size_t>(op)])
+    {
+        uint64_t calls = counters.calls.load(std::memory_order_relaxed);
+        counters.calls.store(calls + 1, std::memory_order_relaxed);
+        if ((calls & (METRIC_SAMPLE_EVERY[static_cast<size_t>(op)] - 1)) == 0)
+        {
+            timed = true;
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    OperationTimer(const OperationTimer&) = delete;
+    OperationTimer& operator=(const OperationTimer&) = delete;
+
+    ~OperationTimer()
+    {
+        if (timed)
+        {
+            auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+            counters.latency.record(static_cast<uint64_t>(std::max<int64_t>(0, elapsed.count())));
+        }
+    }
+
+    void fail()
+    {
+        LatencyHistogram::bump(counters.failures, 1);
+    }
+
+private:
+    OperationMetrics::OperationCounters& counters;
+    bool timed = false;
+    std::chrono::steady_clock::time_point start;
+};
+
+static std::vector<OperationSummary> metrics_summary()
+{
+    return metrics.summary();
+}
+#else
+class OperationTimer
+{
+public:
+    explicit OperationTimer(MetricOp) {}
+    void fail() {}
+};
+
+static std::vector<OperationSummary> metrics_summary()
+{
+    return {};
+}
+#endif
+
+// Таблица по операциям: вызовы, ошибки, замеры и задержки в микросекундах
+static std::string format_metrics_report()
+{
+    std::vector<OperationSummary> operations = metrics_summary();
+    if (operations.empty())
+    {
+        return "Operation metrics are disabled in this build (STORE_METRICS=0).\n";
+    }
+    std::ostringstream out;
+    out << std::left << std::setw(22) << "operation" << std::right
+        << std::setw(10) << "calls" << std::setw(9) << "failed" << std::setw(10) << "sampled"
+        << std::setw(11) << "mean us" << std::setw(11) << "p50 us" << std::setw(11) << "p90 us"
+        << std::setw(11) << "p99 us" << std::setw(11) << "p99.9 us" << std::setw(11) << "max us" << "\n";
+    out << std::fixed << std::setprecision(1);
+    for (size_t op = 0; op < operations.size(); ++op)
+    {
+        const OperationSummary& summary = operations[op];
+        out << std::left << std::setw(22) << METRIC_OP_NAMES[op] << std::right
+            << std::setw(10) << summary.calls << std::setw(9) << summary.failures << std::setw(10) << summary.samples
+            << std::setw(11) << summary.mean_ns() / 1000.0;
+        for (double p : { 0.50, 0.90, 0.99, 0.999 })
+        {
+            out << std::setw(11) << (summary.samples == 0 ? 0.0 : summary.percentile(p) / 1000.0);
+        }
+        out << std::setw(11) << summary.max_ns / 1000.0 << "\n";
+    }
+    return out.str();
+}
+
+// Периодический отчёт в файл: --stats-file=<файл> [--stats-interval=<секунды>, по умолчанию 10].
+// Файл переписывается целиком через временный и rename, последний раз - при выходе.
+class MetricsDumper
+{
+private:
+    std::string path;
+    std::chrono::duration<double> interval{ 10.0 };
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread worker;
+
+    void write() const
+    {
+        const std::string temporary = path + ".tmp";
+        {
+            std::ofstream out(temporary, std::ios::trunc);
+            out << "# unix time " << std::time(nullptr) << "\n" << format_metrics_report();
+            if (!out)
+            {
+                return;
+            }
+        }
+        std::error_code error;
+        std::filesystem::rename(temporary, path, error);
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;)
+        {
+            bool last = wake.wait_for(lock, interval, [this] { return stopping; });
+            lock.unlock();
+            write();
+            lock.lock();
+            if (last)
+            {
+                return;
+            }
+        }
+    }
+
+public:
+    ~MetricsDumper()
+    {
+        stop();
+    }
+
+    // Отчёт пишется в один файл: повторный --stats-file не принимается
+    void start(const std::string& file_path, double interval_seconds)
+    {
+        if (worker.joinable())
+        {
+            std::cerr << "Statistics are already written to " << path << ", ignoring " << file_path << ".\n";
+            return;
+        }
+        path = file_path;
+        interval = std::chrono::duration<double>(std::max(interval_seconds, 0.1));
+        worker = std::thread([this] { run(); });
+    }
+
+    void stop()
+    {
+        if (!worker.joinable())
+        {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        worker.join();
+    }
+};
+
+MetricsDumper metrics_dumper;
+
+// Строка из пула StringPool: 32-битный номер. Сравнение и хеш - сравнение и хеш номера,
+// сама строка хранится в пуле один раз, сколько бы товаров на неё ни ссылалось.
+class InternedString
+{
+private:
+    uint32_t handle = 0; // 0 - пустая строка
+
+public:
+    InternedString() = default;
+
+    explicit InternedString(uint32_t handle)
+        : handle(handle) {}
+
+    uint32_t id() const
+    {
+        return handle;
+    }
+
+    const std::string& str() const;
+
+    bool operator==(InternedString other) const
+    {
+        return handle == other.handle;
+    }
+
+    bool operator!=(InternedString other) const
+    {
+        return handle != other.handle;
+    }
+};
+
+namespace std
+{
+    template <>
+    struct hash<InternedString>
+    {
+        size_t operator()(InternedString value) const
+        {
+            return value.id();
+        }
+    };
+}
+
+// Пул строк (названия компаний и товаров). Строки только добавляются и не перемещаются,
+// поэтому строка по номеру читается без блокировок. Поиск тоже без блокировок: таблица
+// с открытой адресацией хранит номера строк, при росте строится новая таблица, а старая
+// остаётся жить - её ещё могут читать. Добавления идут под одной блокировкой.
+class StringPool
+{
+private:
+    static const unsigned CHUNK_BITS = 12;
+    static const size_t CHUNK_SIZE = size_t(1) << CHUNK_BITS;
+    static const size_t MAX_CHUNKS = size_t(1) << 12; // до 16М различных строк
+
+    struct Index
+    {
+        size_t mask;
+        std::unique_ptr<std::atomic<uint32_t>[]> cells; // номер строки + 1, 0 - пусто
+
+        explicit Index(size_t size)
+            : mask(size - 1), cells(new std::atomic<uint32_t>[size]()) {}
+    };
+
+    std::unique_ptr<std::atomic<std::string*>[]> chunks{ new std::atomic<std::string*>[MAX_CHUNKS]() };
+    std::atomic<uint32_t> count{ 0 };
+    std::atomic<Index*> index{ nullptr };
+    std::vector<std::unique_ptr<Index>> indexes; // текущая и прежние таблицы
+    std::mutex write_mutex;
+
+    static size_t hash(std::string_view text)
+    {
+        return std::hash<std::string_view>()(text);
+    }
+
+    static void place(Index& table, uint32_t handle, size_t hash_value)
+    {
+        size_t cell = hash_value & table.mask;
+        while (table.cells[cell].load(std::memory_order_relaxed) != 0)
+        {
+            cell = (cell + 1) & table.mask;
+        }
+        table.cells[cell].store(handle + 1, std::memory_order_release);
+    }
+
+    bool find(std::string_view text, size_t hash_value, uint32_t& handle) const
+    {
+        const Index* table = index.load(std::memory_order_acquire);
+        for (size_t cell = hash_value & table->mask;; cell = (cell + 1) & table->mask)
+        {
+            uint32_t stored = table->cells[cell].load(std::memory_order_acquire);
+            if (stored == 0)
+            {
+                return false;
+            }
+            if (at(stored - 1) == text)
+            {
+                handle = stored - 1;
+                return true;
+            }
+        }
+    }
+
+    // Вызывается под write_mutex
+    uint32_t append(std::string_view text, size_t hash_value)
+    {
+        uint32_t handle = count.load(std::memory_order_relaxed);
+        if (handle >= CHUNK_SIZE * MAX_CHUNKS)
+        {
+            throw std::length_error("String pool is full");
+        }
+        std::atomic<std::string*>& chunk = chunks[handle >> CHUNK_BITS];
+        if (chunk.load(std::memory_order_relaxed) == nullptr)
+        {
+            chunk.store(new std::string[CHUNK_SIZE], std::memory_order_release);
+        }
+        chunk.load(std::memory_order_relaxed)[handle & (CHUNK_SIZE - 1)] = std::string(text);
+        count.store(handle + 1, std::memory_order_release);
+
+        Index* table = index.load(std::memory_order_relaxed);
+        if ((handle + 1) * 2 > table->mask + 1)
+        {
+            indexes.push_back(std::make_unique<Index>((table->mask + 1) * 2));
+            table = indexes.back().get();
+            for (uint32_t stored = 0; stored < handle; ++stored)
+            {
+                place(*table, stored, hash(at(stored)));
+            }
+        }
+        place(*table, handle, hash_value);
+        index.store(table, std::memory_order_release);
+        return handle;
+    }
+
+public:
+    StringPool()
+    {
+        indexes.push_back(std::make_unique<Index>(1024));
+        index.store(indexes.back().get());
+        append(std::string_view(), hash(std::string_view()));
+    }
+
+    StringPool(const StringPool&) = delete;
+    StringPool& operator=(const StringPool&) = delete;
+
+    ~StringPool()
+    {
+        for (size_t i = 0; i < MAX_CHUNKS; ++i)
+        {
+            delete[] chunks[i].load();
+        }
+    }
+
+    InternedString intern(std::string_view text)
+    {
+        size_t hash_value = hash(text);
+        uint32_t handle;
+        if (find(text, hash_value, handle))
+        {
+            return InternedString(handle);
+        }
+        std::lock_guard<std::mutex> lock(write_mutex);
+        if (!find(text, hash_value, handle))
+        {
+            handle = append(text, hash_value);
+        }
+        return InternedString(handle);
+    }
+
+    // Номер уже добавленной строки, без добавления
+    bool find(std::string_view text, InternedString& value) const
+    {
+        uint32_t handle;
+        if (!find(text, hash(text), handle))
+        {
+            return false;
+        }
+        value = InternedString(handle);
+        return true;
+    }
+
+    const std::string& at(uint32_t handle) const
+    {
+        return chunks[handle >> CHUNK_BITS].load(std::memory_order_acquire)[handle & (CHUNK_SIZE - 1)];
+    }
+
+    size_t size() const
+    {
+        return count.load();
+    }
+
+    // Оценка занятой памяти: блоки строк с их буферами и таблицы поиска
+    size_t memory_usage() const
+    {
+        size_t strings = size();
+        size_t bytes = ((strings + CHUNK_SIZE - 1) / CHUNK_SIZE) * CHUNK_SIZE * sizeof(std::string);
+        for (uint32_t handle = 0; handle < strings; ++handle)
+        {
+            const std::string& text = at(handle);
+            if (text.capacity() > std::string().capacity())
+            {
+                bytes += text.capacity() + 1;
+            }
+        }
+        for (const auto& table : indexes)
+        {
+            bytes += (table->mask + 1) * sizeof(uint32_t);
+        }
+        return bytes + MAX_CHUNKS * sizeof(std::atomic<std::string*>);
+    }
+};
+
+StringPool string_pool; // Названия компаний и товаров
+
+const std::string& InternedString::str() const
+{
+    return string_pool.at(handle);
+}
+
+// История цен товара: изменения цены с временем (секунды Unix-времени) в порядке времени.
+// Записи лежат блоками по BLOCK_SIZE: первая запись блока целиком в заголовке, остальные -
+// разностями в общем массиве байт: время - varint приращения, цена - varint разности в
+// десятитысячных (цены в копейках так записываются точно) или, если цена так не
+// записывается, XOR её битов с прошлой ценой. Обычно это 4-7 байт на изменение вместо 16.
+// Цена на момент времени - двоичный поиск блока и разбор не больше BLOCK_SIZE записей.
+class PriceHistory
+{
+public:
+    using allocator_type = std::pmr::polymorphic_allocator<>;
+
+    static const uint32_t BLOCK_SIZE = 32;
+
+    explicit PriceHistory(const allocator_type& allocator = {})
+        : blocks(allocator), deltas(allocator) {}
+
+    PriceHistory(const PriceHistory& other, const allocator_type& allocator)
+        : blocks(other.blocks, allocator), deltas(other.deltas, allocator), entry_count(other.entry_count),
+        last_time(other.last_time), last_price(other.last_price) {}
+
+    PriceHistory(const PriceHistory&) = default;
+    PriceHistory(PriceHistory&&) = default;
+
+    // Время не идёт назад: запись раньше последней получает время последней
+    void append(int64_t time, double price)
+    {
+        time = std::max(time, last_time);
+        if (entry_count % BLOCK_SIZE == 0)
+        {
+            blocks.push_back({ time, price, static_cast<uint32_t>(deltas.size()) });
+        }
+        else
+        {
+            put_varint(static_cast<uint64_t>(time - last_time));
+            int64_t units, last_units;
+            if (to_units(price, units) && to_units(last_price, last_units))
+            {
+                // Младший бит 0 - разность в десятитысячных (zigzag)
+                int64_t change = units - last_units;
+                uint64_t zigzag = (static_cast<uint64_t>(change) << 1) ^ static_cast<uint64_t>(change >> 63);
+                put_varint(zigzag << 1);
+            }
+            else
+            {
+                // Младший бит 1 - сдвиг и XOR битов цены без младших нулей
+                uint64_t changed = std::bit_cast<uint64_t>(price) ^ std::bit_cast<uint64_t>(last_price);
+                unsigned shift = changed ? std::countr_zero(changed) : 0;
+                put_varint(shift << 1 | 1);
+                put_varint(changed >> shift);
+            }
+        }
+        ++entry_count;
+        last_time = time;
+        last_price = price;
+    }
+
+    // Цена, действовавшая в момент time (последнее изменение не позже time); false, если
+    // история начинается позже
+    bool price_at(int64_t time, double& price) const
+    {
+        auto block = std::upper_bound(blocks.begin(), blocks.end(), time,
+            [](int64_t value, const Block& entry) { return value < entry.first_time; });
+        if (block == blocks.begin())
+        {
+            return false;
+        }
+        --block;
+        Cursor cursor(*this, static_cast<size_t>(block - blocks.begin()));
+        Cursor found = cursor;
+        while (cursor.next() && cursor.time <= time)
+        {
+            found = cursor;
+        }
+        price = found.price();
+        return true;
+    }
+
+    // Изменение номер index, от старых к новым
+    void entry(size_t index, int64_t& time, double& price) const
+    {
+        if (index >= entry_count)
+        {
+            throw std::out_of_range("Invalid price index");
+        }
+        Cursor cursor(*this, index / BLOCK_SIZE);
+        for (size_t i = 0; i < index % BLOCK_SIZE; ++i)
+        {
+            cursor.next();
+        }
+        time = cursor.time;
+        price = cursor.price();
+    }
+
+    size_t size() const
+    {
+        return entry_count;
+    }
+
+    size_t memory_usage() const
+    {
+        return blocks.capacity() * sizeof(Block) + deltas.capacity();
+    }
+
+private:
+    struct Block
+    {
+        int64_t first_time;
+        double first_price;
+        uint32_t first_delta; // начало разностей блока в deltas
+    };
+
+    // Последовательный разбор одного блока. Пока цены идут разностями в десятитысячных,
+    // хранится только их сумма: цена считается один раз, когда она нужна.
+    struct Cursor
+    {
+        const unsigned char* position;
+        size_t remaining;
+        int64_t time;
+        uint64_t bits = 0;  // биты цены, если !in_units
+        int64_t units = 0;  // цена в десятитысячных, если in_units
+        bool in_units = false;
+
+        Cursor(const PriceHistory& history, size_t block)
+            : position(history.deltas.data() + history.blocks[block].first_delta),
+            remaining(std::min<size_t>(PriceHistory::BLOCK_SIZE, history.entry_count - block * PriceHistory::BLOCK_SIZE) - 1),
+            time(history.blocks[block].first_time), bits(std::bit_cast<uint64_t>(history.blocks[block].first_price)) {}
+
+        double price() const
+        {
+            return in_units ? static_cast<double>(units) / PRICE_UNITS : std::bit_cast<double>(bits);
+        }
+
+        bool next()
+        {
+            if (remaining == 0)
+            {
+                return false;
+            }
+            --remaining;
+            time += static_cast<int64_t>(get_varint(position));
+            uint64_t code = get_varint(position);
+            if (code & 1)
+            {
+                bits = std::bit_cast<uint64_t>(price()) ^ (get_varint(position) << (code >> 1));
+                in_units = false;
+            }
+            else
+            {
+                if (!in_units)
+                {
+                    to_units(std::bit_cast<double>(bits), units);
+                    in_units = true;
+                }
+                uint64_t zigzag = code >> 1;
+                units += static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+            }
+            return true;
+        }
+    };
+
+    static constexpr double PRICE_UNITS = 10000.0;
+
+    std::pmr::vector<Block> blocks;
+    std::pmr::vector<unsigned char> deltas;
+    size_t entry_count = 0;
+    int64_t last_time = std::numeric_limits<int64_t>::min();
+    double last_price = 0.0;
+
+    // Цена в десятитысячных; false, если цена так точно не записывается
+    static bool to_units(double price, int64_t& units)
+    {
+        if (!(std::fabs(price) < 1e12))
+        {
+            return false;
+        }
+        units = std::llround(price * PRICE_UNITS);
+        return static_cast<double>(units) / PRICE_UNITS == price;
+    }
+
+    void put_varint(uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            deltas.push_back(static_cast<unsigned char>(value | 0x80));
+            value >>= 7;
+        }
+        deltas.push_back(static_cast<unsigned char>(value));
+    }
+
+    static uint64_t get_varint(const unsigned char*& position)
+    {
+        uint64_t value = 0;
+        for (unsigned shift = 0;; shift += 7)
+        {
+            unsigned char byte = *position++;
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (byte < 0x80)
+            {
+                return value;
+            }
+        }
+    }
+};
+
+// Цена, с которой товар появился в каталоге, действует с начала времён
+const int64_t PRICE_HISTORY_ORIGIN = 0;
+
+class Product
+{
+protected:
+    InternedString COMPANY;
+    InternedString TITLE;
+    PriceHistory PRICE;
+    mutable std::mutex PRICE_MUTEX;    // PRICE меняет переоценка, пока товар читают другие потоки
+    std::atomic<double> CURRENT_PRICE; // последняя цена из PRICE: покупка не трогает историю
+    double Max_Procent_Discount;
+    uint32_t ID = UINT32_MAX; // Номер товара в каталоге, назначает ProductCatalog
+
+public:
+    // История цен лежит в памяти владельца товара: каталог отдаёт свой ресурс
+    using allocator_type = std::pmr::polymorphic_allocator<>;
+
+    Product(std::string company, std::string title, double price, double max_procent_discount,
+        const allocator_type& allocator = {})
+        : COMPANY(string_pool.intern(company)), TITLE(string_pool.intern(title)), PRICE(allocator),
+        CURRENT_PRICE(price), Max_Procent_Discount(max_procent_discount)
+    {
+        PRICE.append(PRICE_HISTORY_ORIGIN, price);
+    }
+
+    Product(const Product& other, const allocator_type& allocator)
+        : COMPANY(other.COMPANY), TITLE(other.TITLE), PRICE(other.copy_price_history(allocator)),
+        CURRENT_PRICE(other.current_price()), Max_Procent_Discount(other.Max_Procent_Discount), ID(other.ID) {}
+
+    Product(const Product& other)
+        : Product(other, allocator_type()) {}
+
+    Product(Product&& other) noexcept
+        : COMPANY(other.COMPANY), TITLE(other.TITLE), PRICE(std::move(other.PRICE)),
+        CURRENT_PRICE(other.current_price()), Max_Procent_Discount(other.Max_Procent_Discount), ID(other.ID) {}
+
+    // Цена из истории: index 0 - начальная цена, дальше изменения по времени
+    double get_price(size_t index) const
+    {
+        int64_t time;
+        double price;
+        std::lock_guard<std::mutex> lock(PRICE_MUTEX);
+        PRICE.entry(index, time, price);
+        return price;
+    }
+
+    size_t get_price_size() const
+    {
+        std::lock_guard<std::mutex> lock(PRICE_MUTEX);
+        return PRICE.size();
+    }
+
+    // Цена сейчас, за O(1) и без блокировок
+    double current_price() const
+    {
+        return CURRENT_PRICE.load(std::memory_order_relaxed);
+    }
+
+    // Цена в момент time; false, если история начинается позже
+    bool price_at(int64_t time, double& price) const
+    {
+        std::lock_guard<std::mutex> lock(PRICE_MUTEX);
+        return PRICE.price_at(time, price);
+    }
+
+    PriceHistory copy_price_history(const allocator_type& allocator) const
+    {
+        std::lock_guard<std::mutex> lock(PRICE_MUTEX);
+        return PriceHistory(PRICE, allocator);
+    }
+
+    // Новая цена с момента time; переоценку каталога упорядочивает ProductCatalog
+    void set_price(int64_t time, double price)
+    {
+        std::lock_guard<std::mutex> lock(PRICE_MUTEX);
+        PRICE.append(time, price);
+        CURRENT_PRICE.store(price, std::memory_order_relaxed);
+    }
+
+    double get_max_discount() const
+    {
+        return Max_Procent_Discount;
+    }
+
+    uint32_t get_id() const
+    {
+        return ID;
+    }
+
+    void set_id(uint32_t id)
+    {
+        ID = id;
+    }
+
+    const std::string& getCompany() const
+    {
+        return COMPANY.str();
+    }
+
+    const std::string& getTitle() const
+    {
+        return TITLE.str();
+    }
+
+    InternedString company_handle() const
+    {
+        return COMPANY;
+    }
+
+    InternedString title_handle() const
+    {
+        return TITLE;
+    }
+
+    void setCompany(const std::string& company)
+    {
+        COMPANY = string_pool.intern(company);
+    }
+
+    void setTitle(const std::string& title)
+    {
+        TITLE = string_pool.intern(title);
+    }
+};
+
+class HouseholdAppliances : public Product
+{
+public:
+    HouseholdAppliances(std::string company, std::string title, double price, double max_procent_discount)
+        : Product(company, title, price, max_procent_discount) {}
+};
+
+class Hoover : public HouseholdAppliances
+{
+public:
+    Hoover(std::string company, std::string title, double price, double max_procent_discount)
+        : HouseholdAppliances(company, title, price, max_procent_discount) {}
+};
+
+class Camera : public Product
+{
+public:
+    Camera(std::string company, std::string title, double price, double max_procent_discount)
+        : Product(company, title, price, max_procent_discount) {}
+};
+
+class DSLRCamera : public Camera
+{
+public:
+    DSLRCamera(std::string company, std::string title, double price, double max_procent_discount)
+        : Camera(company, title, price, max_procent_discount) {}
+};
+
+class Notebook : public Product
+{
+private:
+    double SIZE_DIAGONAL;
+    double WEIGHT;
+    int CORE;
+    double MEMORY;
+
+public:
+    Notebook(std::string company, std::string title, double price, double max_procent_discount,
+        double size_diagonal, double weight, int core, double memory)
+        : Product(company, title, price, max_procent_discount),
+        SIZE_DIAGONAL(size_diagonal), WEIGHT(weight), CORE(core), MEMORY(memory) {}
+};
+
+// Запись истории покупок: товар хранится ссылкой на каталог, а не копией Product
+struct PurchaseRecord
+{
+    uint32_t product_id; // ID товара в каталоге
+    float discount;      // применённая скидка, доля от цены
+    double price;        // уплаченная цена
+    int64_t timestamp;   // время покупки, секунды Unix-времени
+};
+
+static_assert(sizeof(PurchaseRecord) == 24, "PurchaseRecord is stored as is in users.db");
+static_assert(std::is_trivially_copyable<PurchaseRecord>::value, "PurchaseRecord is copied with memcpy");
+
+static int64_t unix_time_now()
+{
+    return std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Сборка с CATALOG_PERFECT_HASH=1 строит для замороженного каталога минимальную
+// совершенную хеш-функцию: поиск по названию - два вычисления хеша (корзина и слот)
+// и одно сравнение, без обращения к пулу строк
+#ifndef CATALOG_PERFECT_HASH
+#define CATALOG_PERFECT_HASH 0
+#endif
+
+// FNV-1a с примешиванием seed, используется и обычным, и совершенным хешированием
+static uint64_t hash_title(std::string_view title, uint64_t seed = 0)
+{
+    uint64_t hash = 14695981039346656037ull ^ (seed * 0x9E3779B97F4A7C15ull);
+    for (unsigned char c : title)
+    {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash ^ (hash >> 32);
+}
+
+// Полнотекстовый поиск по названиям и компаниям товаров: инвертированный индекс
+// слово -> товары, в которых оно встречается. Слово запроса находит слово товара
+// точно, как префикс (до PREFIX_TERMS слов) или с одной опечаткой: лишней, пропущенной,
+// заменённой или переставленной буквой. Опечатки ищутся по индексу удалений: для
+// слова хранятся хеши его самого и всех вариантов без одной буквы, и у слов на таком
+// расстоянии есть общий вариант, который затем проверяется сравнением. Числа опечаток
+// не прощают: "Product 12" и "Product 13" - разные товары. Товары индексируются при
+// добавлении, их ID должны расти.
+class ProductSearchIndex
+{
+public:
+    static constexpr size_t PREFIX_TERMS = 64;
+    static constexpr size_t TYPO_MIN_LENGTH = 4; // более короткие слова ищутся без опечаток
+
+    void add(uint32_t product_id, std::string_view company, std::string_view title)
+    {
+        std::vector<std::string> words = tokenize(company);
+        const size_t company_words = words.size();
+        std::vector<std::string> title_words = tokenize(title);
+        words.insert(words.end(), title_words.begin(), title_words.end());
+
+        for (size_t i = 0; i < words.size(); ++i)
+        {
+            // Младший бит записи - слово из названия; слово из компании идёт раньше
+            std::vector<uint32_t>& postings = terms[term_id(words[i])].postings;
+            uint32_t posting = product_id << 1 | (i >= company_words ? 1u : 0u);
+            if (postings.empty() || postings.back() < posting)
+            {
+                postings.push_back(posting);
+            }
+        }
+        if (product_id >= word_counts.size())
+        {
+            word_counts.resize(product_id + 1, 0);
+        }
+        word_counts[product_id] = static_cast<uint16_t>(std::min<size_t>(words.size(), UINT16_MAX));
+    }
+
+    // До k лучших товаров, в которых нашлось каждое слово запроса. Очки слова: точное
+    // совпадение 6, префикс 4, опечатка 2, и ещё 1, если слово из названия; при равных
+    // очках выше товар с меньшим числом слов, затем с меньшим ID.
+    std::vector<uint32_t> search(std::string_view query, size_t k) const
+    {
+        std::vector<std::string> words = tokenize(query);
+        std::sort(words.begin(), words.end());
+        words.erase(std::unique(words.begin(), words.end()), words.end());
+
+        std::vector<std::vector<TermMatch>> matches(words.size());
+        std::vector<size_t> order(words.size()), cost(words.size(), 0);
+        for (size_t i = 0; i < words.size(); ++i)
+        {
+            match_terms(words[i], matches[i]);
+            if (matches[i].empty())
+            {
+                return {};
+            }
+            for (const TermMatch& match : matches[i]) cost[i] += terms[match.term].postings.size();
+            order[i] = i;
+        }
+        if (words.empty() || k == 0)
+        {
+            return {};
+        }
+        // Кандидаты - товары самого редкого слова, остальные слова ищутся в них двоичным поиском
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return cost[a] < cost[b]; });
+
+        std::vector<Hit> hits;
+        for (const TermMatch& match : matches[order[0]])
+        {
+            for (uint32_t posting : terms[match.term].postings)
+            {
+                hits.push_back({ posting >> 1, match.score + (posting & 1) });
+            }
+        }
+        if (matches[order[0]].size() > 1)
+        {
+            std::sort(hits.begin(), hits.end(), [](const Hit& a, const Hit& b) {
+                return a.product != b.product ? a.product < b.product : a.score > b.score;
+            });
+            hits.erase(std::unique(hits.begin(), hits.end(),
+                [](const Hit& a, const Hit& b) { return a.product == b.product; }), hits.end());
+        }
+        else
+        {
+            // У одного слова запись из компании и из названия подряд, берётся лучшая
+            size_t kept = 0;
+            for (const Hit& hit : hits)
+            {
+                if (kept > 0 && hits[kept - 1].product == hit.product)
+                {
+                    hits[kept - 1].score = std::max(hits[kept - 1].score, hit.score);
+                    continue;
+                }
+                hits[kept++] = hit;
+            }
+            hits.resize(kept);
+        }
+
+        for (size_t w = 1; w < order.size() && !hits.empty(); ++w)
+        {
+            size_t kept = 0;
+            for (const Hit& hit : hits)
+            {
+                uint32_t best = 0;
+                for (const TermMatch& match : matches[order[w]])
+                {
+                    const std::vector<uint32_t>& postings = terms[match.term].postings;
+                    auto it = std::lower_bound(postings.begin(), postings.end(), hit.product << 1);
+                    for (; it != postings.end() && (*it >> 1) == hit.product; ++it)
+                    {
+                        best = std::max(best, match.score + (*it & 1));
+                    }
+                }
+                if (best != 0)
+                {
+                    hits[kept++] = { hit.product, hit.score + best };
+                }
+            }
+            hits.resize(kept);
+        }
+
+        auto better = [&](const Hit& a, const Hit& b) {
+            if (a.score != b.score) return a.score > b.score;
+            if (word_counts[a.product] != word_counts[b.product]) return word_counts[a.product] < word_counts[b.product];
+            return a.product < b.product;
+        };
+        const size_t count = std::min(k, hits.size());
+        std::partial_sort(hits.begin(), hits.begin() + count, hits.end(), better);
+        std::vector<uint32_t> result(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            result[i] = hits[i].product;
+        }
+        return result;
+    }
+
+private:
+    struct Term
+    {
+        std::string_view text;           // ключ by_text: узлы std::map не переезжают
+        std::vector<uint32_t> postings;  // ID товара << 1 | слово из названия, по возрастанию
+    };
+
+    struct TermMatch
+    {
+        uint32_t term;
+        uint32_t score;
+    };
+
+    struct Hit
+    {
+        uint32_t product;
+        uint32_t score;
+    };
+
+    std::vector<Term> terms;
+    std::map<std::string, uint32_t, std::less<>> by_text; // упорядочен для поиска по префиксу
+    std::unordered_map<uint64_t, std::vector<uint32_t>> by_deletion; // хеш варианта -> номера слов
+    std::vector<uint16_t> word_counts; // ID товара -> число слов в компании и названии
+
+    // Слова - последовательности букв и цифр в нижнем регистре; байты UTF-8 остаются как есть
+    static std::vector<std::string> tokenize(std::string_view text)
+    {
+        std::vector<std::string> words;
+        std::string word;
+        for (char c : text)
+        {
+            unsigned char byte = static_cast<unsigned char>(c);
+            if (std::isalnum(byte) || byte >= 0x80)
+            {
+                word += byte < 0x80 ? static_cast<char>(std::tolower(byte)) : c;
+            }
+            else if (!word.empty())
+            {
+                words.push_back(std::move(word));
+                word.clear();
+            }
+        }
+        if (!word.empty())
+        {
+            words.push_back(std::move(word));
+        }
+        return words;
+    }
+
+    static bool typo_tolerant(std::string_view word)
+    {
+        return word.size() >= TYPO_MIN_LENGTH &&
+            std::none_of(word.begin(), word.end(), [](char c) { return c >= '0' && c <= '9'; });
+    }
+
+    // Слово и все его варианты без одной буквы
+    template <typename Visit>
+    static void for_each_deletion(std::string_view word, Visit&& visit)
+    {
+        visit(hash_title(word));
+        std::string variant(word.substr(1));
+        for (size_t i = 0; i < word.size(); ++i)
+        {
+            // variant - word без буквы i; соседние одинаковые буквы дают тот же вариант
+            if (i == 0 || word[i] != word[i - 1])
+            {
+                visit(hash_title(variant));
+            }
+            if (i + 1 < word.size())
+            {
+                variant[i] = word[i];
+            }
+        }
+    }
+
+    // Расстояние Дамерау-Левенштейна (с перестановкой соседних букв) не больше 1
+    static bool within_one_edit(std::string_view a, std::string_view b)
+    {
+        if (a.size() > b.size())
+        {
+            std::swap(a, b);
+        }
+        if (b.size() - a.size() > 1)
+        {
+            return false;
+        }
+        size_t i = 0;
+        while (i < a.size() && a[i] == b[i]) ++i;
+        if (i == a.size())
+        {
+            return true;
+        }
+        if (a.size() != b.size())
+        {
+            return a.substr(i) == b.substr(i + 1);
+        }
+        return a.substr(i + 1) == b.substr(i + 1) ||
+            (i + 1 < a.size() && a[i] == b[i + 1] && a[i + 1] == b[i] && a.substr(i + 2) == b.substr(i + 2));
+    }
+
+    uint32_t term_id(const std::string& word)
+    {
+        auto it = by_text.find(word);
+        if (it != by_text.end())
+        {
+            return it->second;
+        }
+        uint32_t id = static_cast<uint32_t>(terms.size());
+        it = by_text.emplace(word, id).first;
+        terms.push_back({ it->first, {} });
+        if (typo_tolerant(word))
+        {
+            for_each_deletion(word, [&](uint64_t hash) {
+                std::vector<uint32_t>& ids = by_deletion[hash];
+                if (ids.empty() || ids.back() != id)
+                {
+                    ids.push_back(id);
+                }
+            });
+        }
+        return id;
+    }
+
+    void match_terms(const std::string& word, std::vector<TermMatch>& matches) const
+    {
+        auto it = by_text.lower_bound(word);
+        if (it != by_text.end() && it->first == word)
+        {
+            matches.push_back({ it->second, 6 });
+            ++it;
+        }
+        for (size_t n = 0; it != by_text.end() && n < PREFIX_TERMS && it->first.compare(0, word.size(), word) == 0; ++it, ++n)
+        {
+            matches.push_back({ it->second, 4 });
+        }
+
+        if (!typo_tolerant(word))
+        {
+            return;
+        }
+        for_each_deletion(word, [&](uint64_t hash) {
+            auto variants = by_deletion.find(hash);
+            if (variants == by_deletion.end())
+            {
+                return;
+            }
+            for (uint32_t id : variants->second)
+            {
+                bool seen = std::any_of(matches.begin(), matches.end(), [&](const TermMatch& m) { return m.term == id; });
+                if (!seen && within_one_edit(word, terms[id].text))
+                {
+                    matches.push_back({ id, 2 });
+                }
+            }
+        });
+    }
+};
+
+// Каталог товаров с индексом по названию и стабильными ID (номер товара в каталоге,
+// товары только добавляются). Поиск по ID и по названию - O(1): название ищется в пуле
+// строк, а индекс - массив ID товаров по номеру названия в пуле. Поиск по словам
+// названия и компании - ProductSearchIndex, он пополняется в add. Истории цен растут при
+// каждой переоценке, поэтому лежат в общей куче, а не в монотонной арене, которая не
+// возвращала бы прежние буферы. Переоценка возможна и во время работы: переоценки
+// упорядочивает prices_mutex, историю товара - его блокировка, а текущую цену покупка
+// читает без блокировки.
+class ProductCatalog
+{
+private:
+    mutable std::shared_mutex prices_mutex;
+    std::vector<Product> items;
+    std::vector<uint32_t> by_title; // номер названия в string_pool -> ID товара
+    ProductSearchIndex search_index;
+
+    // Совершенный хеш (hash and displace): название попадает в корзину по hash_title(title),
+    // seed корзины подобран так, что hash_title(title, seed) % size() даёт слот без коллизий
+    std::vector<uint32_t> bucket_seeds;
+    std::vector<uint32_t> slots;
+    bool sealed = false; // был вызван freeze()
+    bool frozen = false; // совершенный хеш построен и покрывает товары, кроме late_titles
+    std::unordered_map<std::string_view, uint32_t> late_titles; // добавленные после построения хеша
+
+    bool build_perfect_hash()
+    {
+        const size_t n = items.size();
+        const size_t bucket_count = n / 4 + 1;
+        std::vector<std::vector<uint32_t>> buckets(bucket_count);
+        for (uint32_t id = 0; id < n; ++id)
+        {
+            buckets[hash_title(items[id].getTitle()) % bucket_count].push_back(id);
+        }
+
+        std::vector<size_t> order(bucket_count);
+        for (size_t i = 0; i < bucket_count; ++i) order[i] = i;
+        std::sort(order.begin(), order.end(),
+            [&](size_t a, size_t b) { return buckets[a].size() > buckets[b].size(); });
+
+        const uint32_t empty = UINT32_MAX;
+        bucket_seeds.assign(bucket_count, 0);
+        slots.assign(n, empty);
+        std::vector<size_t> taken;
+        for (size_t bucket : order)
+        {
+            if (buckets[bucket].empty())
+            {
+                break;
+            }
+
+            bool placed = false;
+            for (uint32_t seed = 1; seed < (1u << 20) && !placed; ++seed)
+            {
+                taken.clear();
+                placed = true;
+                for (uint32_t id : buckets[bucket])
+                {
+                    size_t slot = hash_title(items[id].getTitle(), seed) % n;
+                    if (slots[slot] != empty || std::find(taken.begin(), taken.end(), slot) != taken.end())
+                    {
+                        placed = false;
+                        break;
+                    }
+                    taken.push_back(slot);
+                }
+                if (placed)
+                {
+                    bucket_seeds[bucket] = seed;
+                    for (size_t i = 0; i < taken.size(); ++i)
+                    {
+                        slots[taken[i]] = buckets[bucket][i];
+                    }
+                }
+            }
+
+            if (!placed)
+            {
+                bucket_seeds.clear();
+                slots.clear();
+                return false;
+            }
+        }
+        return true;
+    }
+
+public:
+    static constexpr uint32_t npos = UINT32_MAX;
+
+    // Добавляет товар и возвращает его ID; названия в каталоге уникальны
+    uint32_t add(const Product& product)
+    {
+        if (find_id(product.title_handle()) != npos)
+        {
+            throw std::invalid_argument("Duplicate product title: " + product.getTitle());
+        }
+        uint32_t id = static_cast<uint32_t>(items.size());
+        items.push_back(Product(product, &allocation_counter));
+        items.back().set_id(id);
+        uint32_t title = product.title_handle().id();
+        if (title >= by_title.size())
+        {
+            by_title.resize(std::max<size_t>(title + 1, by_title.size() * 2), npos);
+        }
+        by_title[title] = id;
+        search_index.add(id, product.getCompany(), product.getTitle());
+        if (frozen)
+        {
+            // Архивный товар из resolve после freeze: в хеш он попадёт при rehash_titles
+            late_titles.emplace(items.back().getTitle(), id);
+        }
+        return id;
+    }
+
+    // ID товара по названию. Товары из старых записей, которых уже нет в продаже,
+    // добавляются в каталог как архивные, чтобы история ссылалась на них по ID.
+    uint32_t resolve(std::string_view company, std::string_view title, double price)
+    {
+        uint32_t id = find_id(title);
+        return id != npos ? id : add(Product(std::string(company), std::string(title), price, 0.0));
+    }
+
+    // Новая цена товара с момента time (секунды Unix-времени); false, если товара нет
+    bool reprice(uint32_t id, double price, int64_t time)
+    {
+        if (id >= items.size())
+        {
+            return false;
+        }
+        std::unique_lock<std::shared_mutex> lock(prices_mutex);
+        items[id].set_price(time, price);
+        return true;
+    }
+
+    // Переоценка всего каталога разом: new_price(товар) - новая цена товара с момента time
+    template <typename NewPrice>
+    void reprice_all(NewPrice&& new_price, int64_t time)
+    {
+        std::unique_lock<std::shared_mutex> lock(prices_mutex);
+        for (Product& product : items)
+        {
+            product.set_price(time, new_price(static_cast<const Product&>(product)));
+        }
+    }
+
+    // Цена товара в момент time; false, если товара нет
+    bool price_at(uint32_t id, int64_t time, double& price) const
+    {
+        std::shared_lock<std::shared_mutex> lock(prices_mutex);
+        return id < items.size() && items[id].price_at(time, price);
+    }
+
+    // Каталог больше не меняется: при CATALOG_PERFECT_HASH строится совершенный хеш.
+    // Товары, добавленные позже (архивные из resolve), ищутся в late_titles, пока
+    // rehash_titles не перестроит хеш.
+    void freeze()
+    {
+        sealed = true;
+        frozen = false;
+        rehash_titles();
+    }
+
+    // Переносит в совершенный хеш товары, добавленные после его построения; вызывается
+    // после пачки добавлений (загрузки снимка и журнала), а не на каждое
+    void rehash_titles()
+    {
+#if CATALOG_PERFECT_HASH
+        if (sealed && (!frozen || !late_titles.empty()))
+        {
+            frozen = !items.empty() && build_perfect_hash();
+            late_titles.clear();
+        }
+#endif
+    }
+
+    uint32_t find_id(std::string_view title) const
+    {
+        if (frozen)
+        {
+            uint64_t bucket = hash_title(title) % bucket_seeds.size();
+            uint32_t id = slots[hash_title(title, bucket_seeds[bucket]) % slots.size()];
+            if (items[id].getTitle() == title)
+            {
+                return id;
+            }
+            if (late_titles.empty())
+            {
+                return npos;
+            }
+            auto late = late_titles.find(title);
+            return late != late_titles.end() ? late->second : npos;
+        }
+        InternedString handle;
+        return string_pool.find(title, handle) ? find_id(handle) : npos;
+    }
+
+    uint32_t find_id(InternedString title) const
+    {
+        return title.id() < by_title.size() ? by_title[title.id()] : npos;
+    }
+
+    const Product* find_by_title(std::string_view title) const
+    {
+        uint32_t id = find_id(title);
+        return id != npos ? &items[id] : nullptr;
+    }
+
+    const Product* find_by_id(uint32_t id) const
+    {
+        return id < items.size() ? &items[id] : nullptr;
+    }
+
+    // ID до k товаров, лучше всего подходящих к запросу (части названия или компании)
+    std::vector<uint32_t> search(std::string_view query, size_t k) const
+    {
+        return search_index.search(query, k);
+    }
+
+    size_t size() const
+    {
+        return items.size();
+    }
+
+    size_t title_index_memory() const
+    {
+        return by_title.capacity() * sizeof(uint32_t) + (bucket_seeds.capacity() + slots.capacity()) * sizeof(uint32_t);
+    }
+};
+
+const char* const USERS_FILE = "users.txt";
+const char* const JOURNAL_FILE = "users.journal";
+const char* const USER_DB_PREFIX = "users.";
+const char* const USER_DB_SUFFIX = ".db";
+
+static std::FILE* open_file(const char* path, const char* mode)
+{
+#ifdef _WIN32
+    std::FILE* file = nullptr;
+    return fopen_s(&file, path, mode) == 0 ? file : nullptr;
+#else
+    return std::fopen(path, mode);
+#endif
+}
+
+static void flush_to_disk(std::FILE* file)
+{
+    std::fflush(file);
+#ifdef _WIN32
+    _commit(_fileno(file));
+#else
+    fsync(fileno(file));
+#endif
+}
+
+// Сборка с STORE_TRACING=0 убирает трассировку целиком: TraceSpan становится пустым
+#ifndef STORE_TRACING
+#define STORE_TRACING 1
+#endif
+
+#if STORE_TRACING
+// Трасса отдельных запросов в формате Chrome/Perfetto (chrome://tracing, ui.perfetto.dev):
+// --trace=<файл> [--trace-sample=N]. Запрос - корневой участок TraceSpan::request; в трассу
+// попадает каждый N-й запрос потока со всеми вложенными участками. Участки копятся в буфере
+// потока; полный буфер (и остаток при завершении потока) отдаётся потоку записи трассы,
+// так что запрос, даже под блокировкой пользователя, в файл не пишет.
+class TraceRecorder
+{
+public:
+    struct Event
+    {
+        const char* name;     // строковый литерал без кавычек и обратных косых
+        uint64_t start_ns;    // от открытия трассы
+        uint64_t duration_ns;
+        const char* arg_name; // nullptr - без аргумента
+        int64_t arg_value;
+    };
+
+    // Трассировка одного потока; пишет и читает только сам поток
+    struct ThreadBuffer
+    {
+        TraceRecorder& owner;
+        std::vector<Event> events;
+        uint64_t requests = 0;
+        unsigned depth = 0; // открытых участков выбранного запроса
+        uint32_t tid;
+
+        explicit ThreadBuffer(TraceRecorder& owner)
+            : owner(owner), tid(owner.next_tid.fetch_add(1, std::memory_order_relaxed)) {}
+
+        ~ThreadBuffer()
+        {
+            owner.flush(*this);
+        }
+    };
+
+    static const size_t BUFFER_EVENTS = 4096;
+
+    ~TraceRecorder()
+    {
+        close();
+    }
+
+    // Вызывается до начала работы потоков
+    bool open(const std::string& path, uint64_t sample_every)
+    {
+        file = open_file(path.c_str(), "wb");
+        if (!file)
+        {
+            return false;
+        }
+        every = std::max<uint64_t>(1, sample_every);
+        origin = std::chrono::steady_clock::now();
+        std::fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", file);
+        stopping = false;
+        writer = std::thread([this] { run(); });
+        enabled.store(true, std::memory_order_release);
+        return true;
+    }
+
+    // Отданные буферы дописываются; буферы потоков, ещё не отданные, при этом теряются
+    void close()
+    {
+        if (!writer.joinable())
+        {
+            return;
+        }
+        enabled.store(false, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        ready.notify_one();
+        writer.join();
+        std::fputs("\n]}\n", file);
+        std::fclose(file);
+        file = nullptr;
+    }
+
+    bool active() const
+    {
+        return enabled.load(std::memory_order_acquire);
+    }
+
+    ThreadBuffer& local()
+    {
+        static thread_local ThreadBuffer buffer(*this);
+        return buffer;
+    }
+
+    uint64_t sample_every() const
+    {
+        return every;
+    }
+
+    uint64_t now_ns() const
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - origin).count());
+    }
+
+    void add(ThreadBuffer& buffer, const Event& event)
+    {
+        buffer.events.push_back(event);
+        if (buffer.events.size() >= BUFFER_EVENTS)
+        {
+            flush(buffer);
+        }
+    }
+
+    // Отдаёт события буфера потоку записи: под mutex только перемещение вектора
+    void flush(ThreadBuffer& buffer)
+    {
+        if (buffer.events.empty())
+        {
+            return;
+        }
+        std::vector<Event> events;
+        events.swap(buffer.events);
+        buffer.events.reserve(BUFFER_EVENTS);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!stopping)
+            {
+                pending.push_back({ buffer.tid, std::move(events) });
+            }
+        }
+        ready.notify_one();
+    }
+
+private:
+    struct Batch
+    {
+        uint32_t tid;
+        std::vector<Event> events;
+    };
+
+    std::atomic<bool> enabled{ false };
+    uint64_t every = 1;
+    std::chrono::steady_clock::time_point origin;
+    std::atomic<uint32_t> next_tid{ 1 };
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::vector<Batch> pending; // под mutex
+    bool stopping = true;       // под mutex; true - трасса не открыта или закрывается
+    std::thread writer;
+    std::FILE* file = nullptr;  // пишет только поток записи
+    uint64_t written = 0;
+
+    // Поток записи: дописывает отданные буферы, "X" - участок с началом и длительностью,
+    // в микросекундах
+    void run()
+    {
+        std::vector<Batch> batches;
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;)
+        {
+            ready.wait(lock, [&] { return stopping || !pending.empty(); });
+            if (pending.empty())
+            {
+                return;
+            }
+            batches.swap(pending);
+            lock.unlock();
+            for (const Batch& batch : batches)
+            {
+                for (const Event& event : batch.events)
+                {
+                    std::fprintf(file, "%s{\"name\":\"%s\",\"cat\":\"store\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                        "\"ts\":%.3f,\"dur\":%.3f", written++ == 0 ? "" : ",\n", event.name, batch.tid,
+                        event.start_ns / 1000.0, event.duration_ns / 1000.0);
+                    if (event.arg_name)
+                    {
+                        std::fprintf(file, ",\"args\":{\"%s\":%lld}", event.arg_name, static_cast<long long>(event.arg_value));
+                    }
+                    std::fputc('}', file);
+                }
+            }
+            std::fflush(file);
+            batches.clear();
+            lock.lock();
+        }
+    }
+};
+
+TraceRecorder tracer;
+
+// Участок трассы от конструктора до деструктора. Вне выбранного запроса (и когда трасса
+// выключена) не пишет ничего и стоит одной проверки флага.
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char* name)
+    {
+        if (!tracer.active())
+        {
+            return;
+        }
+        TraceRecorder::ThreadBuffer& local = tracer.local();
+        if (local.depth > 0)
+        {
+            begin(local, name);
+        }
+    }
+
+    // Корневой участок запроса: решает, попадёт ли запрос в трассу. Редкие долгие запросы
+    // (запись снимка) пишутся всегда, always = true.
+    static TraceSpan request(const char* name, bool always = false)
+    {
+        TraceSpan span;
+        if (tracer.active())
+        {
+            TraceRecorder::ThreadBuffer& local = tracer.local();
+            if (always || local.depth > 0 || local.requests++ % tracer.sample_every() == 0)
+            {
+                span.begin(local, name);
+            }
+        }
+        return span;
+    }
+
+    TraceSpan(TraceSpan&& other) noexcept
+        : buffer(std::exchange(other.buffer, nullptr))
+    {
+        if (buffer)
+        {
+            event = other.event;
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    ~TraceSpan()
+    {
+        if (buffer)
+        {
+            event.duration_ns = tracer.now_ns() - event.start_ns;
+            --buffer->depth;
+            tracer.add(*buffer, event);
+        }
+    }
+
+    // Числовой аргумент участка (id пользователя, ID товара)
+    void arg(const char* name, int64_t value)
+    {
+        if (buffer)
+        {
+            event.arg_name = name;
+            event.arg_value = value;
+        }
+    }
+
+private:
+    TraceRecorder::ThreadBuffer* buffer = nullptr;
+    TraceRecorder::Event event; // заполняется, только если участок пишется
+
+    TraceSpan() = default;
+
+    void begin(TraceRecorder::ThreadBuffer& local, const char* name)
+    {
+        buffer = &local;
+        ++local.depth;
+        event = { name, tracer.now_ns(), 0, nullptr, 0 };
+    }
+};
+#else
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char*) {}
+    ~TraceSpan() {}
+    static TraceSpan request(const char*, bool = false) { return TraceSpan(""); }
+    void arg(const char*, int64_t) {}
+};
+#endif
+
+// Выполняет body внутри участка трассы name и возвращает его результат
+template <typename Body>
+static auto traced(const char* name, Body&& body)
+{
+    TraceSpan span(name);
+    return body();
+}
+
+// Политика сброса журнала на диск
+enum class JournalSync
+{
+    None,        // сброс оставляем операционной системе
+    EveryRecord, // fsync после каждой записи
+    Group        // групповой fsync: раз в group_records записей или раз в group_interval
+};
+
+struct JournalConfig
+{
+    JournalSync sync = JournalSync::Group;
+    size_t group_records = 32;
+    std::chrono::milliseconds group_interval{ 50 };
+};
+
+// Файл вида <prefix><номер><suffix>: сегмент журнала или снимок базы
+struct NumberedFile
+{
+    unsigned long long seq;
+    std::string path;
+};
+
+static std::vector<NumberedFile> list_numbered_files(const std::string& prefix, const std::string& suffix)
+{
+    std::vector<NumberedFile> files;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(".", error))
+    {
+        std::string name = entry.path().filename().string();
+        if (name.size() <= prefix.size() + suffix.size() ||
+            name.compare(0, prefix.size(), prefix) != 0 ||
+            name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0)
+        {
+            continue;
+        }
+        std::string number = name.substr(prefix.size(), name.size() - prefix.size() - suffix.size());
+        if (number.find_first_not_of("0123456789") != std::string::npos)
+        {
+            continue;
+        }
+        files.push_back({ std::stoull(number), name });
+    }
+    std::sort(files.begin(), files.end(),
+        [](const NumberedFile& a, const NumberedFile& b) { return a.seq < b.seq; });
+    return files;
+}
+
+// Сегменты журнала называются users.journal.<номер первой записи>
+static std::string journal_segment_path(unsigned long long first_seq)
+{
+    return std::string(JOURNAL_FILE) + "." + std::to_string(first_seq);
+}
+
+static std::vector<NumberedFile> list_journal_segments()
+{
+    return list_numbered_files(std::string(JOURNAL_FILE) + ".", "");
+}
+
+// Отрезает от сегмента оборванную последнюю запись (без перевода строки), оставшуюся
+// от сбоя во время записи: иначе следующая дописанная запись склеилась бы с ней
+static void truncate_torn_record(const std::string& path)
+{
+    std::error_code error;
+    const uintmax_t size = std::filesystem::file_size(path, error);
+    if (error || size == 0)
+    {
+        return;
+    }
+
+    std::ifstream file(path, std::ios::binary);
+    char chunk[4096];
+    uintmax_t end = size; // ищем последний '\n' с конца файла
+    while (end > 0)
+    {
+        const size_t length = static_cast<size_t>(std::min<uintmax_t>(end, sizeof(chunk)));
+        file.seekg(static_cast<std::streamoff>(end - length));
+        if (!file.read(chunk, static_cast<std::streamsize>(length)))
+        {
+            return;
+        }
+        size_t last = length;
+        while (last > 0 && chunk[last - 1] != '\n')
+        {
+            --last;
+        }
+        end -= length - last;
+        if (last > 0)
+        {
+            break;
+        }
+    }
+    if (end == size)
+    {
+        return;
+    }
+    file.close();
+    std::cerr << "Dropping a torn record at the end of " << path << ".\n";
+    std::filesystem::resize_file(path, end, error);
+}
+
+// Текстовое поле записи журнала (имя, компания, название): табуляция разделяет поля,
+// перевод строки - записи, поэтому они пишутся как \t, \n, \r, а обратная косая удваивается
+static std::string escape_journal_field(std::string_view text)
+{
+    std::string escaped;
+    escaped.reserve(text.size());
+    for (char c : text)
+    {
+        switch (c)
+        {
+        case '\t': escaped += "\\t"; break;
+        case '\n': escaped += "\\n"; break;
+        case '\r': escaped += "\\r"; break;
+        case '\\': escaped += "\\\\"; break;
+        default: escaped += c; break;
+        }
+    }
+    return escaped;
+}
+
+// Журнал изменений пользователей. Регистрация, пополнение счёта и покупка
+// дописываются в конец текущего сегмента одной строкой, вместо перезаписи всего users.txt.
+// Каждая запись имеет порядковый номер, снимок хранит номер последней учтённой
+// записи, поэтому при повторном проигрывании ничего не применяется дважды.
+// Журнал потокобезопасен и фиксирует записи группами: строка форматируется без
+// блокировок, а под коротким mutex получает номер и попадает в общий буфер. В файл буфер
+// пишет и fsync делает поток журнала, за всех сразу. Вызывающий ждёт свою запись в
+// commit(seq), уже отпустив свои блокировки, поэтому покупки разных полос не выстраиваются
+// в очередь к диску.
+class UserJournal
+{
+private:
+    std::FILE* file = nullptr; // меняется под обоими mutex, читается под любым
+    std::FILE* retired = nullptr;     // под обоими mutex: прошлый сегмент, ещё не сброшенный на диск
+    unsigned long long retired_seq = 0; // последняя запись в retired
+    JournalConfig config;
+    std::atomic<unsigned long long> next_seq{ 1 };
+    std::string buffer;                 // под mutex: записи, ещё не отданные ОС
+    size_t buffered = 0;                // под mutex: сколько их
+    std::string batch;                  // под sync_mutex: пачка, которую пишет поток журнала
+    unsigned long long written_seq = 0; // под mutex: последняя запись, отданная ОС
+    unsigned long long durable_seq = 0; // под mutex: последняя запись на диске
+    size_t unsynced = 0;                // под mutex: записей в ОС без fsync
+    std::chrono::steady_clock::time_point last_sync = std::chrono::steady_clock::now();
+    bool stopping = false;
+    std::mutex mutex;      // буфер, номера записей, состояние потока журнала
+    std::mutex sync_mutex; // запись в файл, fsync и смена сегмента; берётся раньше mutex
+    std::condition_variable work;      // потоку журнала: есть что писать
+    std::condition_variable committed; // ждущим commit: written_seq или durable_seq выросли
+    std::thread flusher;
+
+    // Дописывает запись с очередным номером (номер ставится перед строкой format, которая
+    // начинается с табуляции). Возвращает номер или 0, если журнал закрыт.
+    template <typename... Args>
+    unsigned long long write_record(const char* format, Args... args)
+    {
+        char line[512];
+        int length = std::snprintf(line, sizeof(line), format, args...);
+        std::string long_line;
+        if (length >= static_cast<int>(sizeof(line)))
+        {
+            long_line.resize(static_cast<size_t>(length) + 1);
+            std::snprintf(long_line.data(), long_line.size(), format, args...);
+            long_line.pop_back();
+        }
+        std::string_view text = long_line.empty() ? std::string_view(line, static_cast<size_t>(std::max(length, 0))) : long_line;
+
+        unsigned long long seq;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!file) return 0;
+            seq = next_seq++;
+            char number[24];
+            buffer.append(number, std::to_chars(number, number + sizeof(number), seq).ptr);
+            buffer += text;
+            ++buffered;
+        }
+        work.notify_one();
+        return seq;
+    }
+
+    // Отдаёт ОС накопленный буфер и, если пора по политике (или force_sync), делает fsync.
+    // Прошлый сегмент, оставленный rotate, сбрасывается на диск и закрывается.
+    // Вызывается под sync_mutex.
+    void write_pending(bool force_sync, bool allow_sync = true)
+    {
+        std::FILE* current;
+        std::FILE* old_segment;
+        unsigned long long old_seq;
+        unsigned long long target;
+        bool need_sync;
+        batch.clear();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            old_segment = std::exchange(retired, nullptr);
+            old_seq = retired_seq;
+            batch.swap(buffer);
+            unsynced += std::exchange(buffered, 0);
+            current = file;
+            target = next_seq - 1;
+            switch (config.sync)
+            {
+            case JournalSync::None:
+                need_sync = force_sync;
+                break;
+            case JournalSync::EveryRecord:
+                need_sync = true;
+                break;
+            default:
+                need_sync = force_sync || unsynced >= config.group_records ||
+                    (unsynced > 0 && std::chrono::steady_clock::now() - last_sync >= config.group_interval);
+                break;
+            }
+            need_sync = need_sync && allow_sync;
+        }
+        if (old_segment)
+        {
+            flush_to_disk(old_segment);
+            std::fclose(old_segment);
+        }
+        if (current)
+        {
+            if (!batch.empty())
+            {
+                std::fwrite(batch.data(), 1, batch.size(), current);
+                std::fflush(current);
+            }
+            if (need_sync)
+            {
+                flush_to_disk(current); // файл не закроется: закрытие тоже идёт под sync_mutex
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            written_seq = std::max(written_seq, target);
+            if (old_segment)
+            {
+                durable_seq = std::max(durable_seq, old_seq);
+            }
+            if (need_sync)
+            {
+                durable_seq = std::max(durable_seq, target);
+                unsynced = 0;
+                last_sync = std::chrono::steady_clock::now();
+            }
+        }
+        committed.notify_all();
+    }
+
+    // Поток журнала: пишет буфер, как только в нём что-то есть; при групповом fsync
+    // досыпает не дольше group_interval до сброса хвоста
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping)
+        {
+            if (buffered == 0 && !retired)
+            {
+                if (config.sync == JournalSync::Group && unsynced > 0)
+                {
+                    work.wait_until(lock, last_sync + config.group_interval);
+                }
+                else
+                {
+                    work.wait(lock);
+                }
+                if (buffered == 0 && !retired && (config.sync != JournalSync::Group || unsynced == 0))
+                {
+                    continue;
+                }
+            }
+            lock.unlock();
+            {
+                std::lock_guard<std::mutex> sync_lock(sync_mutex);
+                write_pending(false);
+            }
+            lock.lock();
+        }
+    }
+
+    // Пишет всё записанное к этому моменту, затем под mutex (когда новых записей нет)
+    // меняет файл: открывает сегмент с номером first_seq или, при пустом path, закрывает.
+    // Без sync_old старый сегмент без fsync переходит в retired, и его сбрасывает на
+    // диск поток журнала.
+    bool replace_file_locked(const std::string& path, unsigned long long first_seq, bool sync_old = true)
+    {
+        for (;;)
+        {
+            write_pending(sync_old, sync_old);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (buffered > 0)
+            {
+                continue;
+            }
+            bool keep_durable = false;
+            if (file && !sync_old && unsynced > 0 && config.sync != JournalSync::None)
+            {
+                retired = file; // write_pending выше уже сбросил прошлый retired
+                retired_seq = next_seq - 1;
+                unsynced = 0;
+                keep_durable = true;
+                work.notify_one();
+            }
+            else if (file)
+            {
+                std::fclose(file);
+            }
+            file = nullptr;
+            if (path.empty())
+            {
+                return true;
+            }
+            next_seq = first_seq;
+            written_seq = first_seq - 1;
+            if (!keep_durable)
+            {
+                durable_seq = first_seq - 1;
+            }
+            truncate_torn_record(path);
+            file = open_file(path.c_str(), "ab");
+            if (!file)
+            {
+                std::cerr << "Failed to open " << path << " for writing.\n";
+                return false;
+            }
+            if (!flusher.joinable())
+            {
+                flusher = std::thread([this] { run(); });
+            }
+            return true;
+        }
+    }
+
+public:
+    UserJournal() = default;
+    UserJournal(const UserJournal&) = delete;
+    UserJournal& operator=(const UserJournal&) = delete;
+
+    ~UserJournal()
+    {
+        close();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        work.notify_one();
+        if (flusher.joinable())
+        {
+            flusher.join();
+        }
+    }
+
+    // Открывает новый сегмент, первая запись которого получит номер first_seq
+    bool open(unsigned long long first_seq)
+    {
+        std::lock_guard<std::mutex> sync_lock(sync_mutex);
+        return replace_file_locked(journal_segment_path(first_seq), first_seq);
+    }
+
+    // Закрывает текущий сегмент и начинает следующий; старые сегменты можно
+    // удалить, как только снимок покроет last_seq(). fsync закрытого сегмента делает
+    // поток журнала, поэтому rotate можно звать под блокировками пользователей.
+    bool rotate()
+    {
+        std::lock_guard<std::mutex> sync_lock(sync_mutex);
+        unsigned long long first_seq = next_seq;
+        return replace_file_locked(journal_segment_path(first_seq), first_seq, false);
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> sync_lock(sync_mutex);
+        replace_file_locked("", 0);
+    }
+
+    void set_config(const JournalConfig& new_config)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        config = new_config;
+    }
+
+    unsigned long long last_seq() const
+    {
+        return next_seq - 1;
+    }
+
+    // Ждёт, пока запись seq отдана ОС (и переживёт падение процесса), а при fsync каждой
+    // записи - пока она на диске. Вызывается без блокировок пользователя.
+    void commit(unsigned long long seq)
+    {
+        if (seq == 0)
+        {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        committed.wait(lock, [&] {
+            return (config.sync == JournalSync::EveryRecord ? durable_seq : written_seq) >= seq || !file;
+        });
+    }
+
+    unsigned long long append_sign_up(int user_id, const std::string& full_name, double initial_balance)
+    {
+        return write_record("\tU\t%d\t%.17g\t%s\n", user_id, initial_balance, escape_journal_field(full_name).c_str());
+    }
+
+    unsigned long long append_top_up(int user_id, double amount)
+    {
+        return write_record("\tB\t%d\t%.17g\n", user_id, amount);
+    }
+
+    // Товар записывается названием: ID каталога не обязаны совпадать между запусками
+    unsigned long long append_purchase(int user_id, const Product& product, const PurchaseRecord& record)
+    {
+        return write_record("\tP\t%d\t%.17g\t%.9g\t%lld\t%s\t%s\n", user_id, record.price,
+            static_cast<double>(record.discount), static_cast<long long>(record.timestamp),
+            escape_journal_field(product.getCompany()).c_str(), escape_journal_field(product.getTitle()).c_str());
+    }
+
+    // Всё записанное - на диск
+    void sync()
+    {
+        std::lock_guard<std::mutex> sync_lock(sync_mutex);
+        write_pending(true);
+    }
+};
+
+UserJournal journal;
+
+class User
+{
+public:
+    // Имя и история - в памяти, которую дал владелец: арена пачки при загрузке,
+    // пул таблицы users
+    using allocator_type = std::pmr::polymorphic_allocator<>;
+
+    int id;
+    std::pmr::string full_name;
+    double account_balance;
+    double discount = 0.0;
+    std::pmr::vector<PurchaseRecord> purchased_products;
+
+    User() = default;
+
+    explicit User(const allocator_type& allocator)
+        : full_name(allocator), purchased_products(allocator) {}
+
+    User(int id, std::string_view full_name, double initial_balance, const allocator_type& allocator = {})
+        : id(id), full_name(full_name, allocator), account_balance(initial_balance), purchased_products(allocator) {}
+
+    User(const User& other, const allocator_type& allocator)
+        : id(other.id), full_name(other.full_name, allocator), account_balance(other.account_balance),
+        discount(other.discount), purchased_products(other.purchased_products, allocator) {}
+
+    // Пополнение счёта; вызывается под блокировкой пользователя в CheckoutService
+    void add_balance(double amount)
+    {
+        account_balance += amount; // используем account_balance вместо AMOUNT_OF_MONEY
+    }
+
+    virtual double individual_discount() const
+    {
+        return 0.0;
+    }
+
+    virtual bool purchase_product(Product& product, size_t price_index)
+    {
+        if (price_index >= product.get_price_size())
+        {
+            std::cout << "Invalid price index.\n";
+            return false;
+        }
+
+        double max_discounted_price = product.get_price(price_index) * (1.0 - product.get_max_discount());
+
+        double user_discount = individual_discount();
+
+        double applied_discount = std::max(user_discount, product.get_max_discount());
+
+        double discounted_price = product.get_price(price_index) * (1.0 - applied_discount);
+
+        if (account_balance >= discounted_price)
+        {
+            account_balance -= discounted_price;
+            purchased_products.push_back({ product.get_id(), static_cast<float>(applied_discount), discounted_price, unix_time_now() });
+            return true; // purchase was successful
+        }
+        else
+        {
+            std::cout << "Insufficient funds.\n";
+            return false; // insufficient funds
+        }
+    }
+};
+
+class RegularCustomer : public User
+{
+private:
+    double total_purchase_cost;
+
+public:
+    RegularCustomer(std::string full_name, double initial_balance)
+        : User(0, full_name, initial_balance), total_purchase_cost(0.0) {}
+
+    double individual_discount() const override
+    {
+        return std::min(total_purchase_cost / 1000.0, 0.15);
+    }
+
+    bool purchase_product(Product& product, size_t price_index) override
+    {
+        bool purchase_successful = User::purchase_product(product, price_index);
+        if (purchase_successful)
+        {
+            total_purchase_cost += product.get_price(price_index);
+        }
+        return purchase_successful;
+    }
+};
+
+// Блок таблицы пользователей, разложенный по столбцам. Горячие поля, которые трогает
+// каждая покупка и обход балансов (id, баланс, скидка), лежат в плотных массивах;
+// имя и история покупок - в холодной части, выделенной отдельно, и в кэш не попадают.
+// Холодная часть берёт память из пула таблицы.
+const unsigned USER_CHUNK_BITS = 14;
+const size_t USER_CHUNK_SIZE = size_t(1) << USER_CHUNK_BITS;
+
+struct UserColumns
+{
+    struct Cold
+    {
+        using allocator_type = std::pmr::polymorphic_allocator<>;
+
+        std::pmr::string full_name;
+        std::pmr::vector<PurchaseRecord> purchased_products;
+
+        explicit Cold(const allocator_type& allocator)
+            : full_name(allocator), purchased_products(allocator) {}
+
+        Cold(const Cold& other, const allocator_type& allocator)
+            : full_name(other.full_name, allocator), purchased_products(other.purchased_products, allocator) {}
+    };
+
+    std::atomic<bool> used[USER_CHUNK_SIZE]{};
+    int ids[USER_CHUNK_SIZE];
+    double balances[USER_CHUNK_SIZE];
+    double discounts[USER_CHUNK_SIZE];
+    std::pmr::vector<Cold> cold;
+    std::atomic<uint64_t> saved_epoch{ 0 }; // снимок контрольной точки, в который блок уже скопирован
+    std::mutex save_mutex;                  // копирование блока в снимок
+
+    explicit UserColumns(std::pmr::memory_resource* memory)
+        : cold(USER_CHUNK_SIZE, memory) {}
+
+    void store(size_t index, User&& user)
+    {
+        ids[index] = user.id;
+        balances[index] = user.account_balance;
+        discounts[index] = user.discount;
+        cold[index].full_name = std::move(user.full_name);
+        cold[index].purchased_products = std::move(user.purchased_products);
+    }
+};
+
+// Пользователь в таблице: ссылка на ячейку блока. Как указатель, ссылка пуста, если
+// пользователя нет, и не переносит константность на пользователя.
+class UserRef
+{
+private:
+    friend class UserTable;
+
+    UserColumns* columns = nullptr;
+    size_t index = 0;
+
+public:
+    UserRef() = default;
+
+    UserRef(UserColumns* columns, size_t index)
+        : columns(columns), index(index) {}
+
+    explicit operator bool() const
+    {
+        return columns != nullptr;
+    }
+
+    int id() const
+    {
+        return columns->ids[index];
+    }
+
+    double& account_balance() const
+    {
+        return columns->balances[index];
+    }
+
+    double& discount() const
+    {
+        return columns->discounts[index];
+    }
+
+    std::pmr::string& full_name() const
+    {
+        return columns->cold[index].full_name;
+    }
+
+    std::pmr::vector<PurchaseRecord>& purchased_products() const
+    {
+        return columns->cold[index].purchased_products;
+    }
+
+    // Пополнение счёта; вызывается под блокировкой пользователя в CheckoutService
+    void add_balance(double amount) const
+    {
+        account_balance() += amount;
+    }
+
+    User to_user() const
+    {
+        User user(id(), full_name(), account_balance());
+        user.discount = discount();
+        user.purchased_products = purchased_products();
+        return user;
+    }
+};
+
+
+
+// Отображение файла в память только для чтения
+class MappedFile
+{
+private:
+    const char* view = nullptr;
+    size_t view_size = 0;
+#ifdef _WIN32
+    HANDLE file_handle = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile()
+    {
+        close();
+    }
+
+    bool open(const std::string& path)
+    {
+        close();
+#ifdef _WIN32
+        // FILE_SHARE_DELETE позволяет удалить устаревший снимок, пока он отображён
+        file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file_handle == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart == 0)
+        {
+            close();
+            return false;
+        }
+        mapping = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping)
+        {
+            close();
+            return false;
+        }
+        view = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        view_size = static_cast<size_t>(file_size.QuadPart);
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0)
+        {
+            close();
+            return false;
+        }
+        void* address = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        if (address == MAP_FAILED)
+        {
+            close();
+            return false;
+        }
+        view = static_cast<const char*>(address);
+        view_size = static_cast<size_t>(info.st_size);
+#endif
+        if (!view)
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        if (view) UnmapViewOfFile(view);
+        if (mapping) CloseHandle(mapping);
+        if (file_handle != INVALID_HANDLE_VALUE) CloseHandle(file_handle);
+        mapping = nullptr;
+        file_handle = INVALID_HANDLE_VALUE;
+#else
+        if (view) munmap(const_cast<char*>(view), view_size);
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+#endif
+        view = nullptr;
+        view_size = 0;
+    }
+
+    const char* data() const
+    {
+        return view;
+    }
+
+    size_t size() const
+    {
+        return view_size;
+    }
+
+    // Файл будет прочитан целиком по порядку: ОС может читать вперёд крупными блоками
+    void advise_sequential() const
+    {
+#ifndef _WIN32
+        if (view) posix_madvise(const_cast<char*>(view), view_size, POSIX_MADV_SEQUENTIAL);
+#endif
+    }
+};
+
+// Бинарный формат базы пользователей users.<seq>.db (seq - последняя запись журнала в снимке).
+// Файл отображается в память целиком: заголовок, таблица пользователей фиксированного
+// размера (отсортирована по id), таблица покупок, таблица товаров, на которые ссылаются
+// покупки, и куча строк (имена, компании, названия). Все числа хранятся в little-endian.
+// Версия 1 хранила в каждой покупке строки товара; такие файлы по-прежнему читаются.
+// Версия 3 добавила в заголовок число выданных ячеек плотной таблицы пользователей.
+const char USER_DB_MAGIC[8] = { 'H', 'M', 'U', 'S', 'E', 'R', 'D', 'B' };
+const uint32_t USER_DB_VERSION = 3;
+
+struct UserDbHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t covered_seq;
+    uint64_t user_count;
+    uint64_t users_offset;
+    uint64_t purchase_count;
+    uint64_t purchases_offset;
+    uint64_t strings_size;
+    uint64_t strings_offset;
+    uint64_t product_count;   // с версии 2
+    uint64_t products_offset; // с версии 2
+    uint64_t user_slot_count; // с версии 3
+};
+
+const uint32_t USER_DB_V1_HEADER_SIZE = 72;
+const uint32_t USER_DB_V2_HEADER_SIZE = 88;
+
+struct UserDbEntry
+{
+    int64_t id;
+    double account_balance;
+    double discount;
+    uint64_t name_offset;
+    uint32_t name_length;
+    uint32_t purchase_count;
+    uint64_t first_purchase;
+};
+
+// Товар в таблице товаров (версия 2) или покупка (версия 1)
+struct UserDbProduct
+{
+    uint64_t company_offset;
+    uint64_t title_offset;
+    uint32_t company_length;
+    uint32_t title_length;
+    double price;
+};
+
+static_assert(sizeof(UserDbHeader) == 96, "UserDbHeader layout is part of the file format");
+static_assert(sizeof(UserDbEntry) == 48, "UserDbEntry layout is part of the file format");
+static_assert(sizeof(UserDbProduct) == 32, "UserDbProduct layout is part of the file format");
+
+static std::string user_db_path(unsigned long long covered_seq)
+{
+    return std::string(USER_DB_PREFIX) + std::to_string(covered_seq) + USER_DB_SUFFIX;
+}
+
+// Открытый снимок базы. Открытие стоит O(число товаров): проверяется заголовок и
+// ID товаров файла сопоставляются с каталогом; страницы таблицы пользователей
+// подгружаются ОС по мере обращения к пользователям.
+class UserDatabase
+{
+private:
+    MappedFile file;
+    const UserDbHeader* header = nullptr;
+    uint32_t version = 0;
+    const UserDbEntry* entries = nullptr;
+    const char* purchases = nullptr;
+    const char* strings = nullptr;
+    uint64_t strings_size = 0;
+    ProductCatalog* catalog = nullptr;
+    std::vector<uint32_t> product_ids; // ID товара в файле -> ID в каталоге
+
+    static bool range_fits(uint64_t offset, uint64_t count, uint64_t item_size, uint64_t file_size)
+    {
+        return offset <= file_size && count <= (file_size - offset) / item_size;
+    }
+
+    bool string_at(uint64_t offset, uint32_t length, std::string_view& out) const
+    {
+        if (offset > strings_size || length > strings_size - offset)
+        {
+            return false;
+        }
+        out = std::string_view(strings + offset, length);
+        return true;
+    }
+
+    bool resolve_product(const UserDbProduct& product, uint32_t& id) const
+    {
+        std::string_view company, title;
+        if (!string_at(product.company_offset, product.company_length, company) ||
+            !string_at(product.title_offset, product.title_length, title))
+        {
+            return false;
+        }
+        id = catalog->resolve(company, title, product.price);
+        return true;
+    }
+
+    const UserDbEntry* find_entry(int user_id) const
+    {
+        if (!header)
+        {
+            return nullptr;
+        }
+        const UserDbEntry* end = entries + header->user_count;
+        const UserDbEntry* it = std::lower_bound(entries, end, static_cast<int64_t>(user_id),
+            [](const UserDbEntry& entry, int64_t id) { return entry.id < id; });
+        return (it != end && it->id == user_id) ? it : nullptr;
+    }
+
+    bool load_entry(const UserDbEntry& entry, User& user) const
+    {
+        if (entry.first_purchase > header->purchase_count ||
+            entry.purchase_count > header->purchase_count - entry.first_purchase)
+        {
+            std::cerr << "Corrupted purchase history of user " << entry.id << ".\n";
+            return false;
+        }
+
+        std::string_view full_name;
+        if (!string_at(entry.name_offset, entry.name_length, full_name))
+        {
+            std::cerr << "Corrupted name of user " << entry.id << ".\n";
+            return false;
+        }
+
+        // Поля присваиваются по одному: имя и история остаются в памяти, которую дал вызывающий
+        user.id = static_cast<int>(entry.id);
+        user.full_name.assign(full_name);
+        user.account_balance = entry.account_balance;
+        user.discount = entry.discount;
+        user.purchased_products.resize(entry.purchase_count);
+
+        if (version == 1)
+        {
+            const UserDbProduct* history = reinterpret_cast<const UserDbProduct*>(purchases) + entry.first_purchase;
+            for (uint32_t i = 0; i < entry.purchase_count; ++i)
+            {
+                PurchaseRecord& record = user.purchased_products[i];
+                record = { 0, 0.0f, history[i].price, 0 };
+                if (!resolve_product(history[i], record.product_id))
+                {
+                    std::cerr << "Corrupted purchase history of user " << entry.id << ".\n";
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        if (entry.purchase_count > 0)
+        {
+            std::memcpy(user.purchased_products.data(), purchases + entry.first_purchase * sizeof(PurchaseRecord),
+                entry.purchase_count * sizeof(PurchaseRecord));
+        }
+        for (PurchaseRecord& record : user.purchased_products)
+        {
+            if (record.product_id >= product_ids.size())
+            {
+                std::cerr << "Corrupted purchase history of user " << entry.id << ".\n";
+                return false;
+            }
+            record.product_id = product_ids[record.product_id];
+        }
+        return true;
+    }
+
+public:
+    bool open(const std::string& path, ProductCatalog& products)
+    {
+        close();
+        if (!file.open(path))
+        {
+            return false;
+        }
+
+        uint64_t file_size = file.size();
+        const UserDbHeader* candidate = reinterpret_cast<const UserDbHeader*>(file.data());
+        bool valid = file_size >= USER_DB_V1_HEADER_SIZE &&
+            std::memcmp(candidate->magic, USER_DB_MAGIC, sizeof(USER_DB_MAGIC)) == 0 &&
+            ((candidate->version == 1 && candidate->header_size == USER_DB_V1_HEADER_SIZE) ||
+                (candidate->version == 2 && candidate->header_size == USER_DB_V2_HEADER_SIZE &&
+                    file_size >= USER_DB_V2_HEADER_SIZE) ||
+                (candidate->version == USER_DB_VERSION && candidate->header_size == sizeof(UserDbHeader) &&
+                    file_size >= sizeof(UserDbHeader)));
+        if (valid)
+        {
+            uint64_t purchase_size = candidate->version == 1 ? sizeof(UserDbProduct) : sizeof(PurchaseRecord);
+            valid = range_fits(candidate->users_offset, candidate->user_count, sizeof(UserDbEntry), file_size) &&
+                range_fits(candidate->purchases_offset, candidate->purchase_count, purchase_size, file_size) &&
+                range_fits(candidate->strings_offset, candidate->strings_size, 1, file_size) &&
+                (candidate->version == 1 ||
+                    range_fits(candidate->products_offset, candidate->product_count, sizeof(UserDbProduct), file_size));
+        }
+        if (!valid)
+        {
+            std::cerr << "Invalid user database " << path << ".\n";
+            file.close();
+            return false;
+        }
+
+        header = candidate;
+        version = header->version;
+        entries = reinterpret_cast<const UserDbEntry*>(file.data() + header->users_offset);
+        purchases = file.data() + header->purchases_offset;
+        strings = file.data() + header->strings_offset;
+        strings_size = header->strings_size;
+        catalog = &products;
+
+        if (version >= 2)
+        {
+            const UserDbProduct* stored = reinterpret_cast<const UserDbProduct*>(file.data() + header->products_offset);
+            product_ids.resize(header->product_count);
+            for (uint64_t i = 0; i < header->product_count; ++i)
+            {
+                if (!resolve_product(stored[i], product_ids[i]))
+                {
+                    std::cerr << "Invalid product table in " << path << ".\n";
+                    close();
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    void close()
+    {
+        file.close();
+        header = nullptr;
+        version = 0;
+        entries = nullptr;
+        purchases = nullptr;
+        strings = nullptr;
+        strings_size = 0;
+        product_ids.clear();
+    }
+
+    bool is_open() const
+    {
+        return header != nullptr;
+    }
+
+    uint32_t format_version() const
+    {
+        return version;
+    }
+
+    unsigned long long covered_seq() const
+    {
+        return header ? header->covered_seq : 0;
+    }
+
+    // В снимках до версии 3 только старые случайные id, ячеек в них нет
+    uint64_t user_slot_count() const
+    {
+        return (header && version >= 3) ? header->user_slot_count : 0;
+    }
+
+    size_t user_count() const
+    {
+        return header ? static_cast<size_t>(header->user_count) : 0;
+    }
+
+    int id_at(size_t index) const
+    {
+        return static_cast<int>(entries[index].id);
+    }
+
+    bool contains(int user_id) const
+    {
+        return find_entry(user_id) != nullptr;
+    }
+
+    bool load_user(int user_id, User& user) const
+    {
+        const UserDbEntry* entry = find_entry(user_id);
+        return entry && load_entry(*entry, user);
+    }
+
+    bool load_at(size_t index, User& user) const
+    {
+        return load_entry(entries[index], user);
+    }
+};
+
+// Собирает файл базы в памяти; строки товаров хранятся один раз в таблице товаров
+class UserDbWriter
+{
+private:
+    std::vector<UserDbEntry> entries;
+    std::vector<PurchaseRecord> purchases;
+    std::string strings;
+
+    std::vector<uint64_t> interned_offsets; // номер строки в string_pool -> смещение в куче
+
+    uint64_t add_string(std::string_view value)
+    {
+        uint64_t offset = strings.size();
+        strings += value;
+        return offset;
+    }
+
+    // Строка из пула пишется в кучу один раз, сколько бы товаров её ни использовали
+    uint64_t add_string(InternedString value)
+    {
+        if (value.id() >= interned_offsets.size())
+        {
+            interned_offsets.resize(value.id() + 1, UINT64_MAX);
+        }
+        uint64_t& offset = interned_offsets[value.id()];
+        if (offset == UINT64_MAX)
+        {
+            offset = add_string(value.str());
+        }
+        return offset;
+    }
+
+    void add_entry(int id, double account_balance, double discount, std::string_view full_name,
+        const std::pmr::vector<PurchaseRecord>& purchased_products)
+    {
+        UserDbEntry entry{};
+        entry.id = id;
+        entry.account_balance = account_balance;
+        entry.discount = discount;
+        entry.name_offset = add_string(full_name);
+        entry.name_length = static_cast<uint32_t>(full_name.size());
+        entry.purchase_count = static_cast<uint32_t>(purchased_products.size());
+        entry.first_purchase = purchases.size();
+        entries.push_back(entry);
+        purchases.insert(purchases.end(), purchased_products.begin(), purchased_products.end());
+    }
+
+public:
+    // Пользователи добавляются в порядке возрастания id
+    void add_user(const User& user)
+    {
+        add_entry(user.id, user.account_balance, user.discount, user.full_name, user.purchased_products);
+    }
+
+    void add_user(UserRef user)
+    {
+        add_entry(user.id(), user.account_balance(), user.discount(), user.full_name(), user.purchased_products());
+    }
+
+    bool write(const std::string& path, unsigned long long covered_seq, uint64_t user_slot_count,
+        const ProductCatalog& catalog)
+    {
+        std::vector<UserDbProduct> products(catalog.size());
+        for (uint32_t id = 0; id < catalog.size(); ++id)
+        {
+            const Product* product = catalog.find_by_id(id);
+            products[id].company_offset = add_string(product->company_handle());
+            products[id].company_length = static_cast<uint32_t>(product->getCompany().size());
+            products[id].title_offset = add_string(product->title_handle());
+            products[id].title_length = static_cast<uint32_t>(product->getTitle().size());
+            products[id].price = product->current_price();
+        }
+
+        UserDbHeader header{};
+        std::memcpy(header.magic, USER_DB_MAGIC, sizeof(USER_DB_MAGIC));
+        header.version = USER_DB_VERSION;
+        header.header_size = sizeof(UserDbHeader);
+        header.covered_seq = covered_seq;
+        header.user_count = entries.size();
+        header.users_offset = sizeof(UserDbHeader);
+        header.purchase_count = purchases.size();
+        header.purchases_offset = header.users_offset + entries.size() * sizeof(UserDbEntry);
+        header.product_count = products.size();
+        header.products_offset = header.purchases_offset + purchases.size() * sizeof(PurchaseRecord);
+        header.strings_size = strings.size();
+        header.strings_offset = header.products_offset + products.size() * sizeof(UserDbProduct);
+        header.user_slot_count = user_slot_count;
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(UserDbEntry));
+        file.write(reinterpret_cast<const char*>(purchases.data()), purchases.size() * sizeof(PurchaseRecord));
+        file.write(reinterpret_cast<const char*>(products.data()), products.size() * sizeof(UserDbProduct));
+        file.write(strings.data(), strings.size());
+        file.close();
+        return static_cast<bool>(file);
+    }
+};
+
+
+
+// Сборка с USER_ID_OBFUSCATION=1 выдаёт наружу не номер ячейки таблицы пользователей,
+// а его перестановку: по id не видно, сколько пользователей зарегистрировано, и соседние
+// id не подбираются. Перестановка входит в формат базы, на существующей базе её не меняют.
+#ifndef USER_ID_OBFUSCATION
+#define USER_ID_OBFUSCATION 0
+#endif
+
+// id из [1, LEGACY_USER_ID_MAX] раньше выдавались случайно; новые id - номер ячейки
+// плотной таблицы, сдвинутый за этот диапазон, так что id остаётся положительным int
+const int LEGACY_USER_ID_MAX = 1000000;
+const unsigned USER_SLOT_BITS = 30;
+const uint64_t USER_SLOT_CAPACITY = uint64_t(1) << USER_SLOT_BITS;
+
+#if USER_ID_OBFUSCATION
+// Раунд сети Фейстеля над половинами номера ячейки по 15 бит
+static uint32_t user_slot_round(uint32_t half, uint32_t round)
+{
+    uint32_t x = (half + round * 0x9E3779B9u) * 0x85EBCA6Bu;
+    x ^= x >> 13;
+    x *= 0xC2B2AE35u;
+    x ^= x >> 16;
+    return x & 0x7FFF;
+}
+#endif
+
+static uint32_t permute_user_slot(uint32_t slot)
+{
+#if USER_ID_OBFUSCATION
+    uint32_t left = slot >> 15, right = slot & 0x7FFF;
+    for (uint32_t round = 0; round < 4; ++round)
+    {
+        uint32_t next = left ^ user_slot_round(right, round);
+        left = right;
+        right = next;
+    }
+    return (left << 15) | right;
+#else
+    return slot;
+#endif
+}
+
+static uint32_t unpermute_user_slot(uint32_t value)
+{
+#if USER_ID_OBFUSCATION
+    uint32_t left = value >> 15, right = value & 0x7FFF;
+    for (uint32_t round = 4; round-- > 0;)
+    {
+        uint32_t previous = right ^ user_slot_round(left, round);
+        right = left;
+        left = previous;
+    }
+    return (left << 15) | right;
+#else
+    return value;
+#endif
+}
+
+static int user_id_for_slot(uint64_t slot)
+{
+    return LEGACY_USER_ID_MAX + 1 + static_cast<int>(permute_user_slot(static_cast<uint32_t>(slot)));
+}
+
+static bool user_slot_for_id(int user_id, uint64_t& slot)
+{
+    if (user_id <= LEGACY_USER_ID_MAX ||
+        static_cast<uint64_t>(user_id - LEGACY_USER_ID_MAX - 1) >= USER_SLOT_CAPACITY)
+    {
+        return false;
+    }
+    slot = unpermute_user_slot(static_cast<uint32_t>(user_id - LEGACY_USER_ID_MAX - 1));
+    return true;
+}
+
+// Таблица пользователей: ячейки лежат блоками UserColumns, блоки не перемещаются,
+// поэтому ссылки на пользователей стабильны. Поиск по новому id - вычисление номера
+// ячейки, блока и проверка флага занятости. Ячейки выдаёт атомарный счётчик, блок
+// создаётся тем потоком, которому он понадобился первым, так что регистрации из разных
+// потоков друг друга не ждут. Пользователи со старыми id получают ячейки отдельных
+// блоков по порядку появления, через хеш; его, как и перезапись занятых ячеек, меняют
+// только под эксклюзивной блокировкой.
+class UserTable
+{
+private:
+    static const size_t MAX_CHUNKS = static_cast<size_t>(USER_SLOT_CAPACITY >> USER_CHUNK_BITS);
+
+    // Имена и истории всех блоков. Истории растут под блокировками разных полос, поэтому
+    // пул синхронизированный; clear() отдаёт его память системе разом.
+    std::pmr::synchronized_pool_resource cold_memory{ &allocation_counter };
+    std::unique_ptr<std::atomic<UserColumns*>[]> chunks{ new std::atomic<UserColumns*>[MAX_CHUNKS]() };
+    std::atomic<uint64_t> next_slot{ 0 };
+    std::atomic<size_t> dense_count{ 0 };
+    std::unordered_map<int, uint32_t> legacy_index; // старый id -> ячейка в legacy_chunks
+    std::vector<std::unique_ptr<UserColumns>> legacy_chunks;
+
+    // Снимок для контрольной точки (см. begin_snapshot)
+    std::atomic<uint64_t> snapshot_epoch{ 0 };
+    std::atomic<bool> snapshot_open{ false };
+    std::vector<UserColumns*> snapshot_legacy; // legacy-блоки на момент begin_snapshot
+    uint64_t snapshot_slots = 0;
+    std::mutex snapshot_mutex; // snapshot_users
+    std::vector<User> snapshot_users;
+
+    // Копирует пользователей блока в снимок, если блок ещё не скопирован в этот снимок
+    void save_chunk(UserColumns* chunk)
+    {
+        std::lock_guard<std::mutex> lock(chunk->save_mutex);
+        const uint64_t epoch = snapshot_epoch.load(std::memory_order_acquire);
+        if (chunk->saved_epoch.load(std::memory_order_relaxed) == epoch)
+        {
+            return;
+        }
+        std::vector<User> copied;
+        for (size_t i = 0; i < USER_CHUNK_SIZE; ++i)
+        {
+            if (chunk->used[i].load(std::memory_order_acquire))
+            {
+                copied.push_back(UserRef(chunk, i).to_user());
+            }
+        }
+        {
+            std::lock_guard<std::mutex> users_lock(snapshot_mutex);
+            if (snapshot_open)
+            {
+                snapshot_users.insert(snapshot_users.end(), std::make_move_iterator(copied.begin()),
+                    std::make_move_iterator(copied.end()));
+            }
+        }
+        chunk->saved_epoch.store(epoch, std::memory_order_release);
+    }
+
+    void before_change(UserColumns* chunk)
+    {
+        if (snapshot_open.load(std::memory_order_acquire) &&
+            chunk->saved_epoch.load(std::memory_order_acquire) != snapshot_epoch.load(std::memory_order_relaxed))
+        {
+            save_chunk(chunk);
+        }
+    }
+
+    UserColumns* chunk_at(uint64_t slot) const
+    {
+        return chunks[slot >> USER_CHUNK_BITS].load(std::memory_order_acquire);
+    }
+
+    UserColumns* create_chunk(uint64_t slot)
+    {
+        std::atomic<UserColumns*>& entry = chunks[slot >> USER_CHUNK_BITS];
+        UserColumns* chunk = entry.load(std::memory_order_acquire);
+        if (chunk == nullptr)
+        {
+            UserColumns* created = new UserColumns(&cold_memory);
+            if (entry.compare_exchange_strong(chunk, created, std::memory_order_acq_rel))
+            {
+                chunk = created;
+            }
+            else
+            {
+                delete created; // блок успел создать другой поток
+            }
+        }
+        return chunk;
+    }
+
+    UserRef insert_legacy(User&& user)
+    {
+        auto it = legacy_index.emplace(user.id, static_cast<uint32_t>(legacy_index.size())).first;
+        size_t slot = it->second;
+        if (slot >> USER_CHUNK_BITS == legacy_chunks.size())
+        {
+            legacy_chunks.push_back(std::make_unique<UserColumns>(&cold_memory));
+        }
+        UserColumns* chunk = legacy_chunks[slot >> USER_CHUNK_BITS].get();
+        size_t index = slot & (USER_CHUNK_SIZE - 1);
+        before_change(chunk);
+        chunk->store(index, std::move(user));
+        chunk->used[index].store(true, std::memory_order_release);
+        return UserRef(chunk, index);
+    }
+
+    // Занятые ячейки блоков: visit(блок, индекс)
+    template <typename Visit>
+    void for_each_slot(Visit&& visit) const
+    {
+        for (size_t first = 0; first < legacy_index.size(); first += USER_CHUNK_SIZE)
+        {
+            UserColumns* chunk = legacy_chunks[first >> USER_CHUNK_BITS].get();
+            size_t count = std::min(USER_CHUNK_SIZE, legacy_index.size() - first);
+            for (size_t i = 0; i < count; ++i)
+            {
+                visit(chunk, i);
+            }
+        }
+
+        uint64_t end = slot_count();
+        for (uint64_t first = 0; first < end; first += USER_CHUNK_SIZE)
+        {
+            UserColumns* chunk = chunk_at(first);
+            if (chunk == nullptr)
+            {
+                continue;
+            }
+            size_t count = static_cast<size_t>(std::min<uint64_t>(USER_CHUNK_SIZE, end - first));
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (chunk->used[i].load(std::memory_order_acquire))
+                {
+                    visit(chunk, i);
+                }
+            }
+        }
+    }
+
+public:
+    UserTable() = default;
+    UserTable(const UserTable&) = delete;
+    UserTable& operator=(const UserTable&) = delete;
+
+    ~UserTable()
+    {
+        clear();
+    }
+
+    UserRef find(int user_id) const
+    {
+        uint64_t slot;
+        if (user_slot_for_id(user_id, slot))
+        {
+            UserColumns* chunk = chunk_at(slot);
+            size_t index = static_cast<size_t>(slot & (USER_CHUNK_SIZE - 1));
+            return (chunk && chunk->used[index].load(std::memory_order_acquire)) ? UserRef(chunk, index) : UserRef();
+        }
+        auto it = legacy_index.find(user_id);
+        if (it == legacy_index.end())
+        {
+            return UserRef();
+        }
+        return UserRef(legacy_chunks[it->second >> USER_CHUNK_BITS].get(), it->second & (USER_CHUNK_SIZE - 1));
+    }
+
+    // Выдаёт id новой ячейки; 0, если ячейки кончились
+    int allocate_id()
+    {
+        uint64_t slot = next_slot.fetch_add(1, std::memory_order_relaxed);
+        return slot < USER_SLOT_CAPACITY ? user_id_for_slot(slot) : 0;
+    }
+
+    // Кладёт пользователя на место, определяемое его id, заменяя прежнего
+    UserRef insert(User user)
+    {
+        uint64_t slot;
+        if (!user_slot_for_id(user.id, slot))
+        {
+            return insert_legacy(std::move(user));
+        }
+
+        // id из журнала или другой таблицы: следующие выданные ячейки должны быть дальше
+        uint64_t next = next_slot.load(std::memory_order_relaxed);
+        while (next <= slot && !next_slot.compare_exchange_weak(next, slot + 1, std::memory_order_relaxed))
+        {
+        }
+
+        UserColumns* chunk = create_chunk(slot);
+        size_t index = static_cast<size_t>(slot & (USER_CHUNK_SIZE - 1));
+        before_change(chunk);
+        chunk->store(index, std::move(user));
+        if (!chunk->used[index].exchange(true, std::memory_order_release))
+        {
+            dense_count.fetch_add(1, std::memory_order_relaxed);
+        }
+        return UserRef(chunk, index);
+    }
+
+    // Ячейки до count уже выданы (число из заголовка снимка)
+    void reserve_slots(uint64_t count)
+    {
+        if (next_slot.load() < count)
+        {
+            next_slot.store(count);
+        }
+    }
+
+    uint64_t slot_count() const
+    {
+        return std::min(next_slot.load(), USER_SLOT_CAPACITY);
+    }
+
+    size_t size() const
+    {
+        return dense_count.load() + legacy_index.size();
+    }
+
+    template <typename Visit>
+    void for_each(Visit&& visit) const
+    {
+        for_each_slot([&](UserColumns* chunk, size_t index) { visit(UserRef(chunk, index)); });
+    }
+
+    // Обход одних горячих столбцов для массовых операций с балансами:
+    // visit(id, баланс, скидка); холодная часть блоков не читается
+    template <typename Visit>
+    void for_each_balance(Visit&& visit) const
+    {
+        for_each_slot([&](UserColumns* chunk, size_t index) {
+            visit(chunk->ids[index], chunk->balances[index], chunk->discounts[index]);
+        });
+    }
+
+    // Снимок таблицы для контрольной точки без остановки работы с ней. begin_snapshot
+    // вызывается, когда таблицу никто не меняет, и стоит O(числа блоков). Дальше каждый
+    // блок копируется один раз: перед первым изменением после begin_snapshot (его
+    // делает изменяющий поток в before_change) или в finish_snapshot, который копирует
+    // остальные блоки в потоке контрольной точки.
+    void begin_snapshot()
+    {
+        std::lock_guard<std::mutex> lock(snapshot_mutex);
+        snapshot_users.clear();
+        snapshot_legacy.clear();
+        for (const auto& chunk : legacy_chunks)
+        {
+            snapshot_legacy.push_back(chunk.get());
+        }
+        snapshot_slots = slot_count();
+        snapshot_epoch.fetch_add(1, std::memory_order_release);
+        snapshot_open = true;
+    }
+
+    // Пользователи таблицы на момент begin_snapshot. Блоки, созданные позже, не
+    // копируются: в них только пользователи, зарегистрированные или прочитанные из
+    // снимка базы после begin_snapshot.
+    void finish_snapshot(UserTable& copy)
+    {
+        for (UserColumns* chunk : snapshot_legacy)
+        {
+            save_chunk(chunk);
+        }
+        for (uint64_t first = 0; first < snapshot_slots; first += USER_CHUNK_SIZE)
+        {
+            if (UserColumns* chunk = chunk_at(first))
+            {
+                save_chunk(chunk);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(snapshot_mutex);
+        snapshot_open = false;
+        copy.reserve_slots(snapshot_slots);
+        for (User& user : snapshot_users)
+        {
+            copy.insert(std::move(user));
+        }
+        snapshot_users.clear();
+    }
+
+    // Вызывается перед изменением пользователя под его блокировкой
+    void before_change(UserRef user)
+    {
+        before_change(user.columns);
+    }
+
+    void clear()
+    {
+        for (size_t i = 0; i < MAX_CHUNKS; ++i)
+        {
+            delete chunks[i].exchange(nullptr);
+        }
+        legacy_index.clear();
+        legacy_chunks.clear();
+        cold_memory.release();
+        next_slot = 0;
+        dense_count = 0;
+    }
+};
+
+ProductCatalog catalog; // Хранение товаров
+UserTable users; // Пользователи, изменённые или прочитанные с момента запуска
+UserDatabase user_db; // Последний снимок базы, отображённый в память
+
+// Пользователь из таблицы users; при первом обращении он подгружается из снимка базы
+UserRef find_user(UserTable& users, int user_id)
+{
+    if (UserRef user = users.find(user_id))
+    {
+        return user;
+    }
+
+    // Пользователь собирается в буфере на стеке и копируется в пул таблицы
+    alignas(std::max_align_t) char scratch_buffer[1024];
+    std::pmr::monotonic_buffer_resource scratch(scratch_buffer, sizeof(scratch_buffer), &allocation_counter);
+    User user(&scratch);
+    if (!user_db.load_user(user_id, user))
+    {
+        return UserRef();
+    }
+    return users.insert(std::move(user));
+}
+
+// Пишет снимок users.<covered_seq>.db, покрывающий записи журнала до covered_seq включительно:
+// пользователи из users и ещё не прочитанные пользователи из текущего снимка.
+// Файл пишется во временный и появляется под своим именем только целиком.
+static bool write_users_snapshot(const UserTable& users, unsigned long long covered_seq)
+{
+    std::vector<std::pair<int, size_t>> order; // id и индекс в снимке (SIZE_MAX - пользователь из users)
+    order.reserve(users.size() + user_db.user_count());
+    users.for_each([&](UserRef user) { order.emplace_back(user.id(), SIZE_MAX); });
+    for (size_t i = 0; i < user_db.user_count(); ++i)
+    {
+        if (!users.find(user_db.id_at(i)))
+        {
+            order.emplace_back(user_db.id_at(i), i);
+        }
+    }
+    std::sort(order.begin(), order.end());
+
+    UserDbWriter writer;
+    User stored;
+    for (const auto& item : order)
+    {
+        if (item.second == SIZE_MAX)
+        {
+            writer.add_user(users.find(item.first));
+        }
+        else if (user_db.load_at(item.second, stored))
+        {
+            writer.add_user(stored);
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    const std::string path = user_db_path(covered_seq);
+    const std::string temp_file = path + ".tmp";
+    if (!writer.write(temp_file, covered_seq, std::max(users.slot_count(), user_db.user_slot_count()), catalog))
+    {
+        std::cerr << "Failed to write " << temp_file << ".\n";
+        return false;
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temp_file, path, error);
+    if (error)
+    {
+        std::cerr << "Failed to replace " << path << ": " << error.message() << "\n";
+        return false;
+    }
+    return true;
+}
+
+// Удаляет сегменты журнала, все записи которых уже вошли в снимок, и старые снимки
+static void compact_journal(unsigned long long covered_seq)
+{
+    std::vector<NumberedFile> segments = list_journal_segments();
+    for (size_t i = 0; i + 1 < segments.size(); ++i)
+    {
+        if (segments[i + 1].seq <= covered_seq + 1)
+        {
+            std::error_code error;
+            std::filesystem::remove(segments[i].path, error);
+        }
+    }
+
+    for (const NumberedFile& snapshot : list_numbered_files(USER_DB_PREFIX, USER_DB_SUFFIX))
+    {
+        if (snapshot.seq < covered_seq)
+        {
+            std::error_code error;
+            std::filesystem::remove(snapshot.path, error); // отображённый в память снимок на Windows удалится позже
+        }
+    }
+}
+
+// Фоновая контрольная точка: раз в checkpoint_records записей журнала снимок
+// пользователей пишется в users.<seq>.db без остановки работы с users. Таблица users
+// (пользователи, прочитанные или изменённые с запуска) копируется по блокам при записи,
+// остальных поток контрольной точки берёт из отображённого снимка. fork() здесь не
+// годится: дочерний процесс многопоточной программы может вызывать только
+// async-signal-safe функции, а запись снимка выделяет память и пишет через потоки.
+class UserCheckpointer
+{
+private:
+    std::thread worker;
+    std::atomic<bool> running{ false };
+    unsigned long long checkpoint_records = 10000;
+    std::atomic<unsigned long long> last_checkpoint_seq{ 0 };
+
+    void finish(bool written, unsigned long long covered_seq)
+    {
+        if (written)
+        {
+            compact_journal(covered_seq);
+        }
+        running = false;
+    }
+
+public:
+    ~UserCheckpointer()
+    {
+        wait();
+    }
+
+    void set_interval(unsigned long long records)
+    {
+        checkpoint_records = std::max<unsigned long long>(1, records);
+    }
+
+    void set_last_checkpoint(unsigned long long covered_seq)
+    {
+        last_checkpoint_seq = covered_seq;
+    }
+
+    bool due() const
+    {
+        return !running && journal.last_seq() - last_checkpoint_seq >= checkpoint_records;
+    }
+
+    // Вызывается, когда users никто не меняет (см. CheckoutService::maybe_checkpoint)
+    void maybe_start(UserTable& users)
+    {
+        if (due())
+        {
+            start(users);
+        }
+    }
+
+    // Под блокировками только смена сегмента журнала и начало снимка таблицы;
+    // пользователей копирует поток контрольной точки (UserTable::finish_snapshot)
+    bool start(UserTable& users)
+    {
+        if (running)
+        {
+            return false; // предыдущая контрольная точка ещё пишется
+        }
+        if (worker.joinable())
+        {
+            worker.join();
+        }
+
+        unsigned long long covered_seq = journal.last_seq();
+        if (!journal.rotate())
+        {
+            return false;
+        }
+        last_checkpoint_seq = covered_seq;
+        running = true;
+
+        users.begin_snapshot();
+        worker = std::thread([this, &users, covered_seq]
+            {
+                UserTable copy;
+                users.finish_snapshot(copy);
+                finish(write_users_snapshot(copy, covered_seq), covered_seq);
+            });
+        return true;
+    }
+
+    void wait()
+    {
+        if (worker.joinable())
+        {
+            worker.join();
+        }
+    }
+};
+
+UserCheckpointer checkpointer;
+
+// Синхронная контрольная точка, используется при выходе из программы
+void save_users_to_file(const UserTable& users)
+{
+    OperationTimer timer(MetricOp::SaveUsers);
+    TraceSpan request = TraceSpan::request("save_users_to_file", true);
+    traced("checkpoint_wait", [] { checkpointer.wait(); });
+    unsigned long long covered_seq = journal.last_seq();
+    traced("journal_sync", [] { journal.sync(); journal.rotate(); });
+    if (traced("write_snapshot", [&] { return write_users_snapshot(users, covered_seq); }))
+    {
+        checkpointer.set_last_checkpoint(covered_seq);
+        traced("compact_journal", [&] { compact_journal(covered_seq); });
+    }
+    else
+    {
+        timer.fail();
+    }
+}
+
+// Скользящее окно продаж - кольцо из slot_count интервалов по slot_seconds секунд
+struct SalesWindow
+{
+    const char* name;
+    int64_t slot_seconds;
+    size_t slot_count;
+};
+
+const SalesWindow SALES_WINDOWS[] = { { "1h", 60, 60 }, { "24h", 3600, 24 } };
+const size_t SALES_WINDOW_COUNT = sizeof(SALES_WINDOWS) / sizeof(SALES_WINDOWS[0]);
+
+struct SalesRank
+{
+    uint32_t product_id;
+    uint64_t units;
+};
+
+// Аналитика продаж: агрегаты обновляются при каждой покупке, и отчёт читает готовые
+// значения, а не истории пользователей. Ведутся выручка по компаниям, продажи и выручка
+// по товарам, средняя скидка и лидеры продаж за скользящие окна SALES_WINDOWS. Покупка
+// попадает в интервал окна по своему времени; интервалы, вышедшие из окна, вычитаются
+// целиком, так что окно сдвигается шагом в интервал, а рейтинг товаров окна всегда
+// упорядочен. Счётчики разделены на SHARD_COUNT частей по ID товара, у каждой своя
+// блокировка: покупки разных товаров почти не ждут друг друга, а лидеры магазина -
+// лучшие из лидеров частей, ведь товар целиком лежит в одной части.
+class SalesAnalytics
+{
+public:
+    static const size_t SHARD_COUNT = 16;
+
+    void record(const PurchaseRecord& record)
+    {
+        Shard& shard = shards[record.product_id % SHARD_COUNT];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.add(record);
+    }
+
+    // Пачка покупок: каждая часть блокируется один раз
+    void record_batch(const PurchaseRecord* records, size_t count)
+    {
+        for (size_t s = 0; s < SHARD_COUNT; ++s)
+        {
+            std::lock_guard<std::mutex> lock(shards[s].mutex);
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (records[i].product_id % SHARD_COUNT == s)
+                {
+                    shards[s].add(records[i]);
+                }
+            }
+        }
+    }
+
+    uint64_t units_sold(uint32_t product_id) const
+    {
+        const Shard& shard = shards[product_id % SHARD_COUNT];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        size_t index = product_id / SHARD_COUNT;
+        return index < shard.units.size() ? shard.units[index] : 0;
+    }
+
+    double product_revenue(uint32_t product_id) const
+    {
+        const Shard& shard = shards[product_id % SHARD_COUNT];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        size_t index = product_id / SHARD_COUNT;
+        return index < shard.revenue.size() ? shard.revenue[index] : 0.0;
+    }
+
+    double company_revenue(InternedString company) const
+    {
+        double total = 0.0;
+        for_each_shard([&](const Shard& shard) {
+            if (company.id() < shard.company_revenue.size())
+            {
+                total += shard.company_revenue[company.id()];
+            }
+        });
+        return total;
+    }
+
+    // Компании с продажами, по убыванию выручки
+    std::vector<std::pair<InternedString, double>> revenue_by_company() const
+    {
+        std::vector<double> totals;
+        for_each_shard([&](const Shard& shard) {
+            totals.resize(std::max(totals.size(), shard.company_revenue.size()), 0.0);
+            for (size_t i = 0; i < shard.company_revenue.size(); ++i)
+            {
+                totals[i] += shard.company_revenue[i];
+            }
+        });
+        std::vector<std::pair<InternedString, double>> companies;
+        for (size_t i = 0; i < totals.size(); ++i)
+        {
+            if (totals[i] > 0.0)
+            {
+                companies.emplace_back(InternedString(static_cast<uint32_t>(i)), totals[i]);
+            }
+        }
+        std::sort(companies.begin(), companies.end(),
+            [](const auto& a, const auto& b) { return a.second > b.second; });
+        return companies;
+    }
+
+    uint64_t purchase_count() const
+    {
+        uint64_t total = 0;
+        for_each_shard([&](const Shard& shard) { total += shard.purchases; });
+        return total;
+    }
+
+    double total_revenue() const
+    {
+        double total = 0.0;
+        for_each_shard([&](const Shard& shard) { total += shard.total_revenue; });
+        return total;
+    }
+
+    // Средняя применённая скидка, доля от цены
+    double average_discount() const
+    {
+        double sum = 0.0;
+        uint64_t count = 0;
+        for_each_shard([&](const Shard& shard) {
+            sum += shard.discount_sum;
+            count += shard.purchases;
+        });
+        return count > 0 ? sum / count : 0.0;
+    }
+
+    // До n самых продаваемых товаров окна SALES_WINDOWS[window], оканчивающегося в now
+    std::vector<SalesRank> top_sellers(size_t window, size_t n, int64_t now = unix_time_now())
+    {
+        std::vector<SalesRank> top;
+        for (size_t s = 0; s < SHARD_COUNT; ++s)
+        {
+            std::lock_guard<std::mutex> lock(shards[s].mutex);
+            Window& sales = shards[s].windows[window];
+            sales.advance(now / SALES_WINDOWS[window].slot_seconds, SALES_WINDOWS[window].slot_count);
+            for (size_t i = 0; i < sales.order.size() && i < n && sales.units[sales.order[i]] > 0; ++i)
+            {
+                top.push_back({ static_cast<uint32_t>(sales.order[i] * SHARD_COUNT + s), sales.units[sales.order[i]] });
+            }
+        }
+        const size_t count = std::min(n, top.size());
+        std::partial_sort(top.begin(), top.begin() + count, top.end(), [](const SalesRank& a, const SalesRank& b) {
+            return a.units != b.units ? a.units > b.units : a.product_id < b.product_id;
+        });
+        top.resize(count);
+        return top;
+    }
+
+    void clear()
+    {
+        for (size_t s = 0; s < SHARD_COUNT; ++s)
+        {
+            std::lock_guard<std::mutex> lock(shards[s].mutex);
+            shards[s] = Shard();
+        }
+    }
+
+    // Восстановление по сохранённым историям: пользователи таблицы и те пользователи
+    // снимка, которых в таблице нет. Вызывается, пока покупок нет; возвращает число покупок.
+    uint64_t rebuild(const UserTable& table, const UserDatabase& db, size_t threads)
+    {
+        clear();
+        std::vector<std::pair<const PurchaseRecord*, size_t>> histories;
+        histories.reserve(table.size());
+        table.for_each([&](UserRef user) {
+            histories.emplace_back(user.purchased_products().data(), user.purchased_products().size());
+        });
+        std::vector<size_t> stored;
+        for (size_t i = 0; i < db.user_count(); ++i)
+        {
+            if (!table.find(db.id_at(i)))
+            {
+                stored.push_back(i);
+            }
+        }
+        return add_histories(histories, db, stored, threads);
+    }
+
+    // Добавляет к агрегатам покупки историй и пользователей снимка с номерами stored.
+    // Истории читают threads потоков, каждый отдаёт покупки пачками.
+    uint64_t add_histories(const std::vector<std::pair<const PurchaseRecord*, size_t>>& histories,
+        const UserDatabase& db, const std::vector<size_t>& stored, size_t threads)
+    {
+        // Снимок версии 1 ищет товары в каталоге при чтении, а каталог меняет только один поток
+        if (db.format_version() == 1)
+        {
+            threads = 1;
+        }
+        threads = std::max<size_t>(1, threads);
+        std::atomic<uint64_t> total{ 0 };
+        auto work = [&](size_t part) {
+            static const size_t BATCH_SIZE = 4096;
+            std::vector<PurchaseRecord> batch;
+            uint64_t count = 0;
+            auto take = [&](const PurchaseRecord* records, size_t size) {
+                batch.insert(batch.end(), records, records + size);
+                count += size;
+                if (batch.size() >= BATCH_SIZE)
+                {
+                    record_batch(batch.data(), batch.size());
+                    batch.clear();
+                }
+            };
+            for (size_t i = histories.size() * part / threads; i < histories.size() * (part + 1) / threads; ++i)
+            {
+                take(histories[i].first, histories[i].second);
+            }
+            User user;
+            for (size_t i = stored.size() * part / threads; i < stored.size() * (part + 1) / threads; ++i)
+            {
+                if (db.load_at(stored[i], user))
+                {
+                    take(user.purchased_products.data(), user.purchased_products.size());
+                }
+            }
+            record_batch(batch.data(), batch.size());
+            total += count;
+        };
+
+        std::vector<std::thread> workers;
+        for (size_t part = 1; part < threads; ++part)
+        {
+            workers.emplace_back(work, part);
+        }
+        work(0);
+        for (std::thread& worker : workers)
+        {
+            worker.join();
+        }
+        return total;
+    }
+
+private:
+    // Продажи окна. order - товары части по убыванию числа продаж: товары с одинаковым
+    // числом идут подряд, и продажа или выбывание меняет товар местами с крайним в его
+    // группе, так что порядок поддерживается за O(1), а лидеры - начало order.
+    struct Window
+    {
+        std::vector<std::vector<uint32_t>> slots; // товары, проданные в интервале, по штуке
+        int64_t newest = INT64_MIN;               // номер последнего интервала окна
+        std::vector<uint32_t> order;              // номера товаров в части
+        std::vector<uint32_t> position;           // номер товара -> место в order
+        std::vector<uint64_t> units;              // номер товара -> продано в окне
+        std::vector<uint32_t> group_first;        // продано -> первое место группы в order
+        std::vector<uint32_t> group_size;         // продано -> размер группы
+
+        void swap_places(uint32_t a, uint32_t b)
+        {
+            std::swap(order[a], order[b]);
+            position[order[a]] = a;
+            position[order[b]] = b;
+        }
+
+        void sold(uint32_t product)
+        {
+            if (product >= position.size())
+            {
+                position.resize(product + 1, UINT32_MAX);
+                units.resize(product + 1, 0);
+            }
+            if (position[product] == UINT32_MAX)
+            {
+                // Новый товар встаёт в конец, в группу с нулём продаж
+                position[product] = static_cast<uint32_t>(order.size());
+                order.push_back(product);
+                if (group_size.empty())
+                {
+                    group_first.push_back(0);
+                    group_size.push_back(0);
+                }
+                if (group_size[0]++ == 0)
+                {
+                    group_first[0] = position[product];
+                }
+            }
+
+            uint64_t count = units[product]++;
+            uint32_t first = group_first[count];
+            swap_places(position[product], first);
+            ++group_first[count];
+            --group_size[count];
+            if (count + 1 == group_size.size())
+            {
+                group_first.push_back(first);
+                group_size.push_back(0);
+            }
+            if (group_size[count + 1]++ == 0)
+            {
+                group_first[count + 1] = first;
+            }
+        }
+
+        void expired(uint32_t product)
+        {
+            uint64_t count = units[product]--;
+            uint32_t last = group_first[count] + group_size[count] - 1;
+            swap_places(position[product], last);
+            --group_size[count];
+            ++group_size[count - 1];
+            group_first[count - 1] = last;
+        }
+
+        // Окно кончается интервалом slot: интервалы старше выбывают
+        void advance(int64_t slot, size_t slot_count)
+        {
+            if (slots.empty())
+            {
+                slots.resize(slot_count);
+            }
+            if (newest != INT64_MIN && slot > newest)
+            {
+                int64_t first = std::max(newest + 1, slot - static_cast<int64_t>(slot_count) + 1);
+                for (int64_t s = first; s <= slot; ++s)
+                {
+                    std::vector<uint32_t>& old = slots[s % slot_count];
+                    for (uint32_t product : old)
+                    {
+                        expired(product);
+                    }
+                    old.clear();
+                }
+            }
+            newest = std::max(newest, slot);
+        }
+
+        void add(uint32_t product, int64_t slot, size_t slot_count)
+        {
+            advance(slot, slot_count);
+            if (slot > newest - static_cast<int64_t>(slot_count))
+            {
+                slots[slot % slot_count].push_back(product);
+                sold(product);
+            }
+        }
+    };
+
+    struct alignas(64) Shard
+    {
+        mutable std::mutex mutex;
+        std::vector<uint64_t> units;          // ID товара / SHARD_COUNT -> продано штук
+        std::vector<double> revenue;          // ID товара / SHARD_COUNT -> выручка
+        std::vector<double> company_revenue;  // номер названия компании в string_pool -> выручка
+        double total_revenue = 0.0;
+        double discount_sum = 0.0;
+        uint64_t purchases = 0;
+        Window windows[SALES_WINDOW_COUNT];
+
+        Shard() = default;
+
+        // Для clear(): блокировка остаётся своя
+        Shard& operator=(Shard&& other)
+        {
+            units = std::move(other.units);
+            revenue = std::move(other.revenue);
+            company_revenue = std::move(other.company_revenue);
+            total_revenue = other.total_revenue;
+            discount_sum = other.discount_sum;
+            purchases = other.purchases;
+            for (size_t w = 0; w < SALES_WINDOW_COUNT; ++w)
+            {
+                windows[w] = std::move(other.windows[w]);
+            }
+            return *this;
+        }
+
+        void add(const PurchaseRecord& record)
+        {
+            size_t index = record.product_id / SHARD_COUNT;
+            if (index >= units.size())
+            {
+                units.resize(index + 1, 0);
+                revenue.resize(index + 1, 0.0);
+            }
+            ++units[index];
+            revenue[index] += record.price;
+            if (const Product* product = catalog.find_by_id(record.product_id))
+            {
+                uint32_t company = product->company_handle().id();
+                if (company >= company_revenue.size())
+                {
+                    company_revenue.resize(company + 1, 0.0);
+                }
+                company_revenue[company] += record.price;
+            }
+            total_revenue += record.price;
+            discount_sum += record.discount;
+            ++purchases;
+            for (size_t w = 0; w < SALES_WINDOW_COUNT; ++w)
+            {
+                windows[w].add(static_cast<uint32_t>(index), record.timestamp / SALES_WINDOWS[w].slot_seconds,
+                    SALES_WINDOWS[w].slot_count);
+            }
+        }
+    };
+
+    std::unique_ptr<Shard[]> shards{ new Shard[SHARD_COUNT] };
+
+    template <typename Visit>
+    void for_each_shard(Visit&& visit) const
+    {
+        for (size_t s = 0; s < SHARD_COUNT; ++s)
+        {
+            std::lock_guard<std::mutex> lock(shards[s].mutex);
+            visit(shards[s]);
+        }
+    }
+};
+
+SalesAnalytics sales; // Продажи, обновляются читателем кольца событий sales_feed
+
+// Событие магазина для читателей вне пути покупки (аналитика, аудит), 32 байта
+enum class StoreEventType : uint8_t
+{
+    Purchase,
+    TopUp
+};
+
+struct StoreEvent
+{
+    StoreEventType type;
+    float discount;      // покупка: применённая скидка
+    int32_t user_id;
+    uint32_t product_id; // покупка: ID товара
+    double amount;       // уплаченная цена или сумма пополнения
+    int64_t timestamp;
+};
+
+static_assert(sizeof(StoreEvent) == 32, "StoreEvent should stay compact");
+
+// Что делает публикация, когда кольцо полно: ждёт самого медленного читателя или
+// выбрасывает событие (их число - EventRing::dropped)
+enum class Backpressure
+{
+    Block,
+    Drop
+};
+
+// Кольцо событий без блокировок: много писателей, и каждый читатель видит все события.
+// Писатель занимает номер CAS-ом общего счётчика, пишет событие в ячейку номер & mask
+// и публикует его, записав номер + 1 в published той же ячейки. У каждого читателя свой
+// курсор - номер следующего события; ячейку можно занять заново, когда её прошли все
+// читатели. События лежат отдельно от номеров, подряд, поэтому читатель получает их
+// пачкой, без копирования. Читатели подключаются до начала публикации или в паузе.
+class EventRing
+{
+public:
+    static const size_t MAX_CONSUMERS = 4;
+
+    EventRing(size_t capacity, Backpressure policy)
+        : capacity(std::bit_ceil(std::max<size_t>(capacity, 2))), mask(this->capacity - 1),
+        events(new StoreEvent[this->capacity]), published(new std::atomic<uint64_t>[this->capacity]()),
+        policy(policy) {}
+
+    EventRing(const EventRing&) = delete;
+    EventRing& operator=(const EventRing&) = delete;
+
+    // Меняется до начала публикации
+    void set_backpressure(Backpressure value)
+    {
+        policy = value;
+    }
+
+    // false, если кольцо полно и политика - Drop
+    bool publish(const StoreEvent& event)
+    {
+        uint64_t seq = claim.value.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            if (seq - gate.value.load(std::memory_order_relaxed) >= capacity)
+            {
+                uint64_t slowest = slowest_consumer(seq);
+                gate.value.store(slowest, std::memory_order_relaxed);
+                if (seq - slowest >= capacity)
+                {
+                    if (policy == Backpressure::Drop)
+                    {
+                        drops.value.fetch_add(1, std::memory_order_relaxed);
+                        return false;
+                    }
+                    std::this_thread::yield();
+                    seq = claim.value.load(std::memory_order_relaxed);
+                    continue;
+                }
+            }
+            if (claim.value.compare_exchange_weak(seq, seq + 1, std::memory_order_acq_rel, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        events[seq & mask] = event;
+        published[seq & mask].store(seq + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Номер читателя; он увидит события, опубликованные после подключения
+    size_t add_consumer()
+    {
+        size_t index = consumer_count.load(std::memory_order_relaxed);
+        if (index == MAX_CONSUMERS)
+        {
+            throw std::logic_error("Too many event consumers");
+        }
+        cursors[index].value.store(claim.value.load(std::memory_order_acquire), std::memory_order_release);
+        consumer_count.store(index + 1, std::memory_order_release);
+        return index;
+    }
+
+    // Отдаёт читателю до max опубликованных подряд событий: handle(события, сколько)
+    // вызывается один или, на стыке кольца, два раза. Курсор сдвигается после handle,
+    // так что до его возврата ячейки не занимаются заново. Возвращает число событий.
+    template <typename Handle>
+    size_t drain(size_t consumer, size_t max, Handle&& handle)
+    {
+        const uint64_t next = cursors[consumer].value.load(std::memory_order_relaxed);
+        size_t count = 0;
+        while (count < max && published[(next + count) & mask].load(std::memory_order_acquire) == next + count + 1)
+        {
+            ++count;
+        }
+        if (count == 0)
+        {
+            return 0;
+        }
+        size_t first = static_cast<size_t>(next & mask);
+        size_t head = std::min(count, capacity - first);
+        handle(static_cast<const StoreEvent*>(&events[first]), head);
+        if (head < count)
+        {
+            handle(static_cast<const StoreEvent*>(&events[0]), count - head);
+        }
+        cursors[consumer].value.store(next + count, std::memory_order_release);
+        return count;
+    }
+
+    // Сколько номеров занято писателями (события могут быть ещё не опубликованы)
+    uint64_t claimed() const
+    {
+        return claim.value.load(std::memory_order_acquire);
+    }
+
+    uint64_t consumed(size_t consumer) const
+    {
+        return cursors[consumer].value.load(std::memory_order_acquire);
+    }
+
+    uint64_t dropped() const
+    {
+        return drops.value.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct alignas(64) Counter
+    {
+        std::atomic<uint64_t> value{ 0 };
+    };
+
+    const size_t capacity;
+    const uint64_t mask;
+    std::unique_ptr<StoreEvent[]> events;
+    std::unique_ptr<std::atomic<uint64_t>[]> published;
+    Backpressure policy;
+    Counter claim;
+    Counter gate; // не больше курсора самого медленного читателя: до него проверять нечего
+    Counter drops;
+    Counter cursors[MAX_CONSUMERS];
+    std::atomic<size_t> consumer_count{ 0 };
+
+    uint64_t slowest_consumer(uint64_t seq) const
+    {
+        uint64_t slowest = seq;
+        size_t count = consumer_count.load(std::memory_order_acquire);
+        for (size_t i = 0; i < count; ++i)
+        {
+            slowest = std::min(slowest, cursors[i].value.load(std::memory_order_acquire));
+        }
+        return slowest;
+    }
+};
+
+// Читатель кольца в своём потоке: забирает события пачками до BATCH_SIZE и отдаёт
+// consume. Пока событий нет, уступает процессор, а потом засыпает на IDLE_SLEEP.
+class EventConsumer
+{
+public:
+    using Consume = std::function<void(const StoreEvent*, size_t)>;
+
+    static const size_t BATCH_SIZE = 1024;
+    static constexpr std::chrono::microseconds IDLE_SLEEP{ 200 };
+
+    explicit EventConsumer(EventRing& ring) : ring(ring) {}
+
+    EventConsumer(const EventConsumer&) = delete;
+    EventConsumer& operator=(const EventConsumer&) = delete;
+
+    ~EventConsumer()
+    {
+        stop();
+    }
+
+    void start(Consume consume_batch)
+    {
+        consume = std::move(consume_batch);
+        index = ring.add_consumer();
+        worker = std::thread([this] { run(); });
+    }
+
+    // Дочитывает опубликованное и останавливает поток
+    void stop()
+    {
+        if (worker.joinable())
+        {
+            stopping.store(true, std::memory_order_release);
+            worker.join();
+        }
+    }
+
+    bool running() const
+    {
+        return worker.joinable();
+    }
+
+    // Ждёт, пока прочитано всё, что писатели заняли до вызова
+    void catch_up() const
+    {
+        if (!running())
+        {
+            return;
+        }
+        const uint64_t target = ring.claimed();
+        while (ring.consumed(index) < target)
+        {
+            std::this_thread::yield();
+        }
+    }
+
+private:
+    EventRing& ring;
+    Consume consume;
+    size_t index = 0;
+    std::atomic<bool> stopping{ false };
+    std::thread worker;
+
+    void run()
+    {
+        size_t idle = 0;
+        for (;;)
+        {
+            bool last_pass = stopping.load(std::memory_order_acquire);
+            if (ring.drain(index, BATCH_SIZE, consume) > 0)
+            {
+                idle = 0;
+                continue;
+            }
+            if (last_pass)
+            {
+                return;
+            }
+            if (++idle < 64)
+            {
+                std::this_thread::yield();
+            }
+            else
+            {
+                std::this_thread::sleep_for(IDLE_SLEEP);
+            }
+        }
+    }
+};
+
+EventRing store_events(1 << 16, Backpressure::Block); // Покупки и пополнения для читателей
+EventConsumer sales_feed(store_events);              // Аналитика продаж
+
+// Аудит: каждое событие - строка в файле --audit=<файл>
+//   purchase <время> <id пользователя> <ID товара> <цена> <скидка>
+//   topup <время> <id пользователя> <сумма>
+class AuditExporter
+{
+private:
+    EventConsumer feed{ store_events };
+    std::FILE* file = nullptr;
+
+public:
+    ~AuditExporter()
+    {
+        feed.stop();
+        if (file)
+        {
+            std::fclose(file);
+        }
+    }
+
+    bool open(const std::string& path)
+    {
+        file = open_file(path.c_str(), "ab");
+        if (!file)
+        {
+            return false;
+        }
+        feed.start([this](const StoreEvent* events, size_t count) {
+            for (size_t i = 0; i < count; ++i)
+            {
+                const StoreEvent& event = events[i];
+                if (event.type == StoreEventType::Purchase)
+                {
+                    std::fprintf(file, "purchase\t%lld\t%d\t%u\t%.17g\t%.9g\n", static_cast<long long>(event.timestamp),
+                        event.user_id, event.product_id, event.amount, event.discount);
+                }
+                else
+                {
+                    std::fprintf(file, "topup\t%lld\t%d\t%.17g\n", static_cast<long long>(event.timestamp),
+                        event.user_id, event.amount);
+                }
+            }
+            std::fflush(file);
+        });
+        return true;
+    }
+};
+
+AuditExporter audit;
+
+enum class CheckoutStatus
+{
+    Ok,
+    UnknownUser,
+    UnknownProduct,
+    InsufficientFunds,
+    InvalidAmount
+};
+
+struct CheckoutResult
+{
+    CheckoutStatus status;
+    double balance; // баланс пользователя после операции
+};
+
+// Потокобезопасные операции с пользователями для многих потоков сразу.
+// Состояние пользователя защищает одна из STRIPE_COUNT блокировок, выбранная по id,
+// поэтому покупки разных пользователей не мешают друг другу. Структуру таблицы users
+// защищает shared_mutex: поиск идёт под разделяемой блокировкой, вставка (регистрация,
+// подгрузка из снимка) под исключительной; ссылки на элементы unordered_map при вставке
+// не меняются. Каталог на горячем пути только читается.
+class CheckoutService
+{
+private:
+    static const size_t STRIPE_COUNT = 256;
+
+    struct alignas(64) Stripe
+    {
+        std::mutex mutex;
+    };
+
+    ProductCatalog& products;
+    UserTable& table;
+    std::shared_mutex table_mutex;
+    std::unique_ptr<Stripe[]> stripes{ new Stripe[STRIPE_COUNT] };
+
+    std::mutex& stripe_for(int user_id)
+    {
+        // Мультипликативный хеш: соседние id попадают в разные полосы
+        uint32_t hash = static_cast<uint32_t>(user_id) * 2654435761u;
+        return stripes[hash >> 24].mutex;
+    }
+
+    UserRef locate(int user_id)
+    {
+        {
+            std::shared_lock<std::shared_mutex> lock(table_mutex);
+            if (UserRef user = table.find(user_id))
+            {
+                return user;
+            }
+        }
+        std::unique_lock<std::shared_mutex> lock(table_mutex);
+        return find_user(table, user_id);
+    }
+
+    void lock_all_stripes()
+    {
+        for (size_t i = 0; i < STRIPE_COUNT; ++i)
+        {
+            stripes[i].mutex.lock();
+        }
+    }
+
+    void unlock_all_stripes()
+    {
+        for (size_t i = STRIPE_COUNT; i-- > 0;)
+        {
+            stripes[i].mutex.unlock();
+        }
+    }
+
+public:
+    CheckoutService(ProductCatalog& products, UserTable& table)
+        : products(products), table(table) {}
+
+    // Проверка баланса, списание, запись в историю и в журнал идут под одной
+    // блокировкой пользователя, поэтому покупка атомарна. Фиксации журнала покупка ждёт,
+    // уже отпустив блокировку.
+    CheckoutResult purchase(int user_id, uint32_t product_id)
+    {
+        OperationTimer timer(MetricOp::PurchaseProduct);
+        TraceSpan request = TraceSpan::request("purchase");
+        request.arg("user_id", user_id);
+        const Product* product = traced("catalog_lookup", [&] { return products.find_by_id(product_id); });
+        if (product == nullptr)
+        {
+            timer.fail();
+            return { CheckoutStatus::UnknownProduct, 0.0 };
+        }
+        UserRef user = traced("user_lookup", [&] { return locate(user_id); });
+        if (!user)
+        {
+            timer.fail();
+            return { CheckoutStatus::UnknownUser, 0.0 };
+        }
+
+        unsigned long long seq;
+        double balance;
+        {
+            std::lock_guard<std::mutex> lock(stripe_for(user_id));
+            table.before_change(user);
+            // Скидка - большая из личной скидки пользователя и скидки товара, как в
+            // User::purchase_product; одна цена на проверку и списание
+            const double discount = traced("discount", [&] { return std::max(user.discount(), product->get_max_discount()); });
+            const double price = product->current_price() * (1.0 - discount);
+            if (user.account_balance() < price)
+            {
+                timer.fail();
+                return { CheckoutStatus::InsufficientFunds, user.account_balance() };
+            }
+
+            PurchaseRecord record{ product_id, static_cast<float>(discount), price, unix_time_now() };
+            user.account_balance() -= record.price;
+            user.purchased_products().push_back(record);
+            seq = traced("journal_append", [&] { return journal.append_purchase(user_id, *product, record); });
+            store_events.publish({ StoreEventType::Purchase, record.discount, user_id, product_id, record.price, record.timestamp });
+            balance = user.account_balance();
+        }
+        traced("journal_commit", [&] { journal.commit(seq); });
+        return { CheckoutStatus::Ok, balance };
+    }
+
+    CheckoutResult purchase(int user_id, std::string_view title)
+    {
+        uint32_t product_id = products.find_id(title);
+        if (product_id == ProductCatalog::npos)
+        {
+            return { CheckoutStatus::UnknownProduct, 0.0 };
+        }
+        return purchase(user_id, product_id);
+    }
+
+    std::vector<uint32_t> search(std::string_view query, size_t k) const
+    {
+        return products.search(query, k);
+    }
+
+    CheckoutResult top_up(int user_id, double amount)
+    {
+        if (!(amount >= 0))
+        {
+            return { CheckoutStatus::InvalidAmount, 0.0 };
+        }
+        UserRef user = locate(user_id);
+        if (!user)
+        {
+            return { CheckoutStatus::UnknownUser, 0.0 };
+        }
+
+        unsigned long long seq;
+        double balance;
+        {
+            std::lock_guard<std::mutex> lock(stripe_for(user_id));
+            table.before_change(user);
+            user.add_balance(amount);
+            seq = journal.append_top_up(user_id, amount);
+            store_events.publish({ StoreEventType::TopUp, 0.0f, user_id, 0, amount, unix_time_now() });
+            balance = user.account_balance();
+        }
+        journal.commit(seq);
+        return { CheckoutStatus::Ok, balance };
+    }
+
+    // Новый пользователь получает свою ячейку таблицы, поэтому регистрациям хватает
+    // разделяемой блокировки: она лишь не даёт начаться контрольной точке
+    int sign_up(const std::string& full_name, double initial_balance)
+    {
+        OperationTimer timer(MetricOp::SignUp);
+        int user_id;
+        unsigned long long seq;
+        {
+            std::shared_lock<std::shared_mutex> lock(table_mutex);
+            user_id = table.allocate_id();
+            if (user_id == 0)
+            {
+                timer.fail();
+                return 0;
+            }
+            table.insert(User(user_id, full_name, initial_balance));
+            seq = journal.append_sign_up(user_id, full_name, initial_balance);
+        }
+        journal.commit(seq);
+        return user_id;
+    }
+
+    // Вызывает visit под блокировкой пользователя; false, если пользователя нет
+    bool with_user(int user_id, const std::function<void(UserRef)>& visit)
+    {
+        UserRef user = locate(user_id);
+        if (!user)
+        {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(stripe_for(user_id));
+        table.before_change(user);
+        visit(user);
+        return true;
+    }
+
+    // Контрольной точке нужно согласованное состояние: на время смены сегмента
+    // журнала и начала снимка таблицы блокируются все полосы
+    void maybe_checkpoint()
+    {
+        if (!checkpointer.due())
+        {
+            return;
+        }
+        std::unique_lock<std::shared_mutex> lock(table_mutex);
+        lock_all_stripes();
+        checkpointer.maybe_start(table);
+        unlock_all_stripes();
+    }
+
+    void checkpoint()
+    {
+        std::unique_lock<std::shared_mutex> lock(table_mutex);
+        lock_all_stripes();
+        save_users_to_file(table);
+        unlock_all_stripes();
+    }
+
+    // Вызывает visit, пока таблица и все пользователи неизменны: ни покупок, ни регистраций
+    template <typename Visit>
+    void with_consistent_state(Visit&& visit)
+    {
+        std::unique_lock<std::shared_mutex> lock(table_mutex);
+        lock_all_stripes();
+        visit(static_cast<const UserTable&>(table));
+        unlock_all_stripes();
+    }
+};
+
+CheckoutService checkout(catalog, users);
+
+// Контрольные точки сессий меню. maybe_checkpoint ждёт все полосы, чтобы сменить
+// сегмент журнала, поэтому идёт в своём потоке: поток пула исполнителя на это время не занят,
+// а сессия не ждёт контрольную точку.
+class CheckpointThread
+{
+private:
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool requested = false;
+    bool stopping = false;
+    std::thread worker;
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;)
+        {
+            wake.wait(lock, [&] { return requested || stopping; });
+            if (stopping)
+            {
+                return;
+            }
+            requested = false;
+            lock.unlock();
+            checkout.maybe_checkpoint();
+            lock.lock();
+        }
+    }
+
+public:
+    ~CheckpointThread()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        if (worker.joinable())
+        {
+            worker.join();
+        }
+    }
+
+    void request()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!worker.joinable())
+            {
+                worker = std::thread([this] { run(); });
+            }
+            requested = true;
+        }
+        wake.notify_one();
+    }
+};
+
+CheckpointThread checkpoint_thread;
+
+// Обратное к escape_journal_field. Неизвестная последовательность остаётся как есть:
+// так читаются и записи, сделанные до экранирования.
+static std::string unescape_journal_field(const std::string& text)
+{
+    std::string plain;
+    plain.reserve(text.size());
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+        if (text[i] != '\\' || i + 1 == text.size())
+        {
+            plain += text[i];
+            continue;
+        }
+        switch (text[i + 1])
+        {
+        case 't': plain += '\t'; ++i; break;
+        case 'n': plain += '\n'; ++i; break;
+        case 'r': plain += '\r'; ++i; break;
+        case '\\': plain += '\\'; ++i; break;
+        default: plain += '\\'; break;
+        }
+    }
+    return plain;
+}
+
+static std::vector<std::string> split_journal_record(const std::string& line)
+{
+    std::vector<std::string> fields;
+    size_t start = 0;
+    while (true)
+    {
+        size_t end = line.find('\t', start);
+        if (end == std::string::npos)
+        {
+            fields.push_back(line.substr(start));
+            return fields;
+        }
+        fields.push_back(line.substr(start, end - start));
+        start = end + 1;
+    }
+}
+
+// Проигрывает журнал поверх загруженного снимка, пропуская записи с номером <= after_seq.
+// Возвращает номер последней записи журнала.
+static unsigned long long replay_journal(const std::string& path, UserTable& users,
+    unsigned long long after_seq)
+{
+    std::ifstream file(path, std::ios::binary);
+    unsigned long long last_seq = after_seq;
+    if (!file)
+    {
+        return last_seq;
+    }
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (file.eof())
+        {
+            break; // Оборванная последняя запись (сбой во время записи) не применяется
+        }
+
+        std::vector<std::string> fields = split_journal_record(line);
+        if (fields.size() < 4)
+        {
+            break;
+        }
+
+        try
+        {
+            unsigned long long seq = std::stoull(fields[0]);
+            int user_id = std::stoi(fields[2]);
+            double value = std::stod(fields[3]);
+            last_seq = std::max(last_seq, seq);
+            if (seq <= after_seq)
+            {
+                continue;
+            }
+
+            const std::string& type = fields[1];
+            UserRef user = (type == "U") ? UserRef() : find_user(users, user_id);
+            if (type == "U" && fields.size() == 5)
+            {
+                users.insert(User(user_id, unescape_journal_field(fields[4]), value));
+            }
+            else if (!user)
+            {
+                std::cerr << "Journal record for unknown user: " << line << "\n";
+            }
+            else if (type == "B")
+            {
+                user.account_balance() += value;
+            }
+            else if (type == "P" && fields.size() == 8)
+            {
+                user.account_balance() -= value;
+                user.purchased_products().push_back({ catalog.resolve(unescape_journal_field(fields[6]), unescape_journal_field(fields[7]), value),
+                    static_cast<float>(std::stod(fields[4])), value, std::stoll(fields[5]) });
+            }
+            else if (type == "P" && fields.size() == 6)
+            {
+                // Запись покупки до появления скидки и времени: компания и название
+                user.account_balance() -= value;
+                user.purchased_products().push_back({ catalog.resolve(unescape_journal_field(fields[4]), unescape_journal_field(fields[5]), value), 0.0f, value, 0 });
+            }
+            else
+            {
+                std::cerr << "Unknown journal record: " << line << "\n";
+            }
+        }
+        catch (const std::exception&)
+        {
+            std::cerr << "Corrupted journal record: " << line << "\n";
+            break;
+        }
+    }
+
+    return last_seq;
+}
+
+// getline, понимающий файлы с окончаниями строк Windows (\r\n)
+static void read_text_line(std::istream& file, std::string& line)
+{
+    std::getline(file, line);
+    if (!line.empty() && line.back() == '\r')
+    {
+        line.pop_back();
+    }
+}
+
+// Ошибка в записи users.txt; строка вычисляется после разбора, по смещению
+struct TextImportError
+{
+    size_t offset;
+    size_t line;
+    std::string reason;
+};
+
+// Кусок файла, разобранный одним потоком: записи, начинающиеся в [start, конец куска).
+// Покупки товаров, которых нет в каталоге, ссылаются на unknown_products куска;
+// такие товары добавляются в каталог уже после разбора, в одном потоке. Имена и истории
+// пользователей куска лежат в его арене; она переходит в результат импорта.
+struct TextImportChunk
+{
+    struct UnknownProduct
+    {
+        std::string_view company;
+        std::string_view title;
+        double price;
+    };
+
+    struct PendingPurchase
+    {
+        size_t user;
+        size_t purchase;
+        uint32_t product;
+    };
+
+    size_t start = 0;
+    size_t stop = 0; // начало следующей записи
+    std::unique_ptr<std::pmr::monotonic_buffer_resource> arena =
+        std::make_unique<std::pmr::monotonic_buffer_resource>(&allocation_counter);
+    std::vector<User> users;
+    std::vector<TextImportError> errors;
+    std::vector<UnknownProduct> unknown_products;
+    std::unordered_map<std::string_view, uint32_t> unknown_by_title;
+    std::vector<PendingPurchase> pending;
+
+    TextImportChunk() = default;
+    TextImportChunk(TextImportChunk&&) = default;
+
+    // Имена и истории users лежат в arena, поэтому прежние users освобождаются раньше,
+    // чем заменяется arena (неявное присваивание шло бы в порядке объявления полей)
+    TextImportChunk& operator=(TextImportChunk&& other) noexcept
+    {
+        users.clear();
+        start = other.start;
+        stop = other.stop;
+        arena = std::move(other.arena);
+        users = std::move(other.users);
+        errors = std::move(other.errors);
+        unknown_products = std::move(other.unknown_products);
+        unknown_by_title = std::move(other.unknown_by_title);
+        pending = std::move(other.pending);
+        return *this;
+    }
+};
+
+// Разбор старого текстового формата users.txt, отображённого в память. Запись - строки
+// id, имя, баланс, скидка, число покупок и по три строки (компания, название, цена) на
+// покупку. Записи не размечены, поэтому поток, начинающий с середины файла, ищет начало
+// записи: строку, с которой подряд разбираются SYNC_RECORDS записей. Если поток ошибся,
+// это видно при сведении кусков: его начало не совпадёт с концом предыдущего куска.
+class UsersTextParser
+{
+private:
+    static const int SYNC_RECORDS = 4;
+
+    enum class RecordStatus
+    {
+        Ok,
+        Invalid, // структура верна, но значения нет: запись пропускается
+        Broken   // структура нарушена: начало следующей записи приходится искать
+    };
+
+    const char* data;
+    size_t size;
+    const ProductCatalog& catalog;
+
+    // Строка с позиции pos без \r\n; pos переходит на следующую строку
+    bool next_line(size_t& pos, std::string_view& line) const
+    {
+        if (pos >= size)
+        {
+            return false;
+        }
+        const char* begin = data + pos;
+        const char* end = static_cast<const char*>(std::memchr(begin, '\n', size - pos));
+        size_t length = end ? static_cast<size_t>(end - begin) : size - pos;
+        pos += end ? length + 1 : length;
+        if (length > 0 && begin[length - 1] == '\r')
+        {
+            --length;
+        }
+        line = std::string_view(begin, length);
+        return true;
+    }
+
+    void skip_blank_lines(size_t& pos) const
+    {
+        size_t probe = pos;
+        std::string_view line;
+        while (next_line(probe, line) && line.find_first_not_of(" \t") == std::string_view::npos)
+        {
+            pos = probe;
+        }
+    }
+
+    template <typename T>
+    static bool parse_number(std::string_view text, T& value)
+    {
+        size_t first = text.find_first_not_of(" \t");
+        size_t last = text.find_last_not_of(" \t");
+        if (first == std::string_view::npos)
+        {
+            return false;
+        }
+        const char* begin = text.data() + first;
+        const char* end = text.data() + last + 1;
+        auto [parsed, error] = std::from_chars(begin, end, value);
+        return error == std::errc() && parsed == end;
+    }
+
+    static std::string quoted(std::string_view text)
+    {
+        return "'" + std::string(text.substr(0, 40)) + (text.size() > 40 ? "...'" : "'");
+    }
+
+    // Разбирает запись с позиции pos и переводит pos на следующую. Без chunk только
+    // проверяет структуру (поиск начала записи), иначе добавляет пользователя в chunk.
+    RecordStatus parse_record(size_t& pos, TextImportChunk* chunk, std::string& reason) const
+    {
+        std::string_view id_line, name, balance_line, discount_line, count_line;
+        long long id;
+        double balance, discount;
+        long long count;
+        if (!next_line(pos, id_line) || !parse_number(id_line, id))
+        {
+            reason = "expected user id, got " + quoted(id_line);
+            return RecordStatus::Broken;
+        }
+        if (!next_line(pos, name) || !next_line(pos, balance_line) || !next_line(pos, discount_line) ||
+            !next_line(pos, count_line))
+        {
+            reason = "unexpected end of file in user " + std::to_string(id);
+            return RecordStatus::Broken;
+        }
+        if (!parse_number(balance_line, balance) || !parse_number(discount_line, discount) ||
+            !parse_number(count_line, count))
+        {
+            reason = "malformed balance, discount or purchase count of user " + std::to_string(id);
+            return RecordStatus::Broken;
+        }
+        // На покупку уходит не меньше 4 байт ("\n\n0\n")
+        if (count < 0 || static_cast<unsigned long long>(count) > (size - pos) / 4 + 1)
+        {
+            reason = "invalid purchase count " + quoted(count_line) + " of user " + std::to_string(id);
+            return RecordStatus::Broken;
+        }
+
+        // Значения проверяются и при поиске начала записи не нужны: мусорная запись
+        // с верной структурой всё равно остаётся границей записей
+        if (chunk == nullptr)
+        {
+            std::string_view company, title, price_line;
+            double price;
+            for (long long i = 0; i < count; ++i)
+            {
+                if (!next_line(pos, company) || !next_line(pos, title) || !next_line(pos, price_line) ||
+                    !parse_number(price_line, price))
+                {
+                    return RecordStatus::Broken;
+                }
+            }
+            return RecordStatus::Ok;
+        }
+
+        reason.clear();
+        if (id < 1 || id > std::numeric_limits<int>::max())
+        {
+            reason = "invalid user id " + quoted(id_line);
+        }
+        else if (!std::isfinite(balance) || balance < 0)
+        {
+            reason = "invalid balance " + quoted(balance_line) + " of user " + std::to_string(id);
+        }
+        else if (!std::isfinite(discount) || discount < 0 || discount > 1)
+        {
+            reason = "invalid discount " + quoted(discount_line) + " of user " + std::to_string(id);
+        }
+
+        User user(static_cast<int>(id), name, balance, chunk->arena.get());
+        user.discount = discount;
+        user.purchased_products.resize(static_cast<size_t>(count));
+        const size_t pending_before = chunk->pending.size();
+        for (long long i = 0; i < count; ++i)
+        {
+            std::string_view company, title, price_line;
+            double price;
+            if (!next_line(pos, company) || !next_line(pos, title) || !next_line(pos, price_line))
+            {
+                reason = "unexpected end of file in purchases of user " + std::to_string(id);
+                chunk->pending.resize(pending_before);
+                return RecordStatus::Broken;
+            }
+            if (!parse_number(price_line, price))
+            {
+                reason = "malformed price " + quoted(price_line) + " in purchases of user " + std::to_string(id);
+                chunk->pending.resize(pending_before);
+                return RecordStatus::Broken;
+            }
+            if (reason.empty() && (!std::isfinite(price) || price < 0))
+            {
+                reason = "invalid price " + quoted(price_line) + " in purchases of user " + std::to_string(id);
+            }
+
+            PurchaseRecord& record = user.purchased_products[static_cast<size_t>(i)];
+            record = { catalog.find_id(title), 0.0f, price, 0 };
+            if (record.product_id == ProductCatalog::npos)
+            {
+                auto known = chunk->unknown_by_title.find(title);
+                uint32_t unknown = known != chunk->unknown_by_title.end() ? known->second :
+                    static_cast<uint32_t>(chunk->unknown_products.size());
+                if (unknown == chunk->unknown_products.size())
+                {
+                    chunk->unknown_products.push_back({ company, title, price });
+                    chunk->unknown_by_title.emplace(title, unknown);
+                }
+                chunk->pending.push_back({ chunk->users.size(), static_cast<size_t>(i), unknown });
+            }
+        }
+
+        if (!reason.empty())
+        {
+            chunk->pending.resize(pending_before);
+            return RecordStatus::Invalid;
+        }
+        chunk->users.push_back(std::move(user));
+        return RecordStatus::Ok;
+    }
+
+    // Первое начало строки не раньше pos, с которого подряд разбираются SYNC_RECORDS
+    // записей (или все записи до конца файла)
+    size_t find_record_start(size_t pos) const
+    {
+        if (pos > 0 && pos < size && data[pos - 1] != '\n')
+        {
+            const char* end = static_cast<const char*>(std::memchr(data + pos, '\n', size - pos));
+            pos = end ? static_cast<size_t>(end - data) + 1 : size;
+        }
+        std::string reason;
+        std::string_view line;
+        while (pos < size)
+        {
+            size_t probe = pos;
+            int parsed = 0;
+            bool broken = false;
+            while (parsed < SYNC_RECORDS && !broken)
+            {
+                skip_blank_lines(probe);
+                if (probe >= size)
+                {
+                    break;
+                }
+                broken = parse_record(probe, nullptr, reason) == RecordStatus::Broken;
+                parsed += broken ? 0 : 1;
+            }
+            if (!broken && parsed > 0)
+            {
+                return pos;
+            }
+            next_line(pos, line);
+        }
+        return size;
+    }
+
+public:
+    UsersTextParser(const char* data, size_t size, const ProductCatalog& catalog)
+        : data(data), size(size), catalog(catalog) {}
+
+    // Записи, начинающиеся в [begin, end). Если begin не начало записи (synced == false),
+    // разбор начинается с найденного find_record_start.
+    TextImportChunk parse_chunk(size_t begin, size_t end, bool synced) const
+    {
+        TextImportChunk chunk;
+        size_t pos = synced ? begin : find_record_start(begin);
+        skip_blank_lines(pos);
+        chunk.start = pos;
+        std::string reason;
+        while (pos < end && pos < size)
+        {
+            size_t record = pos;
+            RecordStatus status = parse_record(pos, &chunk, reason);
+            if (status != RecordStatus::Ok)
+            {
+                chunk.errors.push_back({ record, 0, reason });
+            }
+            if (status == RecordStatus::Broken)
+            {
+                pos = find_record_start(record + 1);
+            }
+            skip_blank_lines(pos);
+        }
+        chunk.stop = std::max(pos, chunk.start);
+        return chunk;
+    }
+};
+
+// Результат импорта users.txt: пользователи в порядке файла и отвергнутые записи.
+// Память пользователей - арены кусков, она освобождается вместе с результатом.
+struct TextImportResult
+{
+    std::vector<std::unique_ptr<std::pmr::monotonic_buffer_resource>> arenas;
+    std::vector<User> users;
+    std::vector<TextImportError> errors;
+    unsigned long long covered_seq = 0; // из заголовка "#journal N"
+    size_t bytes = 0;
+    size_t threads = 0;
+    double seconds = 0;
+};
+
+const size_t TEXT_IMPORT_MIN_CHUNK = 4 << 20;
+const size_t TEXT_IMPORT_MAX_REPORTED_ERRORS = 1000;
+
+// Разбирает users.txt параллельно, по куску файла на поток. Товары, которых нет в
+// каталоге, добавляются как архивные (как при подгрузке старых покупок).
+static bool import_users_text(const std::string& path, TextImportResult& result)
+{
+    const auto started = std::chrono::steady_clock::now();
+    result = TextImportResult();
+    std::error_code error;
+    if (std::filesystem::is_regular_file(path, error) && std::filesystem::file_size(path, error) == 0)
+    {
+        return true; // пустой файл не отображается в память
+    }
+
+    MappedFile file;
+    if (!file.open(path))
+    {
+        std::cerr << "Failed to open " << path << " for reading.\n";
+        return false;
+    }
+    file.advise_sequential();
+    const char* data = file.data();
+    const size_t size = file.size();
+    result.bytes = size;
+
+    size_t first = 0;
+    if (data[0] == '#')
+    {
+        // Заголовок "#journal N": номер последней записи журнала, вошедшей в файл
+        const char* end = static_cast<const char*>(std::memchr(data, '\n', size));
+        first = end ? static_cast<size_t>(end - data) + 1 : size;
+        const char* number = static_cast<const char*>(std::memchr(data, ' ', first));
+        if (number)
+        {
+            std::from_chars(number + 1, data + first, result.covered_seq);
+        }
+    }
+
+    UsersTextParser parser(data, size, catalog);
+    size_t threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+    size_t chunk_count = std::max<size_t>(1, std::min(threads, (size - first) / TEXT_IMPORT_MIN_CHUNK));
+    size_t chunk_size = (size - first) / chunk_count;
+    std::vector<size_t> bounds(chunk_count + 1);
+    for (size_t i = 0; i < chunk_count; ++i)
+    {
+        bounds[i] = first + i * chunk_size;
+    }
+    bounds[chunk_count] = size;
+    result.threads = chunk_count;
+
+    std::vector<TextImportChunk> chunks(chunk_count);
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < chunk_count; ++i)
+    {
+        workers.emplace_back([&, i] { chunks[i] = parser.parse_chunk(bounds[i], bounds[i + 1], false); });
+    }
+    chunks[0] = parser.parse_chunk(bounds[0], bounds[1], true);
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+
+    // Сведение кусков: кусок, начало которого не совпало с концом предыдущего,
+    // разбирается заново; кусок, целиком покрытый предыдущим, отбрасывается
+    size_t pos = chunks[0].stop;
+    for (size_t i = 1; i < chunk_count; ++i)
+    {
+        if (bounds[i + 1] <= pos)
+        {
+            chunks[i] = TextImportChunk();
+            continue;
+        }
+        if (chunks[i].start != pos)
+        {
+            chunks[i] = parser.parse_chunk(pos, bounds[i + 1], true);
+        }
+        pos = chunks[i].stop;
+    }
+
+    size_t user_count = 0;
+    for (const TextImportChunk& chunk : chunks)
+    {
+        user_count += chunk.users.size();
+    }
+    result.users.reserve(user_count);
+    size_t line = 1, counted = 0;
+    for (TextImportChunk& chunk : chunks)
+    {
+        // Товары отвергнутых записей в каталог не попадают
+        std::vector<uint32_t> resolved(chunk.unknown_products.size(), ProductCatalog::npos);
+        for (const TextImportChunk::PendingPurchase& purchase : chunk.pending)
+        {
+            uint32_t& id = resolved[purchase.product];
+            if (id == ProductCatalog::npos)
+            {
+                const TextImportChunk::UnknownProduct& product = chunk.unknown_products[purchase.product];
+                id = catalog.resolve(product.company, product.title, product.price);
+            }
+            chunk.users[purchase.user].purchased_products[purchase.purchase].product_id = id;
+        }
+        result.users.insert(result.users.end(), std::make_move_iterator(chunk.users.begin()),
+            std::make_move_iterator(chunk.users.end()));
+        result.arenas.push_back(std::move(chunk.arena));
+
+        for (TextImportError& entry : chunk.errors)
+        {
+            line += std::count(data + counted, data + entry.offset, '\n');
+            counted = entry.offset;
+            entry.line = line;
+            result.errors.push_back(std::move(entry));
+        }
+    }
+
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    return true;
+}
+
+static void report_text_import(const std::string& path, const TextImportResult& result)
+{
+    for (size_t i = 0; i < result.errors.size() && i < TEXT_IMPORT_MAX_REPORTED_ERRORS; ++i)
+    {
+        std::cerr << path << ":" << result.errors[i].line << ": " << result.errors[i].reason << "\n";
+    }
+    if (result.errors.size() > TEXT_IMPORT_MAX_REPORTED_ERRORS)
+    {
+        std::cerr << "... and " << result.errors.size() - TEXT_IMPORT_MAX_REPORTED_ERRORS << " more\n";
+    }
+    std::cerr << "Parsed " << result.users.size() << " users from " << path << " ("
+        << std::fixed << std::setprecision(1) << result.bytes / 1048576.0 << " MB in "
+        << std::setprecision(3) << result.seconds << " s on " << result.threads << " threads), "
+        << result.errors.size() << " records rejected.\n";
+    std::cerr.unsetf(std::ios::floatfield);
+    std::cerr << std::setprecision(6);
+}
+
+// Читает пользователей из старого текстового формата users.txt; повторяющийся id
+// заменяет прежнего пользователя, как при последовательном чтении.
+// covered_seq - номер записи журнала из заголовка "#journal N" (0, если заголовка нет).
+static bool load_users_from_text(const std::string& path, UserTable& users,
+    unsigned long long& covered_seq)
+{
+    TextImportResult result;
+    if (!import_users_text(path, result))
+    {
+        return false;
+    }
+    report_text_import(path, result);
+    covered_seq = result.covered_seq;
+    for (User& user : result.users)
+    {
+        users.insert(std::move(user));
+    }
+    return true;
+}
+
+// Конвертер из users.txt в бинарную базу users.<seq>.db
+bool convert_text_users(const std::string& path)
+{
+    UserTable text_users;
+    unsigned long long covered_seq = 0;
+    if (!load_users_from_text(path, text_users, covered_seq))
+    {
+        return false;
+    }
+
+    user_db.close(); // снимок должен содержать только пользователей из текстового файла
+    if (!write_users_snapshot(text_users, covered_seq))
+    {
+        return false;
+    }
+    std::cout << "Converted " << text_users.size() << " users from " << path
+        << " to " << user_db_path(covered_seq) << "\n";
+    return true;
+}
+
+void load_users_from_file(UserTable& users)
+{
+    OperationTimer timer(MetricOp::LoadUsers);
+    users.clear();
+    user_db.close();
+
+    std::vector<NumberedFile> snapshots = list_numbered_files(USER_DB_PREFIX, USER_DB_SUFFIX);
+    if (snapshots.empty() && std::filesystem::exists(USERS_FILE))
+    {
+        // Первый запуск после перехода на бинарный формат
+        convert_text_users(USERS_FILE);
+        snapshots = list_numbered_files(USER_DB_PREFIX, USER_DB_SUFFIX);
+    }
+
+    // Открываем самый новый корректный снимок
+    unsigned long long snapshot_seq = 0;
+    for (auto it = snapshots.rbegin(); it != snapshots.rend(); ++it)
+    {
+        if (user_db.open(it->path, catalog))
+        {
+            snapshot_seq = user_db.covered_seq();
+            users.reserve_slots(user_db.user_slot_count());
+            break;
+        }
+    }
+
+    // В версии 1 товары покупок ищутся в каталоге по названию при каждой подгрузке.
+    // Читаем такой снимок целиком сейчас, чтобы после запуска каталог только читался.
+    if (user_db.format_version() == 1)
+    {
+        for (size_t i = 0; i < user_db.user_count(); ++i)
+        {
+            find_user(users, user_db.id_at(i));
+        }
+    }
+
+    // Осталось проиграть хвост журнала
+    unsigned long long last_seq = snapshot_seq;
+    for (const NumberedFile& segment : list_journal_segments())
+    {
+        last_seq = std::max(last_seq, replay_journal(segment.path, users, snapshot_seq));
+    }
+    journal.open(last_seq + 1);
+    checkpointer.set_last_checkpoint(snapshot_seq);
+    catalog.rehash_titles(); // архивные товары из снимка и журнала
+}
+
+// Аналитика продаж по сохранённым историям строится при первом отчёте, а не при запуске:
+// иначе запуск читал бы из снимка историю каждого пользователя
+std::mutex sales_build_mutex;
+bool sales_built = false; // под sales_build_mutex
+
+// База перед началом работы магазина: пользователи и подписка аналитики продаж на события
+// покупок. Сами агрегаты по прежним покупкам достраивает ensure_sales_analytics.
+static void open_store()
+{
+    load_users_from_file(users);
+    {
+        std::lock_guard<std::mutex> lock(sales_build_mutex);
+        sales_built = false;
+    }
+    if (!sales_feed.running())
+    {
+        sales_feed.start([batch = std::vector<PurchaseRecord>()](const StoreEvent* events, size_t count) mutable {
+            batch.clear();
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (events[i].type == StoreEventType::Purchase)
+                {
+                    batch.push_back({ events[i].product_id, events[i].discount, events[i].amount, events[i].timestamp });
+                }
+            }
+            sales.record_batch(batch.data(), batch.size());
+        });
+    }
+}
+
+// Достраивает аналитику продаж по историям, если это ещё не сделано. Срез согласован:
+// под блокировками checkout дочитываются события, агрегаты обнуляются и копируются
+// истории пользователей таблицы. Покупки после среза дальше приходят через sales_feed,
+// а пользователи снимка, которых в таблице не было, читаются уже без блокировок:
+// их сохранённые истории неизменны, даже если пользователя тем временем подгрузили.
+static void ensure_sales_analytics()
+{
+    std::lock_guard<std::mutex> lock(sales_build_mutex);
+    if (sales_built)
+    {
+        return;
+    }
+
+    std::vector<PurchaseRecord> recent;
+    std::vector<int> table_ids;
+    checkout.with_consistent_state([&](const UserTable& table) {
+        sales_feed.catch_up();
+        sales.clear();
+        table.for_each([&](UserRef user) {
+            table_ids.push_back(user.id());
+            recent.insert(recent.end(), user.purchased_products().begin(), user.purchased_products().end());
+        });
+    });
+
+    std::sort(table_ids.begin(), table_ids.end());
+    std::vector<size_t> stored;
+    for (size_t i = 0; i < user_db.user_count(); ++i)
+    {
+        if (!std::binary_search(table_ids.begin(), table_ids.end(), user_db.id_at(i)))
+        {
+            stored.push_back(i);
+        }
+    }
+    std::vector<std::pair<const PurchaseRecord*, size_t>> histories;
+    for (size_t i = 0; i < recent.size(); i += 4096)
+    {
+        histories.emplace_back(recent.data() + i, std::min<size_t>(4096, recent.size() - i));
+    }
+    sales.add_histories(histories, user_db, stored, std::thread::hardware_concurrency());
+    sales_built = true;
+}
+
+// Добавляет в текущую базу пользователей из users.txt другого магазина. Пользователи,
+// чей id уже занят, не добавляются; результат сразу сохраняется контрольной точкой.
+bool import_text_users(const std::string& path)
+{
+    load_users_from_file(users);
+    TextImportResult result;
+    if (!import_users_text(path, result))
+    {
+        return false;
+    }
+    report_text_import(path, result);
+
+    size_t imported = 0;
+    for (User& user : result.users)
+    {
+        if (find_user(users, user.id))
+        {
+            std::cerr << path << ": user " << user.id << " already exists, skipped.\n";
+            continue;
+        }
+        users.insert(std::move(user));
+        ++imported;
+    }
+    checkout.checkpoint();
+    std::cout << "Imported " << imported << " of " << result.users.size() << " users from " << path << "\n";
+    return true;
+}
+
+const size_t SEARCH_RESULTS = 10; // товаров в ответе на поиск
+
+// Операции меню без консоли: то же, что делают main_menu_session и user_menu, но с
+// типизированными аргументами и результатами и без вывода. Сессия, как user_menu,
+// помнит вошедшего пользователя.
+class StoreSession
+{
+private:
+    CheckoutService& service;
+    int user_id = 0;
+    bool signed_in = false;
+
+public:
+    explicit StoreSession(CheckoutService& service) : service(service) {}
+
+    int sign_up(const std::string& full_name, double initial_balance)
+    {
+        return service.sign_up(full_name, initial_balance);
+    }
+
+    bool sign_in(int id, std::string* full_name = nullptr)
+    {
+        signed_in = service.with_user(id, [&](UserRef user) { if (full_name) *full_name = user.full_name(); });
+        user_id = signed_in ? id : 0;
+        return signed_in;
+    }
+
+    // История покупок вошедшего пользователя; false, если вход не выполнен
+    bool view(std::vector<PurchaseRecord>& history)
+    {
+        return signed_in && service.with_user(user_id, [&](UserRef user) {
+            history.assign(user.purchased_products().begin(), user.purchased_products().end());
+        });
+    }
+
+    CheckoutResult purchase(std::string_view title)
+    {
+        if (!signed_in)
+        {
+            return { CheckoutStatus::UnknownUser, 0.0 };
+        }
+        return service.purchase(user_id, title);
+    }
+
+    // Поиск товаров доступен и без входа
+    std::vector<uint32_t> search(std::string_view query) const
+    {
+        return service.search(query, SEARCH_RESULTS);
+    }
+
+    CheckoutResult top_up(double amount)
+    {
+        if (!signed_in)
+        {
+            return { CheckoutStatus::UnknownUser, 0.0 };
+        }
+        return service.top_up(user_id, amount);
+    }
+
+    // Выход в главное меню: журнал сбрасывается, как в user_menu
+    void sign_out()
+    {
+        if (signed_in)
+        {
+            journal.sync();
+        }
+        signed_in = false;
+        user_id = 0;
+    }
+
+    int current_user() const
+    {
+        return signed_in ? user_id : 0;
+    }
+};
+
+// Сценарий сессии - текстовый файл, по команде в строке:
+//   signup <баланс> <имя>   signin <id или $>   view   buy <название>   topup <сумма>   signout
+//   search <запрос>   sales   stats
+// $ - ID, выданный последней командой signup этого сценария. Строки с # - комментарии.
+// Такой файл пишет интерактивный режим с --record=<файл>.
+enum class SessionOp
+{
+    SignUp,
+    SignIn,
+    View,
+    Purchase,
+    TopUp,
+    SignOut,
+    Search,
+    Sales,
+    Stats,
+    Count
+};
+
+const char* const SESSION_OP_NAMES[] = { "signup", "signin", "view", "buy", "topup", "signout", "search", "sales", "stats" };
+
+struct SessionCommand
+{
+    SessionOp op;
+    int user_id = 0;         // signin; 0 - последний зарегистрированный ($)
+    double amount = 0.0;     // signup, topup
+    std::string text{};      // signup - имя, buy - название товара, search - запрос
+};
+
+// Разбирает одну команду сценария (она же запрос сервера); false, если команда неверна
+bool parse_session_command(const std::string& line, SessionCommand& command)
+{
+    std::istringstream fields(line);
+    std::string name;
+    if (!(fields >> name))
+    {
+        return false;
+    }
+
+    size_t op = 0;
+    while (op < static_cast<size_t>(SessionOp::Count) && name != SESSION_OP_NAMES[op]) ++op;
+    command = SessionCommand{ static_cast<SessionOp>(op) };
+
+    switch (command.op)
+    {
+    case SessionOp::SignUp:
+        if (!(fields >> command.amount))
+        {
+            return false;
+        }
+        std::getline(fields >> std::ws, command.text);
+        return !command.text.empty();
+    case SessionOp::SignIn:
+    {
+        std::string id;
+        if (!(fields >> id))
+        {
+            return false;
+        }
+        if (id == "$")
+        {
+            return true;
+        }
+        char* end = nullptr;
+        long value = std::strtol(id.c_str(), &end, 10);
+        command.user_id = static_cast<int>(value);
+        return *end == '\0' && value > 0 && value <= std::numeric_limits<int>::max();
+    }
+    case SessionOp::Purchase:
+    case SessionOp::Search:
+        std::getline(fields >> std::ws, command.text);
+        return !command.text.empty();
+    case SessionOp::TopUp:
+        return static_cast<bool>(fields >> command.amount);
+    case SessionOp::View:
+    case SessionOp::SignOut:
+    case SessionOp::Sales:
+    case SessionOp::Stats:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool parse_session_script(const std::string& path, std::vector<SessionCommand>& commands)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        std::cerr << "Failed to open " << path << ".\n";
+        return false;
+    }
+
+    std::string line;
+    size_t line_number = 0;
+    for (;;)
+    {
+        read_text_line(in, line);
+        if (!in)
+        {
+            break;
+        }
+        ++line_number;
+        size_t first = line.find_first_not_of(" \t");
+        if (first == std::string::npos || line[first] == '#')
+        {
+            continue;
+        }
+
+        SessionCommand command;
+        if (!parse_session_command(line, command))
+        {
+            std::cerr << path << ":" << line_number << ": invalid command: " << line << "\n";
+            return false;
+        }
+        commands.push_back(std::move(command));
+    }
+    return true;
+}
+
+// Запись интерактивной сессии в сценарий (--record=<файл>)
+class SessionRecorder
+{
+private:
+    std::ofstream out;
+    int last_sign_up = 0;
+
+public:
+    bool open(const std::string& path)
+    {
+        out.open(path, std::ios::app);
+        return static_cast<bool>(out);
+    }
+
+    void sign_up(int user_id, double initial_balance, const std::string& full_name)
+    {
+        if (!out.is_open()) return;
+        last_sign_up = user_id;
+        out << "signup " << initial_balance << " " << full_name << std::endl;
+    }
+
+    void sign_in(int user_id)
+    {
+        if (!out.is_open()) return;
+        if (user_id == last_sign_up)
+        {
+            out << "signin $" << std::endl; // при воспроизведении ID будет другим
+        }
+        else
+        {
+            out << "signin " << user_id << std::endl;
+        }
+    }
+
+    void command(SessionOp op, const std::string& argument = std::string())
+    {
+        if (!out.is_open()) return;
+        out << SESSION_OP_NAMES[static_cast<size_t>(op)];
+        if (!argument.empty())
+        {
+            out << " " << argument;
+        }
+        out << std::endl;
+    }
+};
+
+SessionRecorder recorder;
+
+// Задержки операций одного потока драйвера, в наносекундах
+struct SessionStats
+{
+    std::vector<double> latencies[static_cast<size_t>(SessionOp::Count)];
+    size_t failures[static_cast<size_t>(SessionOp::Count)] = {};
+
+    void merge(const SessionStats& other)
+    {
+        for (size_t op = 0; op < static_cast<size_t>(SessionOp::Count); ++op)
+        {
+            latencies[op].insert(latencies[op].end(), other.latencies[op].begin(), other.latencies[op].end());
+            failures[op] += other.failures[op];
+        }
+    }
+};
+
+// Выполняет команду и замеряет её; last_sign_up - ID для $. Задержка считается от
+// scheduled - момента, когда команду следовало начать: в открытой модели нагрузки
+// опоздание занятого потока входит в задержку, а не пропадает (coordinated omission).
+// Возвращает момент завершения - плановое начало следующей команды сессии.
+static std::chrono::steady_clock::time_point run_session_command(StoreSession& session, const SessionCommand& command,
+    int& last_sign_up, SessionStats& stats, std::chrono::steady_clock::time_point scheduled)
+{
+    std::vector<PurchaseRecord> history;
+    bool ok = true;
+    switch (command.op)
+    {
+    case SessionOp::SignUp:
+        last_sign_up = session.sign_up(command.text, command.amount);
+        ok = last_sign_up != 0;
+        break;
+    case SessionOp::SignIn:
+        ok = session.sign_in(command.user_id != 0 ? command.user_id : last_sign_up);
+        break;
+    case SessionOp::View:
+        ok = session.view(history);
+        break;
+    case SessionOp::Purchase:
+        ok = session.purchase(command.text).status == CheckoutStatus::Ok;
+        break;
+    case SessionOp::TopUp:
+        ok = session.top_up(command.amount).status == CheckoutStatus::Ok;
+        break;
+    case SessionOp::Search:
+        ok = !session.search(command.text).empty();
+        break;
+    case SessionOp::Sales:
+        ensure_sales_analytics();
+        sales_feed.catch_up();
+        sales.top_sellers(1, SEARCH_RESULTS);
+        break;
+    case SessionOp::Stats:
+        format_metrics_report(); // замеряется только сборка отчёта, отказать она не может
+        ok = true;
+        break;
+    default:
+        session.sign_out();
+        break;
+    }
+    auto finish = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double, std::nano>(finish - scheduled).count();
+
+    size_t op = static_cast<size_t>(command.op);
+    stats.latencies[op].push_back(elapsed);
+    if (!ok)
+    {
+        ++stats.failures[op];
+    }
+    return finish;
+}
+
+// Пропускная способность и перцентили задержки по каждой операции
+static void print_session_report(SessionStats& stats, double seconds)
+{
+    auto percentile = [](const std::vector<double>& sorted, double p) {
+        size_t rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+        return sorted[std::min(sorted.size() - 1, rank == 0 ? 0 : rank - 1)] / 1000.0;
+    };
+
+    std::cout << std::left << std::setw(10) << "op" << std::right
+        << std::setw(10) << "count" << std::setw(10) << "failed" << std::setw(12) << "ops/s"
+        << std::setw(12) << "p50 us" << std::setw(12) << "p99 us" << std::setw(12) << "max us" << "\n";
+    std::cout << std::fixed << std::setprecision(1);
+    size_t total = 0;
+    for (size_t op = 0; op < static_cast<size_t>(SessionOp::Count); ++op)
+    {
+        std::vector<double>& samples = stats.latencies[op];
+        if (samples.empty())
+        {
+            continue;
+        }
+        std::sort(samples.begin(), samples.end());
+        total += samples.size();
+        std::cout << std::left << std::setw(10) << SESSION_OP_NAMES[op] << std::right
+            << std::setw(10) << samples.size() << std::setw(10) << stats.failures[op]
+            << std::setw(12) << samples.size() / seconds
+            << std::setw(12) << percentile(samples, 0.50) << std::setw(12) << percentile(samples, 0.99)
+            << std::setw(12) << samples.back() / 1000.0 << "\n";
+    }
+    std::cout << std::left << std::setw(10) << "total" << std::right << std::setw(10) << total
+        << std::setw(10) << "" << std::setw(12) << total / seconds << "\n";
+    std::cout << "Elapsed: " << std::setprecision(3) << seconds << " s\n";
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << std::setprecision(6);
+}
+
+struct DriverOptions
+{
+    std::vector<std::string> scripts; // --drive=<файл>, можно несколько
+    size_t repeat = 1;                // --drive-repeat=N
+    bool load = false;                // --load
+    double rate = 0.0;                // --load-rate=<сессий в секунду>, 0 - без пауз
+    double duration = 10.0;           // --load-duration=<секунды>
+    size_t threads = 1;               // --threads=N
+    size_t steps = 8;                 // --load-steps=<операций в сессии>
+    uint64_t seed = 1;                // --load-seed=N
+};
+
+static DriverOptions parse_driver_options(int argc, char* argv[])
+{
+    DriverOptions options;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg.rfind("--drive=", 0) == 0)
+        {
+            options.scripts.push_back(arg.substr(8));
+        }
+        else if (arg.rfind("--drive-repeat=", 0) == 0)
+        {
+            options.repeat = std::max<size_t>(1, std::stoull(arg.substr(15)));
+        }
+        else if (arg == "--load")
+        {
+            options.load = true;
+        }
+        else if (arg.rfind("--load-rate=", 0) == 0)
+        {
+            options.rate = std::stod(arg.substr(12));
+        }
+        else if (arg.rfind("--load-duration=", 0) == 0)
+        {
+            options.duration = std::stod(arg.substr(16));
+        }
+        else if (arg.rfind("--threads=", 0) == 0)
+        {
+            options.threads = std::max<size_t>(1, std::stoull(arg.substr(10)));
+        }
+        else if (arg.rfind("--load-steps=", 0) == 0)
+        {
+            options.steps = std::stoull(arg.substr(13));
+        }
+        else if (arg.rfind("--load-seed=", 0) == 0)
+        {
+            options.seed = std::stoull(arg.substr(12));
+        }
+    }
+    return options;
+}
+
+// Синтетическая сессия: вход существующего пользователя (или регистрация нового, если
+// выбирать не из кого, и в каждой пятой сессии), затем steps операций:
+// просмотр 30%, покупка 50%, пополнение 20%, и выход
+static std::vector<SessionCommand> make_synthetic_session(std::mt19937_64& gen, const std::vector<int>& known_ids,
+    size_t steps)
+{
+    std::vector<SessionCommand> commands;
+    std::uniform_int_distribution<int> percent(0, 99);
+    if (known_ids.empty() || percent(gen) < 20)
+    {
+        SessionCommand sign_up{ SessionOp::SignUp };
+        sign_up.amount = std::uniform_real_distribution<double>(100.0, 5000.0)(gen);
+        sign_up.text = "Load User " + std::to_string(gen() % 100000);
+        commands.push_back(sign_up);
+        commands.push_back({ SessionOp::SignIn });
+    }
+    else
+    {
+        SessionCommand sign_in{ SessionOp::SignIn };
+        sign_in.user_id = known_ids[gen() % known_ids.size()];
+        commands.push_back(sign_in);
+    }
+
+    for (size_t i = 0; i < steps; ++i)
+    {
+        int roll = percent(gen);
+        if (roll < 30)
+        {
+            commands.push_back({ SessionOp::View });
+        }
+        else if (roll < 80)
+        {
+            SessionCommand buy{ SessionOp::Purchase };
+            buy.text = catalog.find_by_id(static_cast<uint32_t>(gen() % catalog.size()))->getTitle();
+            commands.push_back(buy);
+        }
+        else
+        {
+            SessionCommand top_up{ SessionOp::TopUp };
+            top_up.amount = std::uniform_real_distribution<double>(10.0, 500.0)(gen);
+            commands.push_back(top_up);
+        }
+    }
+    commands.push_back({ SessionOp::SignOut });
+    return commands;
+}
+
+// Драйвер без консоли: try5 --drive=<сценарий> [--drive-repeat=N] [--threads=N]
+// или try5 --load [--load-rate=R] [--load-duration=S] [--load-steps=N] [--threads=N].
+// Работает с базой текущего каталога, как интерактивный режим, и в конце пишет снимок.
+static int run_driver(const DriverOptions& options)
+{
+    std::vector<std::vector<SessionCommand>> scripts;
+    for (const std::string& path : options.scripts)
+    {
+        scripts.emplace_back();
+        if (!parse_session_script(path, scripts.back()))
+        {
+            return 1;
+        }
+    }
+
+    open_store();
+    std::vector<int> known_ids;
+    for (size_t i = 0; i < user_db.user_count(); ++i)
+    {
+        known_ids.push_back(user_db.id_at(i));
+    }
+    users.for_each([&](UserRef user) {
+        if (!user_db.contains(user.id())) known_ids.push_back(user.id());
+    });
+
+    std::vector<SessionStats> stats(options.threads);
+    std::atomic<size_t> next_session{ 0 };
+    const size_t script_sessions = scripts.size() * options.repeat;
+    const AllocationCounter::Totals allocated_before = allocation_counter.totals();
+    const auto start = std::chrono::steady_clock::now();
+
+    auto worker = [&](size_t thread_index) {
+        StoreSession session(checkout);
+        std::mt19937_64 gen(options.seed + thread_index);
+        std::vector<int> pool = known_ids; // и зарегистрированные этим потоком
+        int last_sign_up = 0;
+        for (;;)
+        {
+            size_t index = next_session++;
+            std::vector<SessionCommand> generated;
+            const std::vector<SessionCommand>* commands;
+            auto scheduled = std::chrono::steady_clock::now();
+            if (!options.load)
+            {
+                if (index >= script_sessions) break;
+                commands = &scripts[index % scripts.size()];
+            }
+            else
+            {
+                // Открытая модель нагрузки: сессия index начинается в start + index / rate
+                if (options.rate > 0)
+                {
+                    auto offset = std::chrono::duration<double>(index / options.rate);
+                    if (offset.count() >= options.duration) break;
+                    scheduled = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(offset);
+                    std::this_thread::sleep_until(scheduled);
+                }
+                else if (std::chrono::steady_clock::now() - start >= std::chrono::duration<double>(options.duration))
+                {
+                    break;
+                }
+                generated = make_synthetic_session(gen, pool, options.steps);
+                commands = &generated;
+            }
+
+            checkout.maybe_checkpoint();
+            for (const SessionCommand& command : *commands)
+            {
+                scheduled = run_session_command(session, command, last_sign_up, stats[thread_index], scheduled);
+                if (command.op == SessionOp::SignUp && options.load)
+                {
+                    pool.push_back(last_sign_up);
+                }
+            }
+            session.sign_out();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < options.threads; ++i)
+    {
+        threads.emplace_back(worker, i);
+    }
+    worker(0);
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const AllocationCounter::Totals allocated = allocation_counter.totals() - allocated_before;
+
+    size_t command_count = 0;
+    for (size_t i = 1; i < stats.size(); ++i)
+    {
+        stats[0].merge(stats[i]);
+    }
+    for (const std::vector<double>& samples : stats[0].latencies)
+    {
+        command_count += samples.size();
+    }
+    print_session_report(stats[0], seconds);
+    std::cout << "pmr allocations: " << allocated.allocations << " (" << allocated.bytes << " bytes), "
+        << static_cast<double>(allocated.allocations) / std::max<size_t>(command_count, 1) << " per command\n";
+
+    checkout.checkpoint();
+    return 0;
+}
+
+// Команда в виде строки сценария (и запроса серверу)
+static std::string session_command_line(const SessionCommand& command)
+{
+    std::ostringstream line;
+    line << std::setprecision(17) << SESSION_OP_NAMES[static_cast<size_t>(command.op)];
+    switch (command.op)
+    {
+    case SessionOp::SignUp:
+        line << " " << command.amount << " " << command.text;
+        break;
+    case SessionOp::SignIn:
+        if (command.user_id != 0)
+        {
+            line << " " << command.user_id;
+        }
+        else
+        {
+            line << " $";
+        }
+        break;
+    case SessionOp::Purchase:
+    case SessionOp::Search:
+        line << " " << command.text;
+        break;
+    case SessionOp::TopUp:
+        line << " " << command.amount;
+        break;
+    default:
+        break;
+    }
+    return line.str();
+}
+
+// Ответ сервера на команду - одна строка: "OK" или "ERR\t<причина>", дальше поля через табуляцию.
+//   signup -> OK <id> или ERR sign-up-failed, signin -> OK <имя>, view -> OK <n> (<название> <цена>) x n,
+//   buy и topup -> OK <баланс> или ERR insufficient-funds <баланс>,
+//   search -> OK <n> (<название> <компания> <цена>) x n, лучшие совпадения первыми,
+//   sales -> OK <покупок> <выручка> <средняя скидка> <n> (<название> <продано за 24 ч>) x n,
+//   stats -> OK <n> (<операция> <вызовов> <ошибок> <замеров> <p50> <p99> <max>) x n, задержки в нс
+static std::string session_response(StoreSession& session, const SessionCommand& command, int& last_sign_up)
+{
+    char number[32];
+    auto balance_reply = [&](const CheckoutResult& result) -> std::string {
+        std::snprintf(number, sizeof(number), "%.15g", result.balance);
+        switch (result.status)
+        {
+        case CheckoutStatus::Ok:
+            return std::string("OK\t") + number;
+        case CheckoutStatus::UnknownUser:
+            return "ERR\tnot-signed-in";
+        case CheckoutStatus::UnknownProduct:
+            return "ERR\tunknown-product";
+        case CheckoutStatus::InsufficientFunds:
+            return std::string("ERR\tinsufficient-funds\t") + number;
+        default:
+            return "ERR\tinvalid-amount";
+        }
+    };
+
+    switch (command.op)
+    {
+    case SessionOp::SignUp:
+        last_sign_up = session.sign_up(command.text, command.amount);
+        if (last_sign_up == 0)
+        {
+            return "ERR\tsign-up-failed"; // ID пользователей кончились
+        }
+        return "OK\t" + std::to_string(last_sign_up);
+    case SessionOp::SignIn:
+    {
+        std::string full_name;
+        if (!session.sign_in(command.user_id != 0 ? command.user_id : last_sign_up, &full_name))
+        {
+            return "ERR\tunknown-user";
+        }
+        return "OK\t" + full_name;
+    }
+    case SessionOp::View:
+    {
+        std::vector<PurchaseRecord> history;
+        if (!session.view(history))
+        {
+            return "ERR\tnot-signed-in";
+        }
+        std::string reply = "OK\t" + std::to_string(history.size());
+        for (const PurchaseRecord& record : history)
+        {
+            const Product* product = catalog.find_by_id(record.product_id);
+            std::snprintf(number, sizeof(number), "%.15g", record.price);
+            reply += "\t";
+            reply += product ? product->getTitle() : "?";
+            reply += "\t";
+            reply += number;
+        }
+        return reply;
+    }
+    case SessionOp::Purchase:
+        return balance_reply(session.purchase(command.text));
+    case SessionOp::TopUp:
+        return balance_reply(session.top_up(command.amount));
+    case SessionOp::Search:
+    {
+        std::vector<uint32_t> found = session.search(command.text);
+        std::string reply = "OK\t" + std::to_string(found.size());
+        for (uint32_t id : found)
+        {
+            const Product* product = catalog.find_by_id(id);
+            std::snprintf(number, sizeof(number), "%.15g", product->current_price());
+            reply += "\t";
+            reply += product->getTitle();
+            reply += "\t";
+            reply += product->getCompany();
+            reply += "\t";
+            reply += number;
+        }
+        return reply;
+    }
+    case SessionOp::Sales:
+    {
+        ensure_sales_analytics();
+        sales_feed.catch_up(); // отчёт видит покупки, сделанные до запроса
+        std::vector<SalesRank> top = sales.top_sellers(1, SEARCH_RESULTS);
+        std::snprintf(number, sizeof(number), "%.15g", sales.total_revenue());
+        std::string reply = "OK\t" + std::to_string(sales.purchase_count()) + "\t" + number;
+        std::snprintf(number, sizeof(number), "%.6g", sales.average_discount());
+        reply += "\t";
+        reply += number;
+        reply += "\t" + std::to_string(top.size());
+        for (const SalesRank& rank : top)
+        {
+            const Product* product = catalog.find_by_id(rank.product_id);
+            reply += "\t";
+            reply += product ? product->getTitle() : "?";
+            reply += "\t" + std::to_string(rank.units);
+        }
+        return reply;
+    }
+    case SessionOp::Stats:
+    {
+        std::vector<OperationSummary> operations = metrics_summary();
+        std::string reply = "OK\t" + std::to_string(operations.size());
+        for (size_t op = 0; op < operations.size(); ++op)
+        {
+            const OperationSummary& summary = operations[op];
+            reply += "\t";
+            reply += METRIC_OP_NAMES[op];
+            for (uint64_t value : { summary.calls, summary.failures, summary.samples, summary.percentile(0.50),
+                summary.percentile(0.99), summary.max_ns })
+            {
+                reply += "\t" + std::to_string(value);
+            }
+        }
+        return reply;
+    }
+    default:
+        session.sign_out();
+        return "OK";
+    }
+}
+
+// Пул потоков для блокирующей работы: запросы сервера, fsync журнала, снимки
+class WorkerPool
+{
+private:
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::function<void()>> jobs;
+    std::vector<std::thread> threads;
+    bool stopping = false;
+
+    void loop()
+    {
+        for (;;)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [&] { return stopping || !jobs.empty(); });
+                if (jobs.empty())
+                {
+                    return;
+                }
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job();
+        }
+    }
+
+public:
+    explicit WorkerPool(size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            threads.emplace_back(&WorkerPool::loop, this);
+        }
+    }
+
+    ~WorkerPool()
+    {
+        stop();
+    }
+
+    void post(std::function<void()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(std::move(job));
+        }
+        ready.notify_one();
+    }
+
+    // Выполняет уже поставленные задачи и останавливает потоки
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        ready.notify_all();
+        for (std::thread& thread : threads)
+        {
+            if (thread.joinable()) thread.join();
+        }
+    }
+};
+
+// Память кадров сопрограмм одной сессии. Кадры вложены (user_menu вызывается из
+// main_menu_session) и освобождаются в обратном порядке, поэтому это стек в буфере
+// контекста сессии: кадр берётся и возвращается сдвигом вершины, без malloc.
+// Что не поместилось в буфер, берётся у upstream.
+class SessionArena : public std::pmr::memory_resource
+{
+private:
+    static const size_t CAPACITY = 2048; // main_menu_session и user_menu вместе с заголовками
+    static const size_t ALIGNMENT = alignof(std::max_align_t);
+
+    alignas(std::max_align_t) unsigned char buffer[CAPACITY];
+    size_t top = 0;
+
+    static size_t rounded(size_t size)
+    {
+        return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    }
+
+    void* do_allocate(size_t size, size_t alignment) override
+    {
+        if (alignment <= ALIGNMENT && rounded(size) <= CAPACITY - top)
+        {
+            void* block = buffer + top;
+            top += rounded(size);
+            return block;
+        }
+        return allocation_counter.allocate(size, alignment);
+    }
+
+    void do_deallocate(void* block, size_t size, size_t alignment) override
+    {
+        unsigned char* bytes = static_cast<unsigned char*>(block);
+        if (bytes < buffer || bytes >= buffer + CAPACITY)
+        {
+            allocation_counter.deallocate(block, size, alignment);
+        }
+        else if (bytes + rounded(size) == buffer + top)
+        {
+            top = static_cast<size_t>(bytes - buffer);
+        }
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+struct SessionContext;
+static std::pmr::memory_resource* session_memory(SessionContext& context);
+
+// Сессия меню - сопрограмма C++20. Пока покупатель думает, от сессии остаётся только
+// кадр сопрограммы (сотни байт в памяти сессии), а не поток со стеком, поэтому один
+// поток держит десятки тысяч открытых сессий. SessionTask запускается лениво: сессия
+// верхнего уровня - start(), вложенное меню - co_await.
+class SessionTask
+{
+public:
+    struct promise_type
+    {
+        std::coroutine_handle<> continuation; // кто ждёт завершения
+        std::exception_ptr error;
+
+        // Учёт кадров для отчёта стенда
+        static inline std::atomic<size_t> live_frames{ 0 };
+        static inline std::atomic<size_t> live_bytes{ 0 };
+
+        // Перед кадром хранится ресурс, которому кадр надо вернуть
+        static const size_t FRAME_HEADER = alignof(std::max_align_t);
+
+        static void* allocate_frame(size_t size, std::pmr::memory_resource* memory)
+        {
+            ++live_frames;
+            live_bytes += size;
+            unsigned char* block = static_cast<unsigned char*>(memory->allocate(size + FRAME_HEADER));
+            std::memcpy(block, &memory, sizeof(memory));
+            return block + FRAME_HEADER;
+        }
+
+        static void* operator new(size_t size)
+        {
+            return allocate_frame(size, std::pmr::get_default_resource());
+        }
+
+        // Сопрограммы меню получают контекст первым аргументом: кадр - в памяти сессии
+        template <typename... Args>
+        static void* operator new(size_t size, SessionContext& context, const Args&...)
+        {
+            return allocate_frame(size, session_memory(context));
+        }
+
+        static void operator delete(void* frame, size_t size)
+        {
+            --live_frames;
+            live_bytes -= size;
+            unsigned char* block = static_cast<unsigned char*>(frame) - FRAME_HEADER;
+            std::pmr::memory_resource* memory;
+            std::memcpy(&memory, block, sizeof(memory));
+            memory->deallocate(block, size + FRAME_HEADER);
+        }
+
+        struct FinalAwaiter
+        {
+            bool await_ready() const noexcept { return false; }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> self) noexcept
+            {
+                std::coroutine_handle<> next = self.promise().continuation;
+                return next ? next : std::noop_coroutine();
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        SessionTask get_return_object()
+        {
+            return SessionTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        FinalAwaiter final_suspend() const noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    SessionTask(SessionTask&& other) noexcept : handle(std::exchange(other.handle, {})) {}
+    SessionTask(const SessionTask&) = delete;
+    SessionTask& operator=(const SessionTask&) = delete;
+
+    ~SessionTask()
+    {
+        if (handle) handle.destroy(); // вложенные сопрограммы живут в кадре и уничтожаются с ним
+    }
+
+    void start()
+    {
+        handle.resume();
+    }
+
+    bool done() const
+    {
+        return handle.done();
+    }
+
+    // Исключение, которым завершилась сессия верхнего уровня
+    void rethrow() const
+    {
+        if (handle.done() && handle.promise().error) std::rethrow_exception(handle.promise().error);
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+
+    void await_resume() const
+    {
+        rethrow();
+    }
+
+private:
+    std::coroutine_handle<promise_type> handle;
+
+    explicit SessionTask(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+};
+
+// Где продолжаются сессии. Подменяется под консоль, стенд и сервер.
+class SessionExecutor
+{
+public:
+    virtual ~SessionExecutor() = default;
+
+    // Продолжить сессию в потоке исполнителя
+    virtual void schedule(std::coroutine_handle<> session) = 0;
+
+    // Выполнить блокирующую работу и потом продолжить сессию.
+    // false - работа уже выполнена на месте, сессия не приостанавливалась.
+    virtual bool offload(std::function<void()> work, std::coroutine_handle<> session) = 0;
+};
+
+// Всё в вызывающем потоке: консоль
+class InlineExecutor : public SessionExecutor
+{
+public:
+    void schedule(std::coroutine_handle<> session) override
+    {
+        session.resume();
+    }
+
+    bool offload(std::function<void()> work, std::coroutine_handle<>) override
+    {
+        work();
+        return false;
+    }
+};
+
+// Сессии продолжает один поток-владелец в run_ready(); блокирующая работа идёт в пуле,
+// wake() сообщает владельцу, что есть готовые сессии (владелец может спать в epoll_wait)
+class QueueExecutor : public SessionExecutor
+{
+private:
+    WorkerPool& pool;
+    std::function<void()> wake;
+    std::mutex mutex;
+    std::vector<std::coroutine_handle<>> ready;
+
+public:
+    QueueExecutor(WorkerPool& pool, std::function<void()> wake) : pool(pool), wake(std::move(wake)) {}
+
+    void schedule(std::coroutine_handle<> session) override
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ready.push_back(session);
+        }
+        wake();
+    }
+
+    bool offload(std::function<void()> work, std::coroutine_handle<> session) override
+    {
+        pool.post([this, work = std::move(work), session] {
+            work();
+            schedule(session);
+        });
+        return true;
+    }
+
+    // Продолжает готовые сессии, пока они есть; возвращает число продолжений
+    size_t run_ready()
+    {
+        size_t resumed = 0;
+        std::vector<std::coroutine_handle<>> batch;
+        for (;;)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                batch.swap(ready);
+            }
+            if (batch.empty())
+            {
+                return resumed;
+            }
+            for (std::coroutine_handle<> session : batch)
+            {
+                session.resume();
+            }
+            resumed += batch.size();
+            batch.clear();
+        }
+    }
+};
+
+// Ввод и вывод сессии
+class SessionChannel
+{
+public:
+    virtual ~SessionChannel() = default;
+
+    virtual void write(const std::string& text) = 0;
+
+    // Следующая строка ввода, если она уже есть. Иначе false, а closed - ввода больше не будет.
+    virtual bool try_read_line(std::string& line, bool& closed) = 0;
+
+    // Продолжить сессию через исполнитель, когда придёт строка или ввод закончится
+    virtual void wait_input(std::coroutine_handle<> session) = 0;
+};
+
+// Консоль: чтение блокирует поток, сессия не приостанавливается
+class ConsoleChannel : public SessionChannel
+{
+public:
+    void write(const std::string& text) override
+    {
+        std::cout << text << std::flush;
+    }
+
+    bool try_read_line(std::string& line, bool& closed) override
+    {
+        if (!std::getline(std::cin, line))
+        {
+            closed = true;
+            return false;
+        }
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+        return true;
+    }
+
+    void wait_input(std::coroutine_handle<> session) override
+    {
+        session.resume(); // не вызывается: try_read_line всегда отвечает сразу
+    }
+};
+
+// Строки в памяти: ввод подаёт владелец (сервер, стенд) в потоке исполнителя,
+// вывод он же забирает из output
+class LineChannel : public SessionChannel
+{
+private:
+    SessionExecutor& executor;
+    std::deque<std::string> input;
+    std::coroutine_handle<> waiter;
+    bool finished = false;
+
+    void wake()
+    {
+        if (waiter)
+        {
+            executor.schedule(std::exchange(waiter, {}));
+        }
+    }
+
+public:
+    std::string output;
+    std::function<void()> on_output; // вызывается, когда пустой output пополняется
+
+    explicit LineChannel(SessionExecutor& executor) : executor(executor) {}
+
+    void push_line(std::string line)
+    {
+        input.push_back(std::move(line));
+        wake();
+    }
+
+    void close()
+    {
+        finished = true;
+        wake();
+    }
+
+    void write(const std::string& text) override
+    {
+        if (output.empty() && on_output)
+        {
+            on_output();
+        }
+        output += text;
+    }
+
+    bool try_read_line(std::string& line, bool& closed) override
+    {
+        if (input.empty())
+        {
+            closed = finished;
+            return false;
+        }
+        line = std::move(input.front());
+        input.pop_front();
+        return true;
+    }
+
+    void wait_input(std::coroutine_handle<> session) override
+    {
+        waiter = session;
+    }
+};
+
+struct SessionContext
+{
+    SessionChannel& channel;
+    SessionExecutor& executor;
+    int pending_io = 0; // работа в пуле ещё не вернулась: кадр сессии нельзя уничтожать
+    SessionArena frames; // кадры сопрограмм сессии; контекст переживает задачу сессии
+
+    SessionContext(SessionChannel& channel, SessionExecutor& executor)
+        : channel(channel), executor(executor) {}
+};
+
+static std::pmr::memory_resource* session_memory(SessionContext& context)
+{
+    return &context.frames;
+}
+
+// co_await ReadLine{ context, line } - false, если ввод закончился.
+// Строка пишется в переменную сессии: результат co_await - только bool.
+struct ReadLine
+{
+    SessionContext& context;
+    std::string& line;
+    bool got = false;
+    bool closed = false;
+
+    bool await_ready()
+    {
+        got = context.channel.try_read_line(line, closed);
+        return got || closed;
+    }
+
+    void await_suspend(std::coroutine_handle<> session)
+    {
+        context.channel.wait_input(session);
+    }
+
+    bool await_resume()
+    {
+        if (!got && !closed)
+        {
+            got = context.channel.try_read_line(line, closed);
+        }
+        return got;
+    }
+};
+
+// co_await Persist{ context, work } - блокирующая запись (fsync журнала) вне потока сессий
+struct Persist
+{
+    SessionContext& context;
+    std::function<void()> work;
+    bool suspended = false;
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> session)
+    {
+        ++context.pending_io;
+        suspended = context.executor.offload(std::move(work), session);
+        if (!suspended)
+        {
+            --context.pending_io;
+        }
+        return suspended;
+    }
+
+    void await_resume()
+    {
+        if (suspended)
+        {
+            --context.pending_io;
+        }
+    }
+};
+
+// Первое слово строки как число, как читал std::cin >> value
+template <typename T>
+static bool parse_input(const std::string& line, T& value)
+{
+    std::istringstream fields(line);
+    return static_cast<bool>(fields >> value);
+}
+
+// Покупки пользователя - пункт "View products"
+static std::string describe_purchases(int user_id)
+{
+    std::ostringstream text;
+    bool found = checkout.with_user(user_id, [&](UserRef user)
+        {
+            text << "User: " << user.full_name() << std::endl;
+            text << "Discount: " << user.discount() * 100 << "%" << std::endl;
+            text << "Purchased products:" << std::endl;
+            if (user.purchased_products().empty())
+            {
+                text << "No products purchased." << std::endl;
+            }
+            else
+            {
+                for (const PurchaseRecord& record : user.purchased_products())
+                {
+                    const Product* product = catalog.find_by_id(record.product_id); // Название и компания берутся из каталога
+                    text << "Company: " << (product ? product->getCompany() : "?") << std::endl;
+                    text << "Title: " << (product ? product->getTitle() : "?") << std::endl;
+                    text << "Price: " << record.price << std::endl;
+                    text << "-------------------------" << std::endl;
+                }
+            }
+        });
+
+    if (!found)
+    {
+        text << "User not found.\n";
+    }
+    return text.str();
+}
+
+static SessionTask user_menu(SessionContext& context, int user_id)
+{
+    SessionChannel& out = context.channel;
+    std::string input;
+    while (true)
+    {
+        if (checkpointer.due())
+        {
+            checkpoint_thread.request(); // Фоновая контрольная точка, если журнал вырос
+        }
+
+        out.write("-------------Hypermarket------------\n"
+            "1. View products\n"
+            "2. Purchase product\n"
+            "3. Top up your account\n"
+            "4. Exit\n"
+            "Enter your choice: \n");
+
+        if (!co_await ReadLine{ context, input })
+        {
+            co_return;
+        }
+        int choice = 0;
+        parse_input(input, choice);
+
+        switch (choice)
+        {
+        case 1:
+            recorder.command(SessionOp::View);
+            out.write(describe_purchases(user_id));
+            break;
+        case 2:
+        {
+            out.write("Enter the title of the product you want to purchase: ");
+            if (!co_await ReadLine{ context, input })
+            {
+                co_return;
+            }
+
+            // Поиск товара и пользователя, списание и запись в журнал выполняет CheckoutService
+            CheckoutResult result = checkout.purchase(user_id, input);
+            recorder.command(SessionOp::Purchase, input);
+
+            switch (result.status)
+            {
+            case CheckoutStatus::Ok:
+                out.write("Purchase successful!\n");
+                break;
+            case CheckoutStatus::UnknownProduct:
+            {
+                // Название введено не полностью или с опечаткой: подсказываем похожие товары
+                std::string text = "Product not found.\n";
+                std::vector<uint32_t> similar = checkout.search(input, 3);
+                if (!similar.empty())
+                {
+                    text += "Did you mean:\n";
+                    for (uint32_t id : similar)
+                    {
+                        const Product* product = catalog.find_by_id(id);
+                        text += "  " + product->getTitle() + " (" + product->getCompany() + ")\n";
+                    }
+                }
+                out.write(text);
+                break;
+            }
+            case CheckoutStatus::UnknownUser:
+                out.write("User not found.\n");
+                break;
+            default:
+                out.write("Insufficient funds.\n");
+                break;
+            }
+            break;
+        }
+        case 3:
+        {
+            out.write("Enter the amount you wish to add to the balance: ");
+            double amount;
+            for (;;)
+            {
+                if (!co_await ReadLine{ context, input })
+                {
+                    co_return;
+                }
+                if (parse_input(input, amount))
+                {
+                    break;
+                }
+                out.write("An incorrect value has been entered. Try again: ");
+            }
+
+            CheckoutResult result = checkout.top_up(user_id, amount);
+            std::ostringstream recorded_amount;
+            recorded_amount << std::setprecision(17) << amount;
+            recorder.command(SessionOp::TopUp, recorded_amount.str());
+            if (result.status == CheckoutStatus::InvalidAmount)
+            {
+                out.write("The amount cannot be negative. Please try again.\n");
+                break;
+            }
+            if (result.status == CheckoutStatus::UnknownUser)
+            {
+                out.write("User not found.\n");
+                break;
+            }
+
+            std::ostringstream text;
+            text << "Your balance has been successfully topped up. Current balance: " << result.balance << "\n";
+            out.write(text.str());
+            break;
+        }
+        case 4:
+            recorder.command(SessionOp::SignOut);
+            co_await Persist{ context, [] { journal.sync(); } };
+            co_return; // выход в главное меню
+        default:
+            out.write("Invalid choice.\n");
+            break;
+        }
+    }
+}
+
+// Главное меню: регистрация и вход. Выход (или конец ввода) завершает сессию;
+// снимок базы при выходе из программы пишет тот, кто сессию запустил.
+static SessionTask main_menu_session(SessionContext& context)
+{
+    SessionChannel& out = context.channel;
+    std::string input;
+    std::string full_name;
+    while (true)
+    {
+        if (checkpointer.due())
+        {
+            checkpoint_thread.request();
+        }
+
+        out.write("1. Sign up\n"
+            "2. Sign in\n"
+            "3. Exit\n"
+            "4. Operation statistics\n"
+            "Enter your choice: \n");
+
+        if (!co_await ReadLine{ context, input })
+        {
+            co_return;
+        }
+        int choice = 0;
+        parse_input(input, choice);
+
+        switch (choice)
+        {
+        case 1:
+        {
+            out.write("Enter your full name: ");
+            if (!co_await ReadLine{ context, full_name })
+            {
+                co_return;
+            }
+
+            out.write("Enter the initial amount of money: ");
+            double initial_balance;
+            for (;;)
+            {
+                if (!co_await ReadLine{ context, input })
+                {
+                    co_return;
+                }
+                if (parse_input(input, initial_balance))
+                {
+                    break;
+                }
+                out.write("An incorrect value has been entered. Try again: ");
+            }
+
+            int user_id = checkout.sign_up(full_name, initial_balance); // Регистрация и запись в журнал
+            if (user_id == 0)
+            {
+                out.write("Sign-up failed: no user IDs are left.\n");
+                break;
+            }
+            recorder.sign_up(user_id, initial_balance, full_name);
+            out.write("You have successfully signed up! Your user ID is " + std::to_string(user_id) + "\n");
+            break;
+        }
+        case 2:
+        {
+            out.write("Enter your user ID: ");
+            if (!co_await ReadLine{ context, input })
+            {
+                co_return;
+            }
+            int user_id = 0;
+            parse_input(input, user_id);
+
+            if (!checkout.with_user(user_id, [&](UserRef user) { full_name = user.full_name(); }))
+            {
+                out.write("User not found.\n");
+            }
+            else
+            {
+                out.write("Welcome back, " + full_name + "!\n");
+                recorder.sign_in(user_id);
+                co_await user_menu(context, user_id);
+            }
+            break;
+        }
+        case 3:
+            co_return; // выход из программы
+        case 4:
+            out.write(format_metrics_report());
+            break;
+        default:
+            out.write("Invalid choice.\n");
+            break;
+        }
+    }
+}
+
+// Консоль: та же сессия с InlineExecutor, чтение блокирует поток
+void main_menu()
+{
+    open_store(); // Загрузка пользователей из файла перед началом работы программы
+
+    ConsoleChannel console;
+    InlineExecutor executor;
+    SessionContext context{ console, executor };
+    SessionTask session = main_menu_session(context);
+    session.start(); // с консолью сессия не приостанавливается и здесь уже завершена
+    session.rethrow();
+
+    checkout.checkpoint();
+}
+
+// Стенд: try5 --menu-sessions=N. N сессий меню в одном потоке: все открываются и ждут
+// ввода, потом по кругу получают по строке - регистрация, вход, покупка, пополнение,
+// просмотр, выход. $ в вводе - ID, который сессия выдала при регистрации.
+static int run_menu_sessions(size_t count)
+{
+    static const char* const KEYSTROKES[] = {
+        "1", "Harness User", "1000", "2", "$", "2", "Product 1", "3", "50", "1", "4", "3"
+    };
+
+    open_store();
+    WorkerPool pool(2);
+    std::mutex mutex;
+    std::condition_variable woken;
+    bool pending = false;
+    QueueExecutor executor(pool, [&] {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending = true;
+        woken.notify_one();
+    });
+
+    struct HarnessSession
+    {
+        LineChannel channel;
+        SessionContext context;
+        SessionTask task;
+
+        explicit HarnessSession(SessionExecutor& executor)
+            : channel(executor), context{ channel, executor }, task(main_menu_session(context)) {}
+    };
+
+    // Продолжает сессии, пока не останется ни готовых, ни ждущих пула
+    std::vector<std::unique_ptr<HarnessSession>> sessions;
+    auto drain = [&] {
+        for (;;)
+        {
+            executor.run_ready();
+            bool waiting = false;
+            for (const auto& session : sessions)
+            {
+                waiting = waiting || session->context.pending_io > 0;
+            }
+            if (!waiting)
+            {
+                return;
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            woken.wait(lock, [&] { return pending; });
+            pending = false;
+        }
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+    sessions.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        sessions.push_back(std::make_unique<HarnessSession>(executor));
+        sessions.back()->task.start();
+    }
+    drain();
+    size_t idle_frames = SessionTask::promise_type::live_frames;
+    size_t idle_bytes = SessionTask::promise_type::live_bytes;
+
+    std::vector<std::string> user_ids(count);
+    size_t inputs = 0;
+    const AllocationCounter::Totals allocated_before = allocation_counter.totals();
+    for (const char* keystroke : KEYSTROKES)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            LineChannel& channel = sessions[i]->channel;
+            size_t position = channel.output.find("Your user ID is ");
+            if (user_ids[i].empty() && position != std::string::npos)
+            {
+                user_ids[i] = channel.output.substr(position + 16, channel.output.find('\n', position) - position - 16);
+            }
+            channel.output.clear();
+            channel.push_line(keystroke[0] == '$' ? user_ids[i] : keystroke);
+            ++inputs;
+        }
+        drain();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const AllocationCounter::Totals allocated = allocation_counter.totals() - allocated_before;
+
+    size_t finished = 0;
+    for (const auto& session : sessions)
+    {
+        finished += session->task.done();
+        session->task.rethrow();
+    }
+    std::cout << "Idle sessions: " << count << ", " << idle_frames << " coroutine frames, "
+        << (count ? idle_bytes / count : 0) << " bytes per session\n";
+    std::cout << "Menu inputs: " << inputs << " in " << seconds << " s (" << inputs / seconds << " per second)\n";
+    std::cout << "pmr allocations: " << static_cast<double>(allocated.allocations) / inputs << " per input, "
+        << static_cast<double>(allocated.bytes) / inputs << " bytes per input\n";
+    std::cout << "Completed sessions: " << finished << " of " << count << "\n";
+
+    sessions.clear();
+    pool.stop();
+    checkout.checkpoint();
+    return finished == count ? 0 : 1;
+}
+
+#ifdef __linux__
+// Адрес сервера: unix:<путь к сокету> или tcp:<порт> (только 127.0.0.1)
+static bool parse_socket_address(const std::string& address, sockaddr_storage& storage, socklen_t& length)
+{
+    std::memset(&storage, 0, sizeof(storage));
+    if (address.rfind("unix:", 0) == 0)
+    {
+        sockaddr_un* un = reinterpret_cast<sockaddr_un*>(&storage);
+        std::string path = address.substr(5);
+        if (path.empty() || path.size() >= sizeof(un->sun_path))
+        {
+            return false;
+        }
+        un->sun_family = AF_UNIX;
+        std::memcpy(un->sun_path, path.c_str(), path.size() + 1);
+        length = static_cast<socklen_t>(sizeof(sockaddr_un));
+        return true;
+    }
+    if (address.rfind("tcp:", 0) == 0)
+    {
+        sockaddr_in* in = reinterpret_cast<sockaddr_in*>(&storage);
+        char* end = nullptr;
+        long port = std::strtol(address.c_str() + 4, &end, 10);
+        if (*end != '\0' || port <= 0 || port > 65535)
+        {
+            return false;
+        }
+        in->sin_family = AF_INET;
+        in->sin_port = htons(static_cast<uint16_t>(port));
+        in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        length = static_cast<socklen_t>(sizeof(sockaddr_in));
+        return true;
+    }
+    return false;
+}
+
+// Тысячам соединений не хватает стандартного ограничения в 1024 дескриптора
+static void raise_descriptor_limit()
+{
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+// Сервер сессий покупателей: try5 --serve=unix:<путь>|tcp:<порт> [--workers=N].
+// Протокол строковый: запрос - команда сценария сессии, ответ - строка session_response.
+// Один поток с epoll принимает соединения и читает запросы, операции выполняет пул
+// рабочих потоков. У соединения в работе не больше одного запроса, поэтому ответы
+// идут в порядке запросов и StoreSession соединения трогает один поток.
+// С --serve-menu=<адрес> каждому соединению вместо протокола достаётся консольное меню:
+// сессии-сопрограммы продолжает поток epoll, fsync и снимки уходят в пул.
+// SIGINT или SIGTERM останавливают сервер с записью снимка.
+class SessionServer
+{
+public:
+    // Сигналы остановки. main блокирует их до запуска первого потока: потоки наследуют
+    // маску, и иначе сигнал мог достаться потоку без signalfd и убить процесс.
+    static sigset_t stop_signals()
+    {
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        return signals;
+    }
+
+private:
+    static const size_t MAX_REQUEST = 4096;  // длиннее - разрыв соединения
+    static const size_t MAX_PENDING = 65536; // неотправленных ответов больше - запросы ждут
+    static const size_t MAX_UNREAD = 65536;   // непринятых запросов больше - сокет не читается
+    static const uint64_t LISTEN_TAG = 0;
+    static const uint64_t WAKE_TAG = UINT64_MAX;
+    static const uint64_t SIGNAL_TAG = UINT64_MAX - 1;
+
+    struct MenuSession
+    {
+        LineChannel channel;
+        SessionContext context;
+        SessionTask task;
+
+        explicit MenuSession(SessionExecutor& executor)
+            : channel(executor), context{ channel, executor }, task(main_menu_session(context)) {}
+    };
+
+    struct Connection
+    {
+        int fd;
+        std::string input;
+        std::string output;
+        bool busy = false;     // запрос у рабочего потока
+        bool closing = false;  // соединение разорвано, ждём рабочий поток
+        bool eof = false;      // клиент закончил передачу, осталось ответить
+        uint32_t interest = EPOLLIN | EPOLLRDHUP;
+        StoreSession session{ checkout };
+        int last_sign_up = 0;
+        std::unique_ptr<MenuSession> menu; // только в режиме --serve-menu
+
+        explicit Connection(int fd) : fd(fd) {}
+    };
+
+
+    struct Reply
+    {
+        uint64_t id;
+        std::string response;
+    };
+
+    std::string address;
+    bool menu_mode;
+    int listen_fd = -1;
+    int epoll_fd = -1;
+    int wake_fd = -1;
+    int signal_fd = -1;
+
+    // Пул и исполнитель объявлены раньше соединений: кадры сессий уничтожаются первыми
+    std::unique_ptr<WorkerPool> pool;
+    std::unique_ptr<QueueExecutor> executor;
+    std::unordered_map<uint64_t, std::unique_ptr<Connection>> connections; // только поток epoll
+    uint64_t next_id = 1;
+    std::vector<uint64_t> menu_dirty;   // сессии меню с новым вводом или выводом
+    std::vector<uint64_t> menu_closing; // разорванные сессии меню, ждущие пул
+
+    std::mutex reply_mutex;
+    std::vector<Reply> replies;
+
+    void wake()
+    {
+        uint64_t one = 1;
+        ssize_t written = ::write(wake_fd, &one, sizeof(one));
+        (void)written; // переполнение счётчика eventfd невозможно
+    }
+
+    void execute(uint64_t id, Connection* connection, const std::string& request)
+    {
+        SessionCommand command;
+        std::string response = parse_session_command(request, command)
+            ? session_response(connection->session, command, connection->last_sign_up)
+            : "ERR\tbad-request";
+        {
+            std::lock_guard<std::mutex> lock(reply_mutex);
+            replies.push_back({ id, std::move(response) });
+        }
+        wake();
+    }
+
+    void watch(int fd, uint32_t events, uint64_t tag, int operation)
+    {
+        epoll_event event{};
+        event.events = events;
+        event.data.u64 = tag;
+        epoll_ctl(epoll_fd, operation, fd, &event);
+    }
+
+    void close_connection(uint64_t id)
+    {
+        auto it = connections.find(id);
+        Connection& connection = *it->second;
+        if (connection.menu)
+        {
+            // Кадр сессии может ждать в очереди исполнителя или в пуле: закроем в pump_menus
+            if (!connection.closing)
+            {
+                connection.closing = true;
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection.fd, nullptr);
+                menu_closing.push_back(id);
+            }
+            return;
+        }
+        if (connection.busy)
+        {
+            connection.closing = true; // закроем, когда рабочий поток вернёт ответ
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection.fd, nullptr);
+            return;
+        }
+        connection.session.sign_out();
+        ::close(connection.fd);
+        connections.erase(it);
+    }
+
+    // Отправляет накопленные ответы; false, если соединение пора закрыть
+    bool flush(uint64_t id, Connection& connection)
+    {
+        while (!connection.output.empty())
+        {
+            ssize_t sent = ::send(connection.fd, connection.output.data(), connection.output.size(), MSG_NOSIGNAL);
+            if (sent < 0)
+            {
+                if (errno == EINTR) continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+                break;
+            }
+            connection.output.erase(0, static_cast<size_t>(sent));
+        }
+        update_interest(id, connection);
+        return true;
+    }
+
+    // Клиент, который шлёт запросы и не читает ответы, упирается в MAX_PENDING и MAX_UNREAD:
+    // пока запрос в работе или буфер полон, сокет не читается и данные ждут в ядре
+    bool reading_paused(const Connection& connection) const
+    {
+        return connection.busy || connection.output.size() >= MAX_PENDING || connection.input.size() >= MAX_UNREAD;
+    }
+
+    void update_interest(uint64_t id, Connection& connection)
+    {
+        uint32_t interest = (connection.eof || reading_paused(connection) ? 0u : EPOLLIN | EPOLLRDHUP) |
+            (connection.output.empty() ? 0u : EPOLLOUT);
+        if (interest != connection.interest)
+        {
+            connection.interest = interest;
+            watch(connection.fd, interest, id, EPOLL_CTL_MOD);
+        }
+    }
+
+    // Клиент, закрывший передачу, получает все ответы, потом соединение закрывается.
+    // Сессия меню заканчивается сама (Exit или конец ввода).
+    bool finished(const Connection& connection) const
+    {
+        if (connection.menu)
+        {
+            return connection.menu->task.done() && connection.output.empty();
+        }
+        return connection.eof && !connection.busy && connection.output.empty() &&
+            connection.input.find('\n') == std::string::npos;
+    }
+
+    // Передаёт рабочим потокам следующую полную строку запроса; false - запрос слишком длинный
+    bool dispatch(uint64_t id, Connection& connection)
+    {
+        while (!connection.busy && connection.output.size() < MAX_PENDING)
+        {
+            size_t end = connection.input.find('\n');
+            if (end == std::string::npos ? connection.input.size() > MAX_REQUEST : end > MAX_REQUEST)
+            {
+                return false;
+            }
+            if (end == std::string::npos)
+            {
+                break;
+            }
+            std::string request = connection.input.substr(0, end);
+            connection.input.erase(0, end + 1);
+            if (!request.empty() && request.back() == '\r')
+            {
+                request.pop_back();
+            }
+            if (connection.menu)
+            {
+                connection.menu->channel.push_line(std::move(request)); // ввод меню, как с консоли
+                menu_dirty.push_back(id);
+                continue;
+            }
+            if (request.find_first_not_of(" \t") == std::string::npos)
+            {
+                continue; // пустые строки пропускаются, как в сценариях
+            }
+
+            connection.busy = true;
+            Connection* target = &connection;
+            pool->post([this, id, target, request = std::move(request)] { execute(id, target, request); });
+        }
+        if (!connection.closing)
+        {
+            update_interest(id, connection);
+        }
+        return true;
+    }
+
+    // Продолжает готовые сессии меню, отправляет их вывод и закрывает завершённые
+    void pump_menus()
+    {
+        if (!menu_mode)
+        {
+            return;
+        }
+        executor->run_ready();
+        for (uint64_t id : std::exchange(menu_dirty, {}))
+        {
+            auto it = connections.find(id);
+            if (it == connections.end() || it->second->closing)
+            {
+                continue;
+            }
+            Connection& connection = *it->second;
+            connection.output += connection.menu->channel.output;
+            connection.menu->channel.output.clear();
+            if (!flush(id, connection) || finished(connection))
+            {
+                close_connection(id);
+            }
+        }
+
+        // После run_ready в очереди исполнителя остались только сессии, ждущие пул
+        for (size_t i = 0; i < menu_closing.size();)
+        {
+            auto it = connections.find(menu_closing[i]);
+            if (it->second->menu->context.pending_io > 0)
+            {
+                ++i;
+                continue;
+            }
+            ::close(it->second->fd);
+            connections.erase(it);
+            menu_closing[i] = menu_closing.back();
+            menu_closing.pop_back();
+        }
+    }
+
+    void accept_connections()
+    {
+        for (;;)
+        {
+            int fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0)
+            {
+                if (errno == EINTR) continue;
+                return; // EAGAIN или нехватка дескрипторов: попробуем при следующем событии
+            }
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // для unix-сокета просто не сработает
+            uint64_t id = next_id++;
+            Connection& connection = *connections.emplace(id, std::make_unique<Connection>(fd)).first->second;
+            watch(fd, EPOLLIN | EPOLLRDHUP, id, EPOLL_CTL_ADD);
+            if (menu_mode)
+            {
+                connection.menu = std::make_unique<MenuSession>(*executor);
+                connection.menu->channel.on_output = [this, id] { menu_dirty.push_back(id); };
+                connection.menu->task.start(); // печатает главное меню и ждёт ввода
+            }
+        }
+    }
+
+    void read_requests(uint64_t id, Connection& connection)
+    {
+        char buffer[16384];
+        while (connection.input.size() < MAX_UNREAD)
+        {
+            ssize_t received = ::recv(connection.fd, buffer, sizeof(buffer), 0);
+            if (received > 0)
+            {
+                connection.input.append(buffer, static_cast<size_t>(received));
+                continue;
+            }
+            if (received < 0 && errno == EINTR) continue;
+            if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            if (received < 0)
+            {
+                close_connection(id);
+                return;
+            }
+            connection.eof = true; // ответим на уже присланные запросы
+            update_interest(id, connection);
+            if (connection.menu)
+            {
+                connection.menu->channel.close();
+                menu_dirty.push_back(id);
+            }
+            break;
+        }
+        if (!dispatch(id, connection) || finished(connection))
+        {
+            close_connection(id);
+        }
+    }
+
+    void deliver_replies()
+    {
+        uint64_t count;
+        ssize_t drained = ::read(wake_fd, &count, sizeof(count));
+        (void)drained;
+
+        std::vector<Reply> ready;
+        {
+            std::lock_guard<std::mutex> lock(reply_mutex);
+            ready.swap(replies);
+        }
+        for (Reply& reply : ready)
+        {
+            auto it = connections.find(reply.id);
+            Connection& connection = *it->second;
+            connection.busy = false;
+            if (connection.closing)
+            {
+                close_connection(reply.id);
+                continue;
+            }
+            connection.output += reply.response;
+            connection.output += '\n';
+            if (!flush(reply.id, connection) || !dispatch(reply.id, connection) || finished(connection))
+            {
+                close_connection(reply.id);
+            }
+        }
+    }
+
+public:
+    SessionServer(std::string address, bool menu_mode) : address(std::move(address)), menu_mode(menu_mode) {}
+
+    ~SessionServer()
+    {
+        for (auto& pair : connections)
+        {
+            ::close(pair.second->fd);
+        }
+        for (int fd : { listen_fd, epoll_fd, wake_fd, signal_fd })
+        {
+            if (fd >= 0) ::close(fd);
+        }
+        if (address.rfind("unix:", 0) == 0 && listen_fd >= 0)
+        {
+            ::unlink(address.c_str() + 5);
+        }
+    }
+
+    int run(size_t worker_count)
+    {
+        sockaddr_storage storage;
+        socklen_t length;
+        if (!parse_socket_address(address, storage, length))
+        {
+            std::cerr << "Invalid server address " << address << " (expected unix:<path> or tcp:<port>).\n";
+            return 1;
+        }
+        raise_descriptor_limit();
+
+        listen_fd = ::socket(storage.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int one = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (storage.ss_family == AF_UNIX)
+        {
+            ::unlink(address.c_str() + 5); // сокет от прошлого запуска
+        }
+        if (listen_fd < 0 || ::bind(listen_fd, reinterpret_cast<sockaddr*>(&storage), length) != 0 ||
+            ::listen(listen_fd, SOMAXCONN) != 0)
+        {
+            std::cerr << "Failed to listen on " << address << ": " << std::strerror(errno) << "\n";
+            return 1;
+        }
+
+        // Сигналы остановки (заблокированы в main) читаются через signalfd
+        const sigset_t signals = stop_signals();
+        epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+        wake_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        signal_fd = ::signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+        watch(listen_fd, EPOLLIN, LISTEN_TAG, EPOLL_CTL_ADD);
+        watch(wake_fd, EPOLLIN, WAKE_TAG, EPOLL_CTL_ADD);
+        watch(signal_fd, EPOLLIN, SIGNAL_TAG, EPOLL_CTL_ADD);
+
+        pool = std::make_unique<WorkerPool>(worker_count);
+        executor = std::make_unique<QueueExecutor>(*pool, [this] { wake(); });
+        std::cout << "Serving " << (menu_mode ? "menus" : "requests") << " on " << address << " with " << worker_count << " workers." << std::endl;
+
+        std::vector<epoll_event> events(256);
+        bool running = true;
+        while (running)
+        {
+            int ready = ::epoll_wait(epoll_fd, events.data(), static_cast<int>(events.size()), 1000);
+            for (int i = 0; i < ready; ++i)
+            {
+                uint64_t tag = events[i].data.u64;
+                if (tag == LISTEN_TAG)
+                {
+                    accept_connections();
+                }
+                else if (tag == WAKE_TAG)
+                {
+                    deliver_replies();
+                }
+                else if (tag == SIGNAL_TAG)
+                {
+                    running = false;
+                }
+                else
+                {
+                    auto it = connections.find(tag);
+                    if (it == connections.end() || it->second->closing)
+                    {
+                        continue;
+                    }
+                    Connection& connection = *it->second;
+                    if ((events[i].events & EPOLLERR) || ((events[i].events & EPOLLHUP) && !connection.eof))
+                    {
+                        close_connection(tag);
+                        continue;
+                    }
+                    if ((events[i].events & EPOLLOUT) &&
+                        (!flush(tag, connection) || !dispatch(tag, connection) || finished(connection)))
+                    {
+                        close_connection(tag);
+                        continue;
+                    }
+                    if (!connection.eof && (events[i].events & (EPOLLIN | EPOLLRDHUP)))
+                    {
+                        read_requests(tag, connection);
+                    }
+                }
+            }
+            pump_menus();
+            checkout.maybe_checkpoint();
+        }
+
+        pool->stop();
+        std::cout << "Stopping with " << connections.size() << " open connections." << std::endl;
+        checkout.checkpoint();
+        return 0;
+    }
+};
+
+// Клиент сервера: try5 --client=<адрес> читает запросы со стандартного ввода и печатает
+// ответы (с --raw - передаёт ввод и вывод как есть); с --drive=<сценарий> [--drive-repeat=N] [--connections=N] каждое из N соединений
+// проигрывает сценарии и печатается отчёт о задержках, как у драйвера.
+static int run_client(const std::string& address, const DriverOptions& options, size_t connection_count, bool raw)
+{
+    sockaddr_storage storage;
+    socklen_t length;
+    if (!parse_socket_address(address, storage, length))
+    {
+        std::cerr << "Invalid server address " << address << " (expected unix:<path> or tcp:<port>).\n";
+        return 1;
+    }
+    raise_descriptor_limit();
+
+    std::vector<std::vector<std::string>> scripts;  // строки запросов
+    std::vector<std::vector<SessionOp>> script_ops; // операции для отчёта
+    for (const std::string& path : options.scripts)
+    {
+        std::vector<SessionCommand> commands;
+        if (!parse_session_script(path, commands))
+        {
+            return 1;
+        }
+        scripts.emplace_back();
+        script_ops.emplace_back();
+        for (const SessionCommand& command : commands)
+        {
+            scripts.back().push_back(session_command_line(command) + "\n");
+            script_ops.back().push_back(command.op);
+        }
+    }
+    if (scripts.empty() || raw)
+    {
+        connection_count = 1;
+    }
+
+    struct ClientConnection
+    {
+        int fd;
+        std::string input{};
+        std::string output{};
+        size_t session = 0; // номер проигрываемого сценария
+        size_t step = 0;
+        std::chrono::steady_clock::time_point sent_at{};
+    };
+    std::vector<ClientConnection> clients;
+    for (size_t i = 0; i < connection_count; ++i)
+    {
+        int fd = ::socket(storage.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr*>(&storage), length) != 0)
+        {
+            std::cerr << "Failed to connect to " << address << ": " << std::strerror(errno) << "\n";
+            if (fd >= 0) ::close(fd);
+            for (ClientConnection& client : clients) ::close(client.fd);
+            return 1;
+        }
+        clients.push_back({ fd });
+    }
+
+    // --raw: стандартный ввод и вывод как есть, для --serve-menu
+    if (raw)
+    {
+        pollfd ends[2] = { { STDIN_FILENO, POLLIN, 0 }, { clients[0].fd, POLLIN, 0 } };
+        char buffer[4096];
+        for (;;)
+        {
+            if (::poll(ends, 2, -1) < 0)
+            {
+                if (errno == EINTR) continue;
+                break;
+            }
+            if (ends[0].revents & (POLLIN | POLLHUP))
+            {
+                ssize_t count = ::read(STDIN_FILENO, buffer, sizeof(buffer));
+                if (count <= 0)
+                {
+                    ::shutdown(clients[0].fd, SHUT_WR); // сервер допишет вывод и закроет соединение
+                    ends[0].fd = -1;
+                }
+                else if (::send(clients[0].fd, buffer, static_cast<size_t>(count), MSG_NOSIGNAL) < 0)
+                {
+                    break;
+                }
+            }
+            if (ends[1].revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                ssize_t count = ::recv(clients[0].fd, buffer, sizeof(buffer), 0);
+                if (count <= 0)
+                {
+                    break;
+                }
+                std::cout.write(buffer, count);
+                std::cout.flush();
+            }
+        }
+        ::close(clients[0].fd);
+        return 0;
+    }
+
+    // Без сценария - построчный обмен со стандартным вводом
+    if (scripts.empty())
+    {
+        std::string line;
+        char buffer[4096];
+        std::string received;
+        int status = 0;
+        while (std::getline(std::cin, line))
+        {
+            if (line.find_first_not_of(" \t\r") == std::string::npos)
+            {
+                continue; // на пустую строку сервер не отвечает
+            }
+            line += '\n';
+            if (::send(clients[0].fd, line.data(), line.size(), MSG_NOSIGNAL) < 0)
+            {
+                status = 1;
+                break;
+            }
+            size_t end;
+            while ((end = received.find('\n')) == std::string::npos)
+            {
+                ssize_t count = ::recv(clients[0].fd, buffer, sizeof(buffer), 0);
+                if (count <= 0)
+                {
+                    std::cerr << "Connection closed by the server.\n";
+                    ::close(clients[0].fd);
+                    return 1;
+                }
+                received.append(buffer, static_cast<size_t>(count));
+            }
+            std::cout << received.substr(0, end) << std::endl;
+            received.erase(0, end + 1);
+        }
+        ::close(clients[0].fd);
+        return status;
+    }
+
+    SessionStats stats;
+    const size_t sessions_per_connection = scripts.size() * options.repeat;
+    auto send_next = [&](ClientConnection& client) {
+        const std::vector<std::string>& script = scripts[client.session % scripts.size()];
+        client.output += script[client.step];
+        client.sent_at = std::chrono::steady_clock::now();
+    };
+    // Пустые сценарии просто пропускаются
+    auto advance = [&](ClientConnection& client) {
+        while (client.session < sessions_per_connection && client.step >= scripts[client.session % scripts.size()].size())
+        {
+            ++client.session;
+            client.step = 0;
+        }
+        if (client.session < sessions_per_connection) send_next(client);
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+    size_t active = 0;
+    for (ClientConnection& client : clients)
+    {
+        advance(client);
+        active += client.session < sessions_per_connection;
+    }
+
+    std::vector<pollfd> polls(clients.size());
+    char buffer[16384];
+    while (active > 0)
+    {
+        for (size_t i = 0; i < clients.size(); ++i)
+        {
+            bool done = clients[i].session >= sessions_per_connection;
+            polls[i].fd = done ? -1 : clients[i].fd;
+            polls[i].events = static_cast<short>(POLLIN | (clients[i].output.empty() ? 0 : POLLOUT));
+            polls[i].revents = 0;
+        }
+        if (::poll(polls.data(), polls.size(), 10000) <= 0)
+        {
+            std::cerr << "Server stopped responding.\n";
+            break;
+        }
+
+        for (size_t i = 0; i < clients.size(); ++i)
+        {
+            ClientConnection& client = clients[i];
+            if (polls[i].revents & POLLOUT)
+            {
+                ssize_t sent = ::send(client.fd, client.output.data(), client.output.size(), MSG_NOSIGNAL);
+                if (sent > 0) client.output.erase(0, static_cast<size_t>(sent));
+            }
+            if (!(polls[i].revents & (POLLIN | POLLHUP | POLLERR)))
+            {
+                continue;
+            }
+            ssize_t count = ::recv(client.fd, buffer, sizeof(buffer), 0);
+            if (count <= 0)
+            {
+                std::cerr << "Connection " << i << " closed by the server.\n";
+                client.session = sessions_per_connection;
+                --active;
+                continue;
+            }
+            client.input.append(buffer, static_cast<size_t>(count));
+
+            size_t end;
+            while ((end = client.input.find('\n')) != std::string::npos)
+            {
+                double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - client.sent_at).count();
+                size_t op = static_cast<size_t>(script_ops[client.session % scripts.size()][client.step]);
+                stats.latencies[op].push_back(elapsed);
+                if (client.input.compare(0, 3, "ERR") == 0)
+                {
+                    ++stats.failures[op];
+                }
+                client.input.erase(0, end + 1);
+                ++client.step;
+                advance(client);
+                if (client.session >= sessions_per_connection)
+                {
+                    --active;
+                    break;
+                }
+            }
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (ClientConnection& client : clients)
+    {
+        ::close(client.fd);
+    }
+    print_session_report(stats, seconds);
+    return active == 0 ? 0 : 1;
+}
+#endif
+
+// Замеры производительности: try5 --bench [--bench-out=файл] [--bench-filter=подстрока]
+// [--bench-max-users=N] [--bench-seed=N] [--bench-min-time=секунды]
+// Результат - JSON в формате Google Benchmark, его понимает tools/compare.py из этой библиотеки.
+// Все файлы базы пишутся во временный каталог, рабочий каталог не трогается.
+struct BenchOptions
+{
+    std::string out_path;
+    std::string filter;
+    size_t max_users = 1000000;
+    uint64_t seed = 20240601;
+    double min_time = 0.2;
+};
+
+struct BenchResult
+{
+    std::string name;
+    size_t iterations;
+    double seconds;
+    AllocationCounter::Totals allocated; // через pmr за последний прогон
+};
+
+static volatile uint64_t bench_sink = 0; // результаты замеров, чтобы компилятор их не выбросил
+
+// Как в Google Benchmark: число итераций растёт, пока прогон не займёт min_time
+template <typename Body>
+static BenchResult run_bench(const std::string& name, double min_time, Body&& body)
+{
+    size_t iterations = 1;
+    for (;;)
+    {
+        const AllocationCounter::Totals allocated_before = allocation_counter.totals();
+        auto start = std::chrono::steady_clock::now();
+        body(iterations);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (seconds >= min_time || iterations >= 1000000000)
+        {
+            const AllocationCounter::Totals allocated = allocation_counter.totals() - allocated_before;
+            std::cerr << name << ": " << iterations << " iterations, "
+                << seconds * 1e9 / iterations << " ns, "
+                << static_cast<double>(allocated.allocations) / iterations << " allocs, "
+                << static_cast<double>(allocated.bytes) / iterations << " bytes\n";
+            return { name, iterations, seconds, allocated };
+        }
+        double factor = seconds > 0 ? min_time * 1.4 / seconds : 10.0;
+        iterations = std::max(iterations + 1, static_cast<size_t>(iterations * std::min(factor, 10.0)));
+    }
+}
+
+// Детерминированные синтетические данные: одинаковый seed - одинаковые каталог и пользователи
+class BenchDataGenerator
+{
+private:
+    std::mt19937_64 gen;
+
+public:
+    explicit BenchDataGenerator(uint64_t seed) : gen(seed) {}
+
+    void fill_catalog(ProductCatalog& catalog, size_t count)
+    {
+        std::uniform_real_distribution<double> price(1.0, 2000.0);
+        std::uniform_int_distribution<int> discount(0, 30);
+        for (size_t i = 0; i < count; ++i)
+        {
+            catalog.add(Product("Bench Company " + std::to_string(i % 97), "Bench Product " + std::to_string(i),
+                price(gen), discount(gen) / 100.0));
+        }
+    }
+
+    // count разных ID из [1, id_space]
+    std::vector<int> make_ids(size_t count, int id_space)
+    {
+        std::vector<int> ids(id_space);
+        for (int i = 0; i < id_space; ++i) ids[i] = i + 1;
+        std::shuffle(ids.begin(), ids.end(), gen);
+        ids.resize(std::min(count, ids.size()));
+        return ids;
+    }
+
+    User make_user(int id, size_t history, const ProductCatalog& catalog)
+    {
+        std::uniform_real_distribution<double> balance(0.0, 10000.0);
+        std::uniform_int_distribution<uint32_t> product(0, static_cast<uint32_t>(catalog.size() - 1));
+        User user(id, "Bench User " + std::to_string(id), balance(gen));
+        for (size_t i = 0; i < history; ++i)
+        {
+            const Product* bought = catalog.find_by_id(product(gen));
+            user.purchased_products.push_back({ bought->get_id(), static_cast<float>(bought->get_max_discount()),
+                bought->current_price() * (1.0 - bought->get_max_discount()), 1700000000 + static_cast<int64_t>(i) });
+        }
+        return user;
+    }
+
+    // Пользователи с id, выданными таблицей, как при регистрации
+    void fill_users(UserTable& users, size_t count, size_t history, const ProductCatalog& catalog)
+    {
+        users.clear();
+        for (size_t i = 0; i < count; ++i)
+        {
+            users.insert(make_user(users.allocate_id(), history, catalog));
+        }
+    }
+};
+
+// Пустая база во временном каталоге: снимки, журнал и users закрываются и очищаются
+static void reset_bench_store(const std::filesystem::path& dir)
+{
+    journal.close();
+    user_db.close();
+    users.clear();
+    for (const auto& entry : std::filesystem::directory_iterator(dir))
+    {
+        std::filesystem::remove(entry.path());
+    }
+    load_users_from_file(users);
+}
+
+static std::string json_escape(const std::string& text)
+{
+    std::string escaped;
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            escaped += '\\';
+            escaped += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            char code[8];
+            std::snprintf(code, sizeof(code), "\\u%04x", c);
+            escaped += code;
+        }
+        else
+        {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+static void write_bench_json(std::ostream& out, const char* executable, const BenchOptions& options,
+    const std::vector<BenchResult>& results)
+{
+    char date[32] = "";
+    std::time_t now = std::time(nullptr);
+    std::tm local{};
+#ifdef _WIN32
+    localtime_s(&local, &now);
+#else
+    localtime_r(&now, &local);
+#endif
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &local);
+
+    out << "{\n  \"context\": {\n"
+        << "    \"date\": \"" << date << "\",\n"
+        << "    \"executable\": \"" << json_escape(executable) << "\",\n"
+        << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n"
+#ifdef NDEBUG
+        << "    \"library_build_type\": \"release\",\n"
+#else
+        << "    \"library_build_type\": \"debug\",\n"
+#endif
+        << "    \"seed\": " << options.seed << ",\n"
+        << "    \"catalog_perfect_hash\": " << CATALOG_PERFECT_HASH << ",\n"
+        << "    \"store_metrics\": " << STORE_METRICS << ",\n"
+        << "    \"store_tracing\": " << STORE_TRACING << "\n"
+        << "  },\n  \"benchmarks\": [";
+    out << std::setprecision(6) << std::fixed;
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const BenchResult& r = results[i];
+        double ns = r.seconds * 1e9 / r.iterations;
+        out << (i ? ",\n" : "\n")
+            << "    {\n"
+            << "      \"name\": \"" << json_escape(r.name) << "\",\n"
+            << "      \"run_name\": \"" << json_escape(r.name) << "\",\n"
+            << "      \"run_type\": \"iteration\",\n"
+            << "      \"iterations\": " << r.iterations << ",\n"
+            << "      \"real_time\": " << ns << ",\n"
+            << "      \"cpu_time\": " << ns << ",\n"
+            << "      \"time_unit\": \"ns\",\n"
+            << "      \"allocs_per_iter\": " << static_cast<double>(r.allocated.allocations) / r.iterations << ",\n"
+            << "      \"bytes_per_iter\": " << static_cast<double>(r.allocated.bytes) / r.iterations << "\n"
+            << "    }";
+    }
+    out << "\n  ]\n}\n";
+}
+
+static int run_benchmarks(const char* executable, const BenchOptions& options)
+{
+    std::vector<BenchResult> results;
+    auto wanted = [&](const std::string& name) {
+        return options.filter.empty() || name.find(options.filter) != std::string::npos;
+    };
+
+    std::filesystem::path out_path;
+    if (!options.out_path.empty())
+    {
+        out_path = std::filesystem::absolute(options.out_path);
+    }
+    const std::filesystem::path previous_dir = std::filesystem::current_path();
+    const std::filesystem::path dir = std::filesystem::temp_directory_path() /
+        ("try5-bench-" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()));
+    std::filesystem::create_directories(dir);
+    std::filesystem::current_path(dir);
+
+    JournalConfig config;
+    config.sync = JournalSync::None;
+    journal.set_config(config);
+
+    BenchDataGenerator data(options.seed);
+    data.fill_catalog(catalog, 10000);
+    catalog.freeze();
+    bool failed = false; // проверка результата в одном из замеров не прошла
+
+    // Покупка: баланс не кончается, история очищается, чтобы не расти без предела
+    if (wanted("User::purchase_product"))
+    {
+        User buyer(1, "Bench Buyer", 1e300);
+        std::vector<Product> basket;
+        for (uint32_t id = 0; id < 64; ++id)
+        {
+            basket.push_back(*catalog.find_by_id(id));
+        }
+        results.push_back(run_bench("User::purchase_product", options.min_time, [&](size_t n) {
+            for (size_t i = 0; i < n; ++i)
+            {
+                if (buyer.purchased_products.size() == 65536)
+                {
+                    buyer.purchased_products.clear();
+                }
+                bench_sink = bench_sink + buyer.purchase_product(basket[i % basket.size()], 0);
+            }
+        }));
+    }
+
+    // Цена замера одной операции: счётчик вызовов и каждый 16-й раз чтение часов
+    if (wanted("OperationTimer/purchase_product"))
+    {
+        results.push_back(run_bench("OperationTimer/purchase_product", options.min_time, [&](size_t n) {
+            for (size_t i = 0; i < n; ++i)
+            {
+                OperationTimer timer(MetricOp::PurchaseProduct);
+            }
+        }));
+    }
+
+    // Участок трассы, когда трасса выключена: столько стоит каждый участок на пути покупки
+    if (wanted("TraceSpan/disabled"))
+    {
+        results.push_back(run_bench("TraceSpan/disabled", options.min_time, [&](size_t n) {
+            for (size_t i = 0; i < n; ++i)
+            {
+                TraceSpan span("bench");
+            }
+        }));
+    }
+
+    // Покупка через CheckoutService, журнал закрыт: путь покупки с замером операций
+    // (сравнивать со сборкой STORE_METRICS=0)
+    if (wanted("CheckoutService::purchase"))
+    {
+        UserTable buyers;
+        CheckoutService service(catalog, buyers);
+        std::vector<int> ids;
+        for (int i = 0; i < 1024; ++i)
+        {
+            ids.push_back(service.sign_up("Bench Buyer", 1e300));
+        }
+        results.push_back(run_bench("CheckoutService::purchase", options.min_time, [&](size_t n) {
+            for (size_t i = 0; i < n; ++i)
+            {
+                if (i % 65536 == 65535)
+                {
+                    for (int id : ids)
+                    {
+                        service.with_user(id, [](UserRef user) { user.purchased_products().clear(); });
+                    }
+                }
+                bench_sink = bench_sink + (service.purchase(ids[i % ids.size()], static_cast<uint32_t>(i % 64)).status == CheckoutStatus::Ok);
+            }
+        }));
+    }
+
+    for (const char* kind : { "hit", "miss" })
+    {
+        const std::string name = std::string("ProductCatalog::find_by_title/") + kind + "/10000";
+        if (!wanted(name)) continue;
+        std::vector<std::string> titles;
+        for (int i = 0; i < 1024; ++i)
+        {
+            titles.push_back((kind[0] == 'h' ? "Bench Product " : "Missing Product ") + std::to_string(i * 9 % 10000));
+        }
+        results.push_back(run_bench(name, options.min_time, [&](size_t n) {
+            for (size_t i = 0; i < n; ++i)
+            {
+                bench_sink = bench_sink + (catalog.find_by_title(titles[i & 1023]) != nullptr);
+            }
+        }));
+    }
+
+    // Поиск по словам: точное слово, начало слова и слово с переставленными буквами
+    for (size_t count : { size_t(10000), size_t(1000000) })
+    {
+        ProductCatalog searched;
+        const ProductCatalog& products = count == catalog.size() ? catalog : searched;
+        for (const char* kind : { "exact", "prefix", "typo" })
+        {
+            const std::string name = std::string("ProductCatalog::search/") + kind + "/" + std::to_string(count);
+            if (!wanted(name)) continue;
+            if (products.size() != count)
+            {
+                BenchDataGenerator(options.seed).fill_catalog(searched, count);
+            }
+            std::vector<std::string> queries;
+            for (size_t i = 0; i < 1024; ++i)
+            {
+                std::string number = std::to_string(i * 7919 % count);
+                queries.push_back(kind[0] == 'e' ? "product " + number :
+                    kind[0] == 'p' ? "prod " + number.substr(0, 3) : "prodcut " + number);
+            }
+            results.push_back(run_bench(name, options.min_time, [&](size_t n) {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    bench_sink = bench_sink + products.search(queries[i & 1023], SEARCH_RESULTS).size();
+                }
+            }));
+        }
+    }
+
+    // Аналитика продаж: покупки идут по 64 в секунду, так что окна всё время сдвигаются
+    if (wanted("SalesAnalytics::record"))
+    {
+        SalesAnalytics analytics;
+        std::mt19937_64 gen(options.seed);
+        uint64_t sold = 0;
+        results.push_back(run_bench("SalesAnalytics::record", options.min_time, [&](size_t n) {
+            for (size_t i = 0; i < n; ++i, ++sold)
+            {
+                analytics.record({ static_cast<uint32_t>(gen() % catalog.size()), 0.1f, 10.0,
+                    1700000000 + static_cast<int64_t>(sold / 64) });
+            }
+        }));
+    }
+
+    // Лидеры окна после миллиона покупок за сутки
+    for (size_t w = 0; w < SALES_WINDOW_COUNT; ++w)
+    {
+        const std::string name = std::string("SalesAnalytics::top_sellers/") + SALES_WINDOWS[w].name;
+        if (!wanted(name)) continue;
+        SalesAnalytics analytics;
+        std::mt19937_64 gen(options.seed);
+        const int64_t day = 86400;
+        for (int64_t i = 0; i < 1000000; ++i)
+        {
+            analytics.record({ static_cast<uint32_t>(gen() % catalog.size()), 0.1f, 10.0, 1700000000 + i * day / 1000000 });
+        }
+        results.push_back(run_bench(name, options.min_time, [&](size_t n) {
+            for (size_t i = 0; i < n; ++i)
+            {
+                bench_sink = bench_sink + analytics.top_sellers(w, 10, 1700000000 + day).size();
+            }
+        }));
+    }
+
+    // Восстановление аналитики по историям count пользователей (по 4 покупки)
+    for (size_t count : { size_t(100000), size_t(1000000) })
+    {
+        const std::string name = "SalesAnalytics::rebuild/" + std::to_string(count);
+        if (count > options.max_users || !wanted(name)) continue;
+        data.fill_users(users, count, 4, catalog);
+        SalesAnalytics analytics;
+        UserDatabase no_snapshot;
+        results.push_back(run_bench(name, options.min_time, [&](size_t n) {
+            for (size_t i = 0; i < n; ++i)
+            {
+                bench_sink = bench_sink + analytics.rebuild(users, no_snapshot, std::thread::hardware_concurrency());
+            }
+        }));
+        users.clear();
+    }
+
+    // Кольцо событий в одном потоке: пачка из 256 публикаций, затем её читают consumers
+    // читателей; итерация - одно событие
+    for (size_t consumers : { size_t(1), size_t(3) })
+    {
+        const std::string name = "EventRing::publish+drain/" + std::to_string(consumers) + "c";
+        if (!wanted(name)) continue;
+        EventRing ring(1 << 16, Backpressure::Block);
+        std::vector<size_t> readers;
+        for (size_t c = 0; c < consumers; ++c)
+        {
+            readers.push_back(ring.add_consumer());
+        }
+        results.push_back(run_bench(name, options.min_time, [&](size_t n) {
+            for (size_t done = 0; done < n;)
+            {
+                size_t chunk = std::min<size_t>(256, n - done);
+                for (size_t i = 0; i < chunk; ++i)
+                {
+                    ring.publish({ StoreEventType::Purchase, 0.1f, static_cast<int32_t>(done + i), 1, 10.0, 1700000000 });
+                }
+                for (size_t reader : readers)
+                {
+                    ring.drain(reader, chunk, [](const StoreEvent* events, size_t count) {
+                        bench_sink = bench_sink + events[count - 1].user_id;
+                    });
+                }
+                done += chunk;
+            }
+        }));
+    }
+
+    // Кольцо событий под нагрузкой: 4 потока публикуют, 2 читателя в своих потоках;
+    // замер до момента, когда оба прочитали всё
+    if (wanted("EventRing::threads/4p2c"))
+    {
+        results.push_back(run_bench("EventRing::threads/4p2c", options.min_time, [&](size_t n) {
+            EventRing ring(1 << 16, Backpressure::Block);
+            std::atomic<uint64_t> read{ 0 };
+            EventConsumer first(ring);
+            EventConsumer second(ring);
+            for (EventConsumer* consumer : { &first, &second })
+            {
+                consumer->start([&](const StoreEvent*, size_t count) { read.fetch_add(count, std::memory_order_relaxed); });
+            }
+            std::vector<std::thread> producers;
+            for (size_t t = 0; t < 4; ++t)
+            {
+                producers.emplace_back([&, t] {
+                    for (size_t i = t; i < n; i += 4)
+                    {
+                        ring.publish({ StoreEventType::Purchase, 0.1f, static_cast<int32_t>(i), 1, 10.0, 1700000000 });
+                    }
+                });
+            }
+            for (std::thread& producer : producers)
+            {
+                producer.join();
+            }
+            first.catch_up();
+            second.catch_up();
+            bench_sink = bench_sink + read.load();
+        }));
+    }
+
+    // Цена на момент времени: история из count ежедневных изменений цены (случайное
+    // блуждание с шагом в копейку), запросы - случайные моменты внутри истории
+    for (size_t count : { size_t(1000), size_t(1000000) })
+    {
+        const std::string name = "PriceHistory::price_at/" + std::to_string(count);
+        if (!wanted(name)) continue;
+        PriceHistory history;
+        std::mt19937_64 gen(options.seed);
+        std::uniform_int_distribution<int> step(-500, 500);
+        double price = 1000.0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            price = std::max(1.0, std::round((price + step(gen) / 100.0) * 100.0) / 100.0);
+            history.append(1700000000 + static_cast<int64_t>(i) * 86400, price);
+        }
+        std::uniform_int_distribution<int64_t> moment(1700000000, 1700000000 + static_cast<int64_t>(count) * 86400);
+        std::vector<int64_t> moments(1024);
+        for (int64_t& time : moments) time = moment(gen);
+        results.push_back(run_bench(name, options.min_time, [&](size_t n) {
+            double sink = 0;
+            for (size_t i = 0; i < n; ++i)
+            {
+                double at = 0;
+                history.price_at(moments[i & 1023], at);
+                sink += at;
+            }
+            bench_sink = bench_sink + static_cast<uint64_t>(sink);
+        }));
+    }
+
+    // Переоценка всего каталога, итерация - один проход по 10000 товарам (+1%)
+    if (wanted("ProductCatalog::reprice_all/10000"))
+    {
+        ProductCatalog priced;
+        BenchDataGenerator(options.seed).fill_catalog(priced, 10000);
+        int64_t time = 1700000000;
+        results.push_back(run_bench("ProductCatalog::reprice_all/10000", options.min_time, [&](size_t n) {
+            for (size_t i = 0; i < n; ++i)
+            {
+                priced.reprice_all([](const Product& product) {
+                    return std::round(product.current_price() * 101.0) / 100.0;
+                }, time += 3600);
+            }
+        }));
+    }
+
+    // Проигрывание журнала из 1000 регистраций. Имена с табуляцией, переводом строки и
+    // обратной косой заодно проверяют экранирование: проигранные имена должны совпасть.
+    if (wanted("replay_journal/1000"))
+    {
+        reset_bench_store(dir);
+        const std::string names[] = { "Ann\tLee", "Two\nLines", "Back\\slash\\t", "Plain Name" };
+        std::vector<int> ids;
+        for (size_t i = 0; i < 1000; ++i)
+        {
+            ids.push_back(users.allocate_id());
+            journal.append_sign_up(ids.back(), names[i % 4], 100.0);
+        }
+        journal.sync();
+        const std::string path = journal_segment_path(1);
+        UserTable replayed;
+        results.push_back(run_bench("replay_journal/1000", options.min_time, [&](size_t n) {
+            for (size_t i = 0; i < n; ++i)
+            {
+                replayed.clear();
+                bench_sink = bench_sink + replay_journal(path, replayed, 0);
+            }
+        }));
+        for (size_t i = 0; i < ids.size(); ++i)
+        {
+            UserRef user = replayed.find(ids[i]);
+            if (!user || std::string_view(user.full_name()) != names[i % 4])
+            {
+                std::cerr << "replay_journal: user " << ids[i] << " did not survive the journal round trip.\n";
+                failed = true;
+                break;
+            }
+        }
+    }
+
+    // Сохранение и загрузка базы: у каждого пользователя 4 покупки
+    for (size_t count : { size_t(1000), size_t(100000), size_t(1000000) })
+    {
+        const std::string suffix = "/" + std::to_string(count);
+        if (count > options.max_users ||
+            !(wanted("save_users_to_file" + suffix) || wanted("load_users_from_file" + suffix)))
+        {
+            continue;
+        }
+        reset_bench_store(dir);
+        data.fill_users(users, count, 4, catalog);
+        std::vector<int> ids;
+        users.for_each([&](UserRef user) { ids.push_back(user.id()); });
+
+        if (wanted("save_users_to_file" + suffix))
+        {
+            results.push_back(run_bench("save_users_to_file" + suffix, options.min_time, [&](size_t n) {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    save_users_to_file(users);
+                }
+            }));
+        }
+        else
+        {
+            save_users_to_file(users);
+        }
+
+        // Загрузка только отображает снимок; второй замер ещё и читает всех пользователей.
+        // Таблица users очищается заранее, чтобы не мерить освобождение сгенерированных данных.
+        users.clear();
+        if (wanted("load_users_from_file" + suffix))
+        {
+            results.push_back(run_bench("load_users_from_file" + suffix, options.min_time, [&](size_t n) {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    load_users_from_file(users);
+                    bench_sink = bench_sink + user_db.user_count();
+                }
+            }));
+        }
+        if (wanted("load_users_from_file+materialize" + suffix))
+        {
+            results.push_back(run_bench("load_users_from_file+materialize" + suffix, options.min_time, [&](size_t n) {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    load_users_from_file(users);
+                    for (int id : ids)
+                    {
+                        bench_sink = bench_sink + static_cast<bool>(find_user(users, id));
+                    }
+                }
+            }));
+        }
+    }
+
+    // Выдача id из нескольких потоков сразу: n выдач делятся между потоками
+    for (unsigned threads : { 1u, 4u, 8u })
+    {
+        const std::string name = "UserTable::allocate_id/threads:" + std::to_string(threads);
+        if (!wanted(name)) continue;
+        UserTable table;
+        results.push_back(run_bench(name, options.min_time, [&](size_t n) {
+            table.clear();
+            std::vector<int> sinks(threads);
+            std::vector<std::thread> workers;
+            for (unsigned t = 0; t < threads; ++t)
+            {
+                workers.emplace_back([&table, &sinks, n, threads, t] {
+                    int sink = 0;
+                    for (size_t i = t; i < n; i += threads)
+                    {
+                        sink ^= table.allocate_id();
+                    }
+                    sinks[t] = sink;
+                });
+            }
+            for (unsigned t = 0; t < threads; ++t)
+            {
+                workers[t].join();
+                bench_sink = bench_sink + sinks[t];
+            }
+        }));
+    }
+
+    // Поиск пользователя по новому id (номер ячейки) и по старому случайному id (хеш)
+    const size_t lookup_count = std::min<size_t>(1000000, options.max_users);
+    for (bool dense : { true, false })
+    {
+        const std::string name = std::string("UserTable::find/") + (dense ? "dense" : "legacy") + "/" +
+            std::to_string(lookup_count);
+        if (!wanted(name)) continue;
+        UserTable table;
+        std::vector<int> ids = dense ? std::vector<int>() : data.make_ids(lookup_count, LEGACY_USER_ID_MAX);
+        for (size_t i = 0; i < lookup_count; ++i)
+        {
+            if (dense) ids.push_back(table.allocate_id());
+            table.insert(User(ids[i], "", 0.0));
+        }
+        std::shuffle(ids.begin(), ids.end(), std::mt19937_64(options.seed));
+        results.push_back(run_bench(name, options.min_time, [&](size_t n) {
+            for (size_t i = 0; i < n; ++i)
+            {
+                bench_sink = bench_sink + static_cast<bool>(table.find(ids[i % ids.size()]));
+            }
+        }));
+    }
+
+    // Массовые операции с балансами, итерация - проход по всем пользователям: сумма балансов
+    // и начисление процентов. rows - пользователи целиком подряд (как User лежал в таблице
+    // до разделения на столбцы), columns - горячие столбцы UserTable; у каждого 4 покупки.
+    const size_t balance_count = std::min<size_t>(1000000, options.max_users);
+    const std::pair<const char*, bool> layouts[] = { { "rows", false }, { "columns", true } };
+    std::vector<std::pair<std::string, std::string>> balance_names; // сумма и проценты
+    bool any_balance = false;
+    for (const auto& layout : layouts)
+    {
+        std::string suffix = std::string("/") + layout.first + "/" + std::to_string(balance_count);
+        balance_names.emplace_back("balance_sum" + suffix, "balance_interest" + suffix);
+        any_balance = any_balance || wanted(balance_names.back().first) || wanted(balance_names.back().second);
+    }
+    if (any_balance)
+    {
+        std::vector<User> rows;
+        rows.reserve(balance_count);
+        UserTable table;
+        for (size_t i = 0; i < balance_count; ++i)
+        {
+            rows.push_back(data.make_user(table.allocate_id(), 4, catalog));
+            table.insert(rows.back());
+        }
+
+        for (size_t l = 0; l < 2; ++l)
+        {
+            const bool columns = layouts[l].second;
+            if (wanted(balance_names[l].first))
+            {
+                results.push_back(run_bench(balance_names[l].first, options.min_time, [&](size_t n) {
+                    double total = 0;
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        if (columns)
+                        {
+                            table.for_each_balance([&](int, double& balance, double) { total += balance; });
+                        }
+                        else
+                        {
+                            for (const User& user : rows) total += user.account_balance;
+                        }
+                    }
+                    bench_sink = bench_sink + static_cast<uint64_t>(total);
+                }));
+            }
+            if (wanted(balance_names[l].second))
+            {
+                results.push_back(run_bench(balance_names[l].second, options.min_time, [&](size_t n) {
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        if (columns)
+                        {
+                            table.for_each_balance([](int, double& balance, double discount) {
+                                balance += balance * 0.0001 * (1.0 + discount);
+                            });
+                        }
+                        else
+                        {
+                            for (User& user : rows) user.account_balance += user.account_balance * 0.0001 * (1.0 + user.discount);
+                        }
+                    }
+                }));
+            }
+        }
+    }
+
+    journal.close();
+    user_db.close();
+    users.clear();
+    std::filesystem::current_path(previous_dir);
+    std::error_code error;
+    std::filesystem::remove_all(dir, error);
+
+    if (out_path.empty())
+    {
+        write_bench_json(std::cout, executable, options, results);
+        return failed ? 1 : 0;
+    }
+    std::ofstream out(out_path);
+    write_bench_json(out, executable, options, results);
+    if (!out)
+    {
+        std::cerr << "Failed to write " << out_path.string() << ".\n";
+        return 1;
+    }
+    return failed ? 1 : 0;
+}
+
+// Отчёт о продажах по базе текущего каталога: аналитика восстанавливается по историям
+// всех пользователей, как при запуске магазина, и печатается вместе со временем восстановления
+static int run_sales_report()
+{
+    load_users_from_file(users);
+    const size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    auto start = std::chrono::steady_clock::now();
+    uint64_t purchases = sales.rebuild(users, user_db, threads);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "Rebuilt from " << purchases << " purchases in " << seconds * 1000 << " ms, "
+        << threads << " threads\n";
+    std::cout << "Revenue: " << std::fixed << std::setprecision(2) << sales.total_revenue() << "\n";
+    std::cout << "Average discount: " << sales.average_discount() * 100 << "%\n";
+    std::cout << "Top companies by revenue:\n";
+    std::vector<std::pair<InternedString, double>> companies = sales.revenue_by_company();
+    for (size_t i = 0; i < companies.size() && i < 5; ++i)
+    {
+        std::cout << "  " << companies[i].first.str() << ": " << companies[i].second << "\n";
+    }
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << std::setprecision(6);
+
+    // Окна отсчитываются от последней покупки в базе, а не от текущего времени
+    int64_t latest = 0;
+    users.for_each([&](UserRef user) {
+        for (const PurchaseRecord& record : user.purchased_products()) latest = std::max(latest, record.timestamp);
+    });
+    User stored;
+    for (size_t i = 0; i < user_db.user_count(); ++i)
+    {
+        if (!users.find(user_db.id_at(i)) && user_db.load_at(i, stored))
+        {
+            for (const PurchaseRecord& record : stored.purchased_products) latest = std::max(latest, record.timestamp);
+        }
+    }
+    for (size_t w = 0; w < SALES_WINDOW_COUNT; ++w)
+    {
+        std::cout << "Top sellers, last " << SALES_WINDOWS[w].name << ":\n";
+        for (const SalesRank& rank : sales.top_sellers(w, 10, latest))
+        {
+            const Product* product = catalog.find_by_id(rank.product_id);
+            std::cout << "  " << (product ? product->getTitle() : "?") << ": " << rank.units << "\n";
+        }
+    }
+    return 0;
+}
+
+// Память под названия товаров: строки в каждом товаре (как было до пула строк) против
+// номеров из string_pool. Каталог синтетический: product_count товаров с уникальными
+// названиями у product_count / 100 компаний. Числа - оценка по размерам структур
+// (узел unordered_map - указатель, ключ, значение и сохранённый хеш).
+static int run_memory_report(size_t product_count)
+{
+    const size_t company_count = std::max<size_t>(1, product_count / 100);
+    const size_t pool_before = string_pool.memory_usage();
+    const size_t pool_strings_before = string_pool.size();
+
+    ProductCatalog report_catalog;
+    for (size_t i = 0; i < product_count; ++i)
+    {
+        report_catalog.add(Product("Report Company " + std::to_string(i % company_count),
+            "Report Product " + std::to_string(i), 1.0 + i % 1000, 0.1));
+    }
+
+    auto heap = [](const std::string& text) {
+        return text.capacity() > std::string().capacity() ? text.capacity() + 1 : 0;
+    };
+
+    size_t product_strings = 0, index_strings = 0, db_strings = 0, db_interned = 0;
+    std::vector<bool> written(string_pool.size());
+    for (uint32_t id = 0; id < report_catalog.size(); ++id)
+    {
+        const Product* product = report_catalog.find_by_id(id);
+        // Копии названий в товаре и в ключе индекса по названию
+        product_strings += 2 * sizeof(std::string) + heap(product->getCompany()) + heap(product->getTitle());
+        index_strings += sizeof(void*) + sizeof(std::pair<const std::string, uint32_t>) + sizeof(size_t) +
+            heap(product->getTitle());
+        db_strings += product->getCompany().size() + product->getTitle().size();
+        for (InternedString text : { product->company_handle(), product->title_handle() })
+        {
+            if (!written[text.id()])
+            {
+                written[text.id()] = true;
+                db_interned += text.str().size();
+            }
+        }
+    }
+    index_strings += product_count * sizeof(void*); // корзины при коэффициенте заполнения 1
+
+    const size_t product_interned = product_count * 2 * sizeof(InternedString) +
+        (string_pool.memory_usage() - pool_before);
+    const size_t index_interned = report_catalog.title_index_memory();
+
+    auto megabytes = [](size_t bytes) {
+        std::ostringstream text;
+        text << std::fixed << std::setprecision(2) << bytes / 1048576.0 << " MB";
+        return text.str();
+    };
+    std::cout << "Memory report: " << product_count << " products, " << company_count << " companies, "
+        << string_pool.size() - pool_strings_before << " strings added to the pool\n";
+    std::cout << std::left << std::setw(28) << "" << std::right << std::setw(14) << "strings"
+        << std::setw(14) << "interned" << "\n";
+    const std::pair<const char*, std::pair<size_t, size_t>> rows[] = {
+        { "Product names", { product_strings, product_interned } },
+        { "Catalog title index", { index_strings, index_interned } },
+        { "users.db product strings", { db_strings, db_interned } },
+        { "Total", { product_strings + index_strings + db_strings, product_interned + index_interned + db_interned } },
+    };
+    for (const auto& row : rows)
+    {
+        std::cout << std::left << std::setw(28) << row.first << std::right << std::setw(14)
+            << megabytes(row.second.first) << std::setw(14) << megabytes(row.second.second) << "\n";
+    }
+    return 0;
+}
+
+static BenchOptions parse_bench_options(int argc, char* argv[])
+{
+    BenchOptions options;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg.rfind("--bench-out=", 0) == 0)
+        {
+            options.out_path = arg.substr(12);
+        }
+        else if (arg.rfind("--bench-filter=", 0) == 0)
+        {
+            options.filter = arg.substr(15);
+        }
+        else if (arg.rfind("--bench-max-users=", 0) == 0)
+        {
+            options.max_users = std::stoull(arg.substr(18));
+        }
+        else if (arg.rfind("--bench-seed=", 0) == 0)
+        {
+            options.seed = std::stoull(arg.substr(13));
+        }
+        else if (arg.rfind("--bench-min-time=", 0) == 0)
+        {
+            options.min_time = std::stod(arg.substr(17));
+        }
+    }
+    return options;
+}
+
+static JournalConfig parse_journal_config(int argc, char* argv[])
+{
+    JournalConfig config;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg.rfind("--checkpoint-records=", 0) == 0)
+        {
+            checkpointer.set_interval(std::stoull(arg.substr(21)));
+        }
+        else if (arg == "--journal-sync=none")
+        {
+            config.sync = JournalSync::None;
+        }
+        else if (arg == "--journal-sync=always")
+        {
+            config.sync = JournalSync::EveryRecord;
+        }
+        else if (arg == "--journal-sync=group")
+        {
+            config.sync = JournalSync::Group;
+        }
+        else if (arg.rfind("--journal-group=", 0) == 0)
+        {
+            config.group_records = std::max<size_t>(1, std::stoul(arg.substr(16)));
+        }
+    }
+    return config;
+}
+
+int main(int argc, char* argv[])
+{
+    std::pmr::set_default_resource(&allocation_counter); // pmr-память без своей арены тоже учитывается
+
+#ifdef __linux__
+    // Сервер ждёт SIGINT и SIGTERM в signalfd: блокируем их раньше, чем main и open_store
+    // запустят потоки (статистика, трасса, журнал, аналитика продаж)
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::string(argv[i]).rfind("--serve", 0) == 0)
+        {
+            const sigset_t signals = SessionServer::stop_signals();
+            pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+            break;
+        }
+    }
+#endif
+
+    // Конвертация старой базы: try5 --convert-users users.txt
+    if (argc == 3 && std::string(argv[1]) == "--convert-users")
+    {
+        return convert_text_users(argv[2]) ? 0 : 1;
+    }
+
+    // Замеры вместо меню: try5 --bench
+    if (argc >= 2 && std::string(argv[1]) == "--bench")
+    {
+        return run_benchmarks(argv[0], parse_bench_options(argc, argv));
+    }
+
+    // Память под названия товаров со строками и с пулом строк: try5 --memory-report[=N]
+    if (argc == 2 && std::string(argv[1]).rfind("--memory-report", 0) == 0)
+    {
+        std::string arg = argv[1];
+        return run_memory_report(arg.size() > 16 && arg[15] == '=' ? std::stoull(arg.substr(16)) : 100000);
+    }
+
+    journal.set_config(parse_journal_config(argc, argv));
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg.rfind("--record=", 0) == 0 && !recorder.open(arg.substr(9)))
+        {
+            std::cerr << "Failed to open " << arg.substr(9) << " for writing.\n";
+            return 1;
+        }
+        if (arg == "--event-backpressure=drop")
+        {
+            store_events.set_backpressure(Backpressure::Drop);
+        }
+        if (arg.rfind("--stats-file=", 0) == 0)
+        {
+            double interval = 10.0;
+            for (int j = 1; j < argc; ++j)
+            {
+                std::string other = argv[j];
+                if (other.rfind("--stats-interval=", 0) == 0) interval = std::stod(other.substr(17));
+            }
+            metrics_dumper.start(arg.substr(13), interval);
+        }
+#if STORE_TRACING
+        if (arg.rfind("--trace=", 0) == 0)
+        {
+            uint64_t sample_every = 1;
+            for (int j = 1; j < argc; ++j)
+            {
+                std::string other = argv[j];
+                if (other.rfind("--trace-sample=", 0) == 0) sample_every = std::stoull(other.substr(15));
+            }
+            if (!tracer.open(arg.substr(8), sample_every))
+            {
+                std::cerr << "Failed to open " << arg.substr(8) << " for writing.\n";
+                return 1;
+            }
+        }
+#endif
+        if (arg.rfind("--audit=", 0) == 0 && !audit.open(arg.substr(8)))
+        {
+            std::cerr << "Failed to open " << arg.substr(8) << " for writing.\n";
+            return 1;
+        }
+    }
+
+    catalog.add(Product("Company 1", "Product 1", 10.0, 1));
+    catalog.add(Product("Company 2", "Product 2", 20.0, 0.2));
+    catalog.add(Product("Company 3", "Product 3", 30.0, 0.3));
+    catalog.freeze();
+
+    // Сценарии и синтетическая нагрузка вместо меню
+    DriverOptions driver = parse_driver_options(argc, argv);
+    std::string serve_address;
+    std::string client_address;
+    bool serve_menu = false;
+    bool raw_client = false;
+    size_t workers = 4;
+    size_t connections = 1;
+    size_t menu_sessions = 0;
+    std::string import_path;
+    bool sales_report = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg.rfind("--import-users=", 0) == 0) import_path = arg.substr(15);
+        else if (arg == "--sales-report") sales_report = true;
+        else if (arg.rfind("--serve=", 0) == 0) serve_address = arg.substr(8);
+        else if (arg.rfind("--serve-menu=", 0) == 0) serve_address = arg.substr(13), serve_menu = true;
+        else if (arg == "--raw") raw_client = true;
+        else if (arg.rfind("--menu-sessions=", 0) == 0) menu_sessions = std::stoull(arg.substr(16));
+        else if (arg.rfind("--client=", 0) == 0) client_address = arg.substr(9);
+        else if (arg.rfind("--workers=", 0) == 0) workers = std::max<size_t>(1, std::stoull(arg.substr(10)));
+        else if (arg.rfind("--connections=", 0) == 0) connections = std::max<size_t>(1, std::stoull(arg.substr(14)));
+    }
+    if (!import_path.empty())
+    {
+        return import_text_users(import_path) ? 0 : 1;
+    }
+    if (sales_report)
+    {
+        return run_sales_report();
+    }
+    if (!serve_address.empty() || !client_address.empty())
+    {
+#ifdef __linux__
+        if (!client_address.empty())
+        {
+            return run_client(client_address, driver, connections, raw_client);
+        }
+        open_store();
+        SessionServer server(serve_address, serve_menu);
+        return server.run(workers);
+#else
+        std::cerr << "Server mode needs epoll and is only available on Linux.\n";
+        return 1;
+#endif
+    }
+    if (!driver.scripts.empty() || driver.load)
+    {
+        return run_driver(driver);
+    }
+    if (menu_sessions > 0)
+    {
+        return run_menu_sessions(menu_sessions);
+    }
+
+    main_menu();
+    return 0;
+}